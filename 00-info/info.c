@@ -3,16 +3,53 @@
 // Query basic opencl information from the system.
 // If you need more, use clinfo
 //
+// With -m, also measure what each device delivers: transfer bandwidth
+// across sizes (pageable vs pinned host memory, map/unmap vs read/write,
+// device to device copies), kernel launch and clFinish latency.
+//
 
 // compile with: gcc -Wall -o info info.c -lOpenCL
 
+#define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <CL/cl.h>
 
 #define EXENAME "info"
 
+#define REPS        5           // timed runs per transfer, the best one is kept
+#define LAT_REPS    1000        // launches / clFinish per latency measure
+
+static const size_t sizes[] = {4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024, 128 * 1024 * 1024};
+
+#define NSIZES      (sizeof(sizes) / sizeof(sizes[0]))
+
+#define OP_WRITE        0       // clEnqueueWriteBuffer from malloc'ed memory
+#define OP_READ         1       // clEnqueueReadBuffer to malloc'ed memory
+#define OP_WRITE_PINNED 2       // same from a mapped CL_MEM_ALLOC_HOST_PTR buffer
+#define OP_READ_PINNED  3
+#define OP_MAP_WRITE    4       // map, memcpy in, unmap
+#define OP_MAP_READ     5       // map, memcpy out, unmap
+#define OP_COPY         6       // clEnqueueCopyBuffer, read + write bytes
+#define NOPS            7
+
+static const char *opNames[NOPS] = {"h2d", "d2h", "h2d pin", "d2h pin", "map wr", "map rd", "d2d"};
+
+const char *kernel_empty = "__kernel void empty(void) {}";
+
+struct measure
+{
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_mem dev[2];
+    cl_mem pinned;
+    void *host;                 // pageable
+    void *pin;                  // pinned: pinned buffer mapped once
+};
+
 char *getPlateformString(cl_platform_id id, cl_platform_info info)
 {
     cl_int err;
@@ -73,12 +110,354 @@ char *getDeviceString(cl_device_id id, cl_device_info info)
     return s;
 }
 
+static double wallTime()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// one blocking transfer of size bytes, in seconds, < 0 on error
+static double runOp(struct measure *m, int op, size_t size)
+{
+    cl_int err;
+    double start;
+    void *p;
+
+    start = wallTime();
+
+    switch (op)
+    {
+    case OP_WRITE:
+    case OP_WRITE_PINNED:
+        err = clEnqueueWriteBuffer(m->queue, m->dev[0], CL_TRUE, 0, size,
+                                   op == OP_WRITE ? m->host : m->pin, 0, NULL, NULL);
+        break;
+
+    case OP_READ:
+    case OP_READ_PINNED:
+        err = clEnqueueReadBuffer(m->queue, m->dev[0], CL_TRUE, 0, size,
+                                  op == OP_READ ? m->host : m->pin, 0, NULL, NULL);
+        break;
+
+    case OP_MAP_WRITE:
+    case OP_MAP_READ:
+        p = clEnqueueMapBuffer(m->queue, m->dev[0], CL_TRUE,
+                               op == OP_MAP_WRITE ? CL_MAP_WRITE_INVALIDATE_REGION : CL_MAP_READ,
+                               0, size, 0, NULL, NULL, &err);
+        if (p == NULL)
+        {
+            break;
+        }
+
+        if (op == OP_MAP_WRITE)
+        {
+            memcpy(p, m->host, size);
+        }
+        else
+        {
+            memcpy(m->host, p, size);
+        }
+
+        err = clEnqueueUnmapMemObject(m->queue, m->dev[0], p, 0, NULL, NULL);
+        err |= clFinish(m->queue);
+        break;
+
+    default:
+        err = clEnqueueCopyBuffer(m->queue, m->dev[0], m->dev[1], 0, 0, size, 0, NULL, NULL);
+        err |= clFinish(m->queue);
+        break;
+    }
+
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, EXENAME ": %s(%lu) failed with %d\n", opNames[op], (unsigned long)size, err);
+        return -1;
+    }
+
+    return wallTime() - start;
+}
+
+// GB/s table, one line per size: best of REPS runs after a warmup one,
+// wall clock as seen by the host
+static void measureTransfers(struct measure *m, cl_ulong maxalloc)
+{
+    double t, best;
+    size_t size;
+    unsigned int i;
+    int op, r;
+
+    printf("      bandwidth GB/s, best of %d:\n", REPS);
+    printf("      %10s", "size");
+    for (op = 0; op < NOPS; op += 1)
+    {
+        printf(" %8s", opNames[op]);
+    }
+    printf("\n");
+
+    for (i = 0; i < NSIZES && sizes[i] <= maxalloc; i += 1)
+    {
+        size = sizes[i];
+        printf("      %8lukB", (unsigned long)(size / 1024));
+
+        for (op = 0; op < NOPS; op += 1)
+        {
+            best = 0;
+            for (r = 0; r <= REPS; r += 1)
+            {
+                t = runOp(m, op, size);
+                if (t < 0)
+                {
+                    break;
+                }
+
+                if (r > 0 && (best == 0 || t < best))
+                {
+                    best = t;
+                }
+            }
+
+            if (best > 0)
+            {
+                printf(" %8.2f", (op == OP_COPY ? 2.0 : 1.0) * size / best / 1e9);
+            }
+            else
+            {
+                printf(" %8s", "-");
+            }
+        }
+
+        printf("\n");
+    }
+}
+
+// empty kernel: enqueue + clFinish one at a time, then LAT_REPS enqueued
+// back to back, and clFinish on an idle queue
+static void measureLatency(struct measure *m, cl_device_id device)
+{
+    cl_program prog;
+    cl_kernel kern;
+    cl_int err;
+    size_t global, len;
+    double start, single, batched, finish;
+    int i;
+
+    prog = NULL;
+    kern = NULL;
+
+    len = strlen(kernel_empty);
+
+    prog = clCreateProgramWithSource(m->ctx, 1, &kernel_empty, &len, &err);
+    if (prog == NULL)
+    {
+        fprintf(stderr, EXENAME ": clCreateProgramWithSource failed with %d\n", err);
+        goto error;
+    }
+
+    err = clBuildProgram(prog, 1, &device, NULL, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, EXENAME ": clBuildProgram failed with %d\n", err);
+        goto error;
+    }
+
+    kern = clCreateKernel(prog, "empty", &err);
+    if (kern == NULL)
+    {
+        fprintf(stderr, EXENAME ": clCreateKernel failed with %d\n", err);
+        goto error;
+    }
+
+    global = 1;
+
+    // warmup: the first launch pays for lazy initialisation
+    err = clEnqueueNDRangeKernel(m->queue, kern, 1, NULL, &global, NULL, 0, NULL, NULL);
+    err |= clFinish(m->queue);
+
+    start = wallTime();
+    for (i = 0; i < LAT_REPS && err == CL_SUCCESS; i += 1)
+    {
+        err = clEnqueueNDRangeKernel(m->queue, kern, 1, NULL, &global, NULL, 0, NULL, NULL);
+        err |= clFinish(m->queue);
+    }
+    single = (wallTime() - start) / LAT_REPS;
+
+    start = wallTime();
+    for (i = 0; i < LAT_REPS && err == CL_SUCCESS; i += 1)
+    {
+        err = clEnqueueNDRangeKernel(m->queue, kern, 1, NULL, &global, NULL, 0, NULL, NULL);
+    }
+    err |= clFinish(m->queue);
+    batched = (wallTime() - start) / LAT_REPS;
+
+    start = wallTime();
+    for (i = 0; i < LAT_REPS && err == CL_SUCCESS; i += 1)
+    {
+        err = clFinish(m->queue);
+    }
+    finish = (wallTime() - start) / LAT_REPS;
+
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, EXENAME ": empty kernel launch failed with %d\n", err);
+        goto error;
+    }
+
+    printf("      empty kernel launch latency: %.2fus (enqueue + clFinish), %.2fus batched\n",
+           single * 1e6, batched * 1e6);
+    printf("      clFinish round-trip: %.2fus (idle queue)\n", finish * 1e6);
+
+error:
+    if (kern != NULL)
+    {
+        clReleaseKernel(kern);
+    }
+
+    if (prog != NULL)
+    {
+        clReleaseProgram(prog);
+    }
+}
+
+void measureDevice(cl_device_id device)
+{
+    struct measure m;
+    cl_ulong maxalloc;
+    size_t size;
+    cl_int err;
+    int i;
+
+    memset(&m, 0, sizeof(m));
+
+    err = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxalloc), &maxalloc, NULL);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, EXENAME ": clGetDeviceInfo(CL_DEVICE_MAX_MEM_ALLOC_SIZE) failed with %d\n", err);
+        return;
+    }
+
+    size = sizes[NSIZES - 1];
+    if (size > maxalloc)
+    {
+        size = (size_t)maxalloc;
+    }
+
+    m.ctx = clCreateContext(NULL, 1, &device, NULL, NULL, &err);
+    if (m.ctx == NULL)
+    {
+        fprintf(stderr, EXENAME ": clCreateContext failed with %d\n", err);
+        goto error;
+    }
+
+    m.queue = clCreateCommandQueue(m.ctx, device, 0, &err);
+    if (m.queue == NULL)
+    {
+        fprintf(stderr, EXENAME ": clCreateCommandQueue failed with %d\n", err);
+        goto error;
+    }
+
+    for (i = 0; i < 2; i += 1)
+    {
+        m.dev[i] = clCreateBuffer(m.ctx, CL_MEM_READ_WRITE, size, NULL, &err);
+        if (m.dev[i] == NULL)
+        {
+            fprintf(stderr, EXENAME ": clCreateBuffer[%d] failed with %d\n", i, err);
+            goto error;
+        }
+    }
+
+    m.pinned = clCreateBuffer(m.ctx, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, NULL, &err);
+    if (m.pinned == NULL)
+    {
+        fprintf(stderr, EXENAME ": clCreateBuffer[pinned] failed with %d\n", err);
+        goto error;
+    }
+
+    // mapped for the whole run: its host pointer is the pinned memory
+    m.pin = clEnqueueMapBuffer(m.queue, m.pinned, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size,
+                               0, NULL, NULL, &err);
+    if (m.pin == NULL)
+    {
+        fprintf(stderr, EXENAME ": clEnqueueMapBuffer[pinned] failed with %d\n", err);
+        goto error;
+    }
+
+    m.host = malloc(size);
+    if (m.host == NULL)
+    {
+        fprintf(stderr, EXENAME ": Could not allocate memory [host]\n");
+        goto error;
+    }
+
+    // touch the pages outside of the timings
+    memset(m.host, 1, size);
+    memset(m.pin, 1, size);
+
+    measureTransfers(&m, (cl_ulong)size);
+    measureLatency(&m, device);
+
+error:
+    free(m.host);
+
+    if (m.pin != NULL)
+    {
+        clEnqueueUnmapMemObject(m.queue, m.pinned, m.pin, 0, NULL, NULL);
+        clFinish(m.queue);
+    }
+
+    if (m.pinned != NULL)
+    {
+        clReleaseMemObject(m.pinned);
+    }
+
+    for (i = 0; i < 2; i += 1)
+    {
+        if (m.dev[i] != NULL)
+        {
+            clReleaseMemObject(m.dev[i]);
+        }
+    }
+
+    if (m.queue != NULL)
+    {
+        clReleaseCommandQueue(m.queue);
+    }
+
+    if (m.ctx != NULL)
+    {
+        clReleaseContext(m.ctx);
+    }
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: " EXENAME " [-m]\n");
+    fprintf(stderr, "\t-m         measure bandwidth and latency of each device\n");
+}
+
 int main(int argc, char **argv)
 {
     cl_int err;
     cl_uint np, nps, nd, nds;
     cl_platform_id *platforms;
     cl_device_id *devices;
+    int c, measure;
+
+    measure = 0;
+    while ((c = getopt(argc, argv, "mh")) != -1)
+    {
+        switch (c)
+        {
+        case 'm':
+            measure = 1;
+            break;
+
+        default:
+            usage();
+            return -1;
+        }
+    }
 
     err = clGetPlatformIDs(0, NULL, &nps);
     if (err != CL_SUCCESS)
@@ -216,6 +595,11 @@ int main(int argc, char **argv)
             {
                 printf("      global memory size: %ld\n", memsize);
             }
+
+            if (measure)
+            {
+                measureDevice(devices[nd]);
+            }
         }
     }
 
@@ -1,32 +1,163 @@
 // vector.c
 //
-// Do operations on vectors/matrices
+// Do operations on vectors (matrices: see 03-matrix)
 //
 
-// compile with: gcc -Wall -o vector vector.c ../common/clenum.c ../common/clerror.c -lOpenCL
+// compile with: gcc -Wall -O2 -o vector vector.c ../common/clenum.c ../common/clerror.c ../common/clcache.c
+//                   ../common/threads.c ../common/random.c ../common/verify.c ../common/clprof.c
+//                   ../common/stats.c ../common/clrt.c ../common/clpool.c ../common/clexpr.c
+//                   ../common/cljob.c ../common/clstage.c ../common/clrank.c -lOpenCL -lpthread -lm
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <math.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "../common/clutil.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #define EXENAME     "vector"
 #define VEC_SIZE    (100 * 1024 * 1024)
+#define CHUNK_SIZE  (4 * 1024 * 1024)
+#define MAX_CHUNK   (1024 * 1024 * 1024)
+#define MAX_DEPTH   8
+#define CALIB_SIZE  (4 * 1024 * 1024)
+#define SAMPLES     64
+#define SAMPLE_LEN  1024
+#define JOB_MIN     256         // batch: job sizes
+#define JOB_MAX     4096
+#define BATCH_MAX   (16 * 1024 * 1024)
+#define BATCH_LOCAL 128
+#define SINGLE_JOBS 2000        // batch: jobs run one by one for the comparison
+#define STAGE_REPS  3           // staged: runs per transfer, the best one is kept
 
 const char *kernel_add = "__kernel void vAdd(__global const float* a, __global const float* b,"
                          "                   __global float* c, const unsigned int n)"
                          "{"
-                         "   int i = get_global_id(0);"
+                         "   size_t i = get_global_id(0);"
                          "   if (i < n)"
                          "   {"
                          "       c[i] = a[i] + b[i];"
                          "   }"
                          "}";
 
+// vAdd variants for the autotuner, built with -DW=1|4|8|16: W floats per
+// load/store, a grid-stride loop over the n / W vectors so a work-item
+// can handle several of them, then the n % W tail
+const char *kernel_addv = "#if W == 1\n"
+                          "#define LOAD(i, p) (p)[i]\n"
+                          "#define STORE(v, i, p) (p)[i] = (v)\n"
+                          "#else\n"
+                          "#define CAT(a, b) a##b\n"
+                          "#define XCAT(a, b) CAT(a, b)\n"
+                          "#define LOAD XCAT(vload, W)\n"
+                          "#define STORE XCAT(vstore, W)\n"
+                          "#endif\n"
+                          "__kernel void vAddV(__global const float* a, __global const float* b,"
+                          "                    __global float* c, const unsigned int n)"
+                          "{"
+                          "   size_t i, gsz = get_global_size(0);"
+                          "   size_t nv = n / W;"
+                          "   for (i = get_global_id(0); i < nv; i += gsz)"
+                          "   {"
+                          "       STORE(LOAD(i, a) + LOAD(i, b), i, c);"
+                          "   }"
+                          "   for (i = nv * W + get_global_id(0); i < n; i += gsz)"
+                          "   {"
+                          "       c[i] = a[i] + b[i];"
+                          "   }"
+                          "}";
+
+// Device side input: block i of the Philox stream gives floats 4i .. 4i+3,
+// bit for bit what fillUniform produces on the host (philoxCLSource is
+// prepended at build time)
+const char *kernel_fill = "__kernel void vFill(__global float* p, const uint seed, const uint stream,"
+                          "                    const ulong n)"
+                          "{"
+                          "   ulong block = get_global_id(0);"
+                          "   ulong i = block * 4;"
+                          "   float4 v = philoxUniform4(seed, stream, block);"
+                          "   if (i + 4 <= n)"
+                          "   {"
+                          "       vstore4(v, block, p);"
+                          "   }"
+                          "   else"
+                          "   {"
+                          "       if (i < n) p[i] = v.x;"
+                          "       if (i + 1 < n) p[i + 1] = v.y;"
+                          "       if (i + 2 < n) p[i + 2] = v.z;"
+                          "   }"
+                          "}";
+
+// Segmented vAdd, one work-group per job: in holds the njobs + 1 job
+// offsets, then from base (a 16 uints boundary) the packed a, then the
+// packed b; c is packed the same way as a
+const char *kernel_addseg = "__kernel void vAddSeg(__global const uint* in, __global float* c, const uint njobs)"
+                            "{"
+                            "   uint j = get_group_id(0);"
+                            "   uint base = (njobs + 1 + 15) & ~15u;"
+                            "   uint total = in[njobs];"
+                            "   __global const float* a = (__global const float*)(in + base);"
+                            "   __global const float* b = a + total;"
+                            "   for (uint i = in[j] + get_local_id(0); i < in[j + 1]; i += get_local_size(0))"
+                            "   {"
+                            "       c[i] = a[i] + b[i];"
+                            "   }"
+                            "}";
+
+// Low precision storage variants of vAdd, the addition itself is done in
+// fp32: fp16 through vload_half / vstore_half (core OpenCL, cl_khr_fp16
+// is only needed for half arithmetic), bf16 as the high half of a float
+// rounded to nearest even, int8 as round(x / scale) with one scale per
+// vector, rc = 1 / (sa + sb)
+const char *kernel_addlp = "__kernel void vAddF16(__global const half* a, __global const half* b,"
+                           "                      __global half* c, const unsigned int n)"
+                           "{"
+                           "   size_t i = get_global_id(0);"
+                           "   if (i < n)"
+                           "   {"
+                           "       vstore_half_rte(vload_half(i, a) + vload_half(i, b), i, c);"
+                           "   }"
+                           "}"
+                           "__kernel void vAddBF16(__global const ushort* a, __global const ushort* b,"
+                           "                       __global ushort* c, const unsigned int n)"
+                           "{"
+                           "   size_t i = get_global_id(0);"
+                           "   if (i < n)"
+                           "   {"
+                           "       uint u = as_uint(as_float((uint)a[i] << 16) + as_float((uint)b[i] << 16));"
+                           "       c[i] = (ushort)((u + 0x7fff + ((u >> 16) & 1)) >> 16);"
+                           "   }"
+                           "}"
+                           "__kernel void vAddI8(__global const char* a, __global const char* b,"
+                           "                     __global char* c, const unsigned int n,"
+                           "                     const float sa, const float sb, const float rc)"
+                           "{"
+                           "   size_t i = get_global_id(0);"
+                           "   if (i < n)"
+                           "   {"
+                           "       c[i] = convert_char_sat_rte((a[i] * sa + b[i] * sb) * rc);"
+                           "   }"
+                           "}";
+
+static const unsigned int tuneWidths[] = {1, 4, 8, 16};
+static const unsigned int tuneItems[] = {1, 4, 16};
+static const size_t tuneLocals[] = {0, 64, 128, 256};
+
+#define TUNE_REPS   3
+
 struct data
 {
-    unsigned int size;
+    size_t size;
 
     float *buf0;
     float *buf1;
@@ -41,388 +172,5160 @@ struct data
     cl_kernel kern;
     cl_event evt;
     cl_command_queue queue;
+
+    double wall;            // copy path end-to-end time
+    double kernel;          // copy path kernel time
+
+    size_t global;          // vAdd launch size
+    size_t local;           // 0: driver choice
 };
 
-int testVectorStep3(struct device *d, struct data *x)
+static const char *modes[] = {"copy", "stream", "zero", "usehost", "allochost", "multi", "devgen", "tiled", "bench", "runtime", "batch", "expr", "async", "svm", "staged", "lowp", NULL};
+
+struct options
 {
-    size_t len;
-    cl_int err;
-    size_t size;
-    cl_ulong start, end;
-    int ok;
+    char *mode;             // one of modes[]
+    size_t size;            // floats per vector, 0: VEC_SIZE or the input file size
+    size_t chunk;           // floats per chunk (stream, tiled)
+    unsigned int depth;     // chunks in flight (stream)
+    unsigned int queues;    // 2: transfer + compute, 3: upload + compute + download
+    char *split;            // cal, cu (multi)
+    int tune;               // autotune vAdd before the copy path
+    int threads;            // host threads, 0: one per cpu
+    int simd;               // host SIMD level, -1: detect
+    cl_uint seed;           // input generator seed
+    cl_uint ulp;            // check tolerance
+    char *files[3];         // tiled: a, b and c files, NULL: anonymous memory
+    char *trace;            // Chrome trace output
+    size_t sweep[2];        // bench: first and last size, 0: opts.size only
+    unsigned int factor;    // bench: ratio between sizes
+    int warmup;             // bench: untimed runs per size
+    int reps;               // bench: timed runs per size
+    char *select;           // pid.did or class of the only device to test, NULL: all
+    char *format;           // bench results: text, csv or json
+    char *results;          // bench results file, NULL: stdout
+    int concurrent;         // one host thread per device
+};
 
-    ok = 0;
-    len = strlen(kernel_add);
+static struct options opts = {"copy", 0, CHUNK_SIZE, 3, 3, "cal", 0, 0, -1, 1, 0, {NULL, NULL, NULL}, NULL,
+                              {0, 0}, 4, 2, 10, NULL, "text", NULL, 0};
+
+static struct threadPool *hostPool;
+static struct clprof *prof;
+static struct device *bestDevice;       // -D with a workload class
+
+// trace row of a device queue
+static char *track(char *buf, struct device *d, const char *queue)
+{
+    sprintf(buf, "%d.%d %s", d->pid, d->did, queue);
+    return buf;
+}
+
+// profiling only costs when a trace is asked for
+static cl_command_queue_properties queueProps()
+{
+    return prof != NULL ? CL_QUEUE_PROFILING_ENABLE : 0;
+}
+
+static double wallTime()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static size_t parseSize(const char *s)
+{
+    char *end;
+    unsigned long long v;
 
-    x->prog = clCreateProgramWithSource(x->ctx, 1, &kernel_add, &len, &err);
-    if (x->prog == NULL)
+    v = strtoull(s, &end, 0);
+    switch (*end)
     {
-        fprintf(stderr, "%d.%d: clCreateProgramWithSource failed with %d\n", d->pid, d->did, err);
-        goto error;
+    case 'k':
+    case 'K':
+        v *= 1024;
+        break;
+
+    case 'm':
+    case 'M':
+        v *= 1024 * 1024;
+        break;
+
+    case 'g':
+    case 'G':
+        v *= 1024 * 1024 * 1024;
+        break;
     }
 
-    err = clBuildProgram(x->prog, 0, NULL, NULL, NULL, NULL);
-    if (err != CL_SUCCESS)
+    return (size_t)v;
+}
+
+// first:last[:factor], k/M/G suffixes allowed
+static int parseSweep(const char *s)
+{
+    const char *p;
+
+    p = strchr(s, ':');
+    if (p == NULL)
     {
-        fprintf(stderr, "%d.%d: clBuildProgram failed with %d\n", d->pid, d->did, err);
-        goto error;
+        return 0;
     }
 
-    x->kern = clCreateKernel(x->prog, "vAdd", &err);
-    if (err != CL_SUCCESS)
+    opts.sweep[0] = parseSize(s);
+    opts.sweep[1] = parseSize(p + 1);
+
+    p = strchr(p + 1, ':');
+    if (p != NULL)
     {
-        fprintf(stderr, "%d.%d: clCreateKernel failed with %d\n", d->pid, d->did, err);
-        goto error;
+        opts.factor = (unsigned int)strtoul(p + 1, NULL, 0);
     }
 
-    err = clSetKernelArg(x->kern, 0, sizeof(cl_mem), &x->mem0);
-    if (err != CL_SUCCESS)
+    return opts.sweep[0] != 0 && opts.sweep[0] <= opts.sweep[1] && opts.factor >= 2;
+}
+
+static int selectedDevice(struct device *d)
+{
+    unsigned int pid, did;
+
+    if (opts.select == NULL)
     {
-        fprintf(stderr, "%d.%d: clSetKernelArg[0] failed with %d\n", d->pid, d->did, err);
-        goto error;
+        return 1;
     }
 
-    err = clSetKernelArg(x->kern, 1, sizeof(cl_mem), &x->mem1);
-    if (err != CL_SUCCESS)
+    if (bestDevice != NULL)
     {
-        fprintf(stderr, "%d.%d: clSetKernelArg[1] failed with %d\n", d->pid, d->did, err);
-        goto error;
+        return d == bestDevice;
     }
 
-    err = clSetKernelArg(x->kern, 2, sizeof(cl_mem), &x->mem2);
-    if (err != CL_SUCCESS)
+    return sscanf(opts.select, "%u.%u", &pid, &did) == 2 && pid == d->pid && did == d->did;
+}
+
+// Whole vectors fit: one buffer within CL_DEVICE_MAX_MEM_ALLOC_SIZE, the
+// three of them within CL_DEVICE_GLOBAL_MEM_SIZE, and n within the
+// unsigned int vAdd argument
+static int fitsDevice(struct device *d, size_t n)
+{
+    // not reported: let the allocation tell
+    if (d->maxAlloc == 0 || d->globalMem == 0)
     {
-        fprintf(stderr, "%d.%d: clSetKernelArg[2] failed with %d\n", d->pid, d->did, err);
-        goto error;
+        return 1;
     }
 
-    err = clSetKernelArg(x->kern, 3, sizeof(unsigned int), &x->size);
-    if (err != CL_SUCCESS)
+    return n <= 0xffffffffu && sizeof(cl_float) * n <= d->maxAlloc && 3 * sizeof(cl_float) * n <= d->globalMem;
+}
+
+// Largest chunk for a ring of depth slots: one buffer within
+// CL_DEVICE_MAX_MEM_ALLOC_SIZE, the 3 * depth of them within half of
+// CL_DEVICE_GLOBAL_MEM_SIZE
+static size_t deviceChunk(struct device *d, unsigned int depth)
+{
+    size_t chunk;
+
+    chunk = MAX_CHUNK;
+
+    if (d->maxAlloc != 0 && d->maxAlloc / sizeof(cl_float) < chunk)
     {
-        fprintf(stderr, "%d.%d: clSetKernelArg[3] failed with %d\n", d->pid, d->did, err);
-        goto error;
+        chunk = (size_t)(d->maxAlloc / sizeof(cl_float));
     }
 
-    x->queue = clCreateCommandQueue(x->ctx, d->device, CL_QUEUE_PROFILING_ENABLE, &err);
-    if (x->queue == NULL)
+    if (d->globalMem != 0 && d->globalMem / 2 / (3 * depth * sizeof(cl_float)) < chunk)
     {
-        fprintf(stderr, "%d.%d: clCreateCommandQueue failed with %d\n", d->pid, d->did, err);
-        goto error;
+        chunk = (size_t)(d->globalMem / 2 / (3 * depth * sizeof(cl_float)));
     }
 
-    // async write
-    err = clEnqueueWriteBuffer(x->queue, x->mem0, CL_FALSE, 0,
-                               sizeof(cl_float) * x->size, x->buf0, 0, NULL, NULL);
-    if (err != CL_SUCCESS)
+    return chunk & ~(size_t)1023;
+}
+
+// Page aligned host allocation, so that CL_MEM_USE_HOST_PTR buffers
+// can be used in place by CPU and integrated GPU devices.
+static void *allocHost(size_t size)
+{
+    void *p;
+    long page;
+
+    page = sysconf(_SC_PAGESIZE);
+    if (page <= 0)
     {
-        fprintf(stderr, "%d.%d: clEnqueueWriteBuffer[mem0] failed with %d\n", d->pid, d->did, err);
-        goto error;
+        page = 4096;
     }
 
-    printf("%d.%d: mem0 uploaded\n", d->pid, d->did);
+    // some drivers also want the size to be a cache line multiple
+    size = (size + 63) & ~(size_t)63;
 
-    // async write
-    err = clEnqueueWriteBuffer(x->queue, x->mem1, CL_FALSE, 0,
-                               sizeof(cl_float) * x->size, x->buf1, 0, NULL, NULL);
-    if (err != CL_SUCCESS)
+    if (posix_memalign(&p, (size_t)page, size) != 0)
     {
-        fprintf(stderr, "%d.%d: clEnqueueWriteBuffer[mem1] failed with %d\n", d->pid, d->did, err);
-        goto error;
+        return NULL;
     }
 
-    printf("%d.%d: mem1 uploaded\n", d->pid, d->did);
+    return p;
+}
 
-    size = (size_t)x->size;
+// Host reference: c = a + b split across the thread pool, each thread
+// running the widest SIMD loop allowed by opts.simd.
+struct hostAdd
+{
+    const float *a;
+    const float *b;
+    float *c;
+    size_t n;
+};
 
-    err = clEnqueueNDRangeKernel(x->queue, x->kern, 1, NULL, &size, NULL, 0, NULL, &x->evt);
-    if (err != CL_SUCCESS)
+static void addScalar(const float *a, const float *b, float *c, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i += 1)
     {
-        fprintf(stderr, "%d.%d: clEnqueueNDRangeKernel failed with %d\n", d->pid, d->did, err);
-        goto error;
+        c[i] = a[i] + b[i];
     }
+}
 
-    printf("%d.%d: prog kernel queued\n", d->pid, d->did);
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) static void addSSE(const float *a, const float *b, float *c, size_t n)
+{
+    size_t i;
 
-    err = clFinish(x->queue);
-    if (err != CL_SUCCESS)
+    for (i = 0; i + 4 <= n; i += 4)
     {
-        fprintf(stderr, "%d.%d: clEnqueueNDRangeKernel failed with %d\n", d->pid, d->did, err);
-        goto error;
+        _mm_storeu_ps(c + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
     }
 
-    printf("%d.%d: prog kernel finished\n", d->pid, d->did);
+    addScalar(a + i, b + i, c + i, n - i);
+}
 
-    // block read
-    err = clEnqueueReadBuffer(x->queue, x->mem2, CL_TRUE, 0,
-                              sizeof(cl_float) * x->size, x->buf2, 0, NULL, NULL);
-    if (err != CL_SUCCESS)
+__attribute__((target("avx2"))) static void addAVX2(const float *a, const float *b, float *c, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16)
     {
-        fprintf(stderr, "%d.%d: clEnqueueReadBuffer[mem2] failed with %d\n", d->pid, d->did, err);
-        goto error;
+        _mm256_storeu_ps(c + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        _mm256_storeu_ps(c + i + 8, _mm256_add_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8)));
     }
 
-    printf("%d.%d: mem2 downloaded\n", d->pid, d->did);
+    addScalar(a + i, b + i, c + i, n - i);
+}
 
-    err = clWaitForEvents(1, &x->evt);
-    if (err != CL_SUCCESS)
-    {
-        fprintf(stderr, "%d.%d: clWaitForEvents failed with %d\n", d->pid, d->did, err);
-        goto error;
-    }
-    
-    err = clGetEventProfilingInfo(x->evt, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
-    if (err != CL_SUCCESS)
-    {
-        fprintf(stderr, "%d.%d: clGetEventProfilingInfo[start] failed with %d\n", d->pid, d->did, err);
-        goto error;
-    }
+__attribute__((target("avx512f"))) static void addAVX512(const float *a, const float *b, float *c, size_t n)
+{
+    size_t i;
 
-    err = clGetEventProfilingInfo(x->evt, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
-    if (err != CL_SUCCESS)
+    for (i = 0; i + 32 <= n; i += 32)
     {
-        fprintf(stderr, "%d.%d: clGetEventProfilingInfo[end] failed with %d\n", d->pid, d->did, err);
-        goto error;
+        _mm512_storeu_ps(c + i, _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        _mm512_storeu_ps(c + i + 16, _mm512_add_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16)));
     }
 
-    printf("%d.%d: duration: %g seconds\n", d->pid, d->did, (float)(end - start) / 1e9f);
+    addScalar(a + i, b + i, c + i, n - i);
+}
+#endif
 
-    ok = 1;
+static void hostAddThread(void *arg, int index, int count)
+{
+    struct hostAdd *h;
+    size_t begin, end;
 
-error:
-    if (x->evt) {
-        err = clReleaseEvent(x->evt);
-        if (err != CL_SUCCESS)
-        {
-            fprintf(stderr, "%d.%d: clReleaseEvent failed with %d\n", d->pid, d->did, err);
-        }
-    }
+    h = (struct hostAdd *)arg;
+    splitRange(h->n, 16, index, count, &begin, &end);
 
-    if (x->queue)
+    switch (opts.simd)
     {
-        err = clReleaseCommandQueue(x->queue);
-        if (err != CL_SUCCESS)
-        {
-            fprintf(stderr, "%d.%d: clReleaseCommandQueue failed with %d\n", d->pid, d->did, err);
-            goto error;
-        }
-    }
+#if defined(__x86_64__) || defined(__i386__)
+    case SIMD_AVX512:
+        addAVX512(h->a + begin, h->b + begin, h->c + begin, end - begin);
+        break;
 
-    if (x->kern)
-    {
-        err = clReleaseKernel(x->kern);
-        if (err != CL_SUCCESS)
-        {
-            fprintf(stderr, "%d.%d: clReleaseKernel failed with %d\n", d->pid, d->did, err);
-            goto error;
-        }
-    }
+    case SIMD_AVX2:
+        addAVX2(h->a + begin, h->b + begin, h->c + begin, end - begin);
+        break;
 
-    if (x->prog)
-    {
-        err = clReleaseProgram(x->prog);
-        if (err != CL_SUCCESS)
-        {
-            fprintf(stderr, "%d.%d: clReleaseProgram failed with %d\n", d->pid, d->did, err);
-            goto error;
-        }
+    case SIMD_SSE:
+        addSSE(h->a + begin, h->b + begin, h->c + begin, end - begin);
+        break;
+#endif
+
+    default:
+        addScalar(h->a + begin, h->b + begin, h->c + begin, end - begin);
+        break;
     }
+}
 
-    return ok;
+void hostAdd(const float *a, const float *b, float *c, size_t n)
+{
+    struct hostAdd h;
+
+    h.a = a;
+    h.b = b;
+    h.c = c;
+    h.n = n;
+
+    runThreadPool(hostPool, hostAddThread, &h);
 }
 
-int testVectorStep2(struct device *d, struct data *x)
+// a and b are streams 0 and 1 of the seeded generator, the same values
+// whatever the number of threads
+static void generateVectors(const char *tag, float *a, float *b, size_t n)
 {
-    cl_int err;
-    int ok;
+    double start;
 
-    ok = 0;
+    printf("%s: generating source buffers (philox, seed %u)\n", tag, opts.seed);
 
-    x->mem0 = clCreateBuffer(x->ctx, CL_MEM_READ_ONLY, sizeof(cl_float) * x->size, NULL, &err);
-    if (x->mem0 == NULL)
-    {
-        fprintf(stderr, "%d.%d: clCreateBuffer[mem0] failed with %d\n", d->pid, d->did, err);
-        goto error;
-    }
+    start = wallTime();
+    fillUniform(hostPool, a, n, opts.seed, 0);
+    fillUniform(hostPool, b, n, opts.seed, 1);
 
-    printf("%d.%d: mem0 buffer allocated\n", d->pid, d->did);
+    printf("%s: %lu floats generated in %g seconds\n", tag, (unsigned long)(2 * n), wallTime() - start);
+}
 
-    x->mem1 = clCreateBuffer(x->ctx, CL_MEM_READ_ONLY, sizeof(cl_float) * x->size, NULL, &err);
-    if (x->mem1 == NULL)
-    {
-        fprintf(stderr, "%d.%d: clCreateBuffer[mem1] failed with %d\n", d->pid, d->did, err);
-        goto error;
-    }
+// c against the host reference ref, within opts.ulp
+static int checkVectors(const char *tag, const float *a, const float *b, const float *c,
+                        const float *ref, size_t n)
+{
+    size_t count, first;
+    double start;
 
-    printf("%d.%d: mem1 buffer allocated\n", d->pid, d->did);
+    printf("%s: comparing results ...\n", tag);
 
-    x->mem2 = clCreateBuffer(x->ctx, CL_MEM_READ_ONLY, sizeof(cl_float) * x->size, NULL, &err);
-    if (x->mem2 == NULL)
+    start = wallTime();
+    count = compareFloats(hostPool, c, ref, n, opts.ulp, &first);
+
+    if (count != 0)
     {
-        fprintf(stderr, "%d.%d: clCreateBuffer[mem2] failed with %d\n", d->pid, d->did, err);
-        goto error;
+        printf("%s: check error: %lu of %lu floats off by more than %u ulp, first at %lu: %f + %f != %f\n",
+               tag, (unsigned long)count, (unsigned long)n, opts.ulp, (unsigned long)first,
+               a[first], b[first], c[first]);
+        return 0;
     }
 
-    printf("%d.%d: mem2 buffer allocated\n", d->pid, d->did);
+    printf("%s: check ok: added %lu floats (%g seconds)\n", tag, (unsigned long)n, wallTime() - start);
+    return 1;
+}
 
-    ok = testVectorStep3(d, x);
+cl_kernel createVectorKernel(struct device *d, cl_context ctx, cl_program *prog)
+{
+    cl_int err;
+    cl_kernel kern;
+    double start;
+    int cached;
 
-error:
-    if (x->mem2 != NULL)
-    {
-        err = clReleaseMemObject(x->mem2);
-        if (err != CL_SUCCESS)
-        {
-            fprintf(stderr, "%d.%d: clReleaseMemObject(mem2) failed with %d\n", d->pid, d->did, err);
-        }
-    }
+    start = wallTime();
 
-    if (x->mem1 != NULL)
+    *prog = buildCLProgram(ctx, d, kernel_add, NULL, &cached);
+    if (*prog == NULL)
     {
-        err = clReleaseMemObject(x->mem1);
-        if (err != CL_SUCCESS)
-        {
-            fprintf(stderr, "%d.%d: clReleaseMemObject(mem1) failed with %d\n", d->pid, d->did, err);
-        }
+        fprintf(stderr, "%d.%d: %s", d->pid, d->did, getLastCLError());
+        return NULL;
     }
 
-    if (x->mem0 != NULL)
+    // cold: built from source, warm: loaded from the binary cache
+    printf("%d.%d: program ready in %g seconds (%s)\n", d->pid, d->did,
+           wallTime() - start, cached ? "warm, cached binary" : "cold, source build");
+
+    kern = clCreateKernel(*prog, "vAdd", &err);
+    if (err != CL_SUCCESS)
     {
-        err = clReleaseMemObject(x->mem0);
-        if (err != CL_SUCCESS)
-        {
-            fprintf(stderr, "%d.%d: clReleaseMemObject(mem0) failed with %d\n", d->pid, d->did, err);
-        }
+        fprintf(stderr, "%d.%d: clCreateKernel failed with %d\n", d->pid, d->did, err);
+        return NULL;
     }
 
-    return ok;
+    return kern;
 }
 
-void testVectorStep1(struct device *d)
+// Streamed pipeline: the vector is split in chunks that rotate through
+// opts.depth device buffer slots. Chunk i is uploaded while chunk i-1 is
+// computed and chunk i-2 is downloaded, each stage on its own in-order
+// queue, ordered with events:
+//
+//   upload(i)   waits for kernel(i - depth)    (a, b of the slot are free)
+//   kernel(i)   waits for upload(i)            (a, b are ready)
+//               and for download(i - depth)    (c of the slot is free)
+//   download(i) waits for kernel(i)            (c is ready)
+//
+int testVectorStream(struct device *d, struct data *x)
 {
-    struct data x;
+    cl_command_queue q[3];
+    cl_command_queue qup, qk, qdn;
+    cl_mem mem[MAX_DEPTH][3];
+    cl_event evup[MAX_DEPTH], evk[MAX_DEPTH], evdn[MAX_DEPTH];
+    cl_program prog;
+    cl_kernel kern;
+    cl_event wait[2];
+    cl_uint nwait;
     cl_int err;
-    struct timespec start, end;
-    float dur;
-    int i;
-
-    memset(&x, 0, sizeof(x));
+    char trk[3][64];
+    size_t chunk, nchunks, step, i, off, size;
+    unsigned int s, j, n;
+    double start, end;
+    int ok;
 
-    x.size = VEC_SIZE;
+    ok = 0;
+    prog = NULL;
+    memset(q, 0, sizeof(q));
+    memset(mem, 0, sizeof(mem));
+    memset(evup, 0, sizeof(evup));
+    memset(evk, 0, sizeof(evk));
+    memset(evdn, 0, sizeof(evdn));
 
-    x.buf0 = (float *)malloc(x.size * sizeof(float));
-    if (x.buf0 == NULL)
+    // the ring has to fit the device, whatever the vector size
+    chunk = opts.chunk < x->size ? opts.chunk : x->size;
+    if (chunk > deviceChunk(d, opts.depth))
     {
-        fprintf(stderr, "Could not allocate memory [x.buf0]\n");
-        goto error;
+        chunk = deviceChunk(d, opts.depth);
     }
 
-    x.buf1 = (float *)malloc(x.size * sizeof(float));
-    if (x.buf1 == NULL)
+    nchunks = (x->size + chunk - 1) / chunk;
+
+    kern = createVectorKernel(d, x->ctx, &prog);
+    if (kern == NULL)
     {
-        fprintf(stderr, "Could not allocate memory [x.buf1]\n");
         goto error;
     }
 
-    printf("%d:%d: generating source buffer (rand)\n", d->pid, d->did);
-
-    for (i = 0; i < x.size; i += 1)
+    for (j = 0; j < opts.queues; j += 1)
     {
-        x.buf0[i] = (float)rand() / (float)RAND_MAX;
-        x.buf1[i] = (float)rand() / (float)RAND_MAX;
+        q[j] = clCreateCommandQueue(x->ctx, d->device, queueProps(), &err);
+        if (q[j] == NULL)
+        {
+            fprintf(stderr, "%d.%d: clCreateCommandQueue[%d] failed with %d\n", d->pid, d->did, j, err);
+            goto error;
+        }
     }
 
-    x.buf2 = (float *)malloc(x.size * sizeof(float));
-    if (x.buf2 == NULL)
+    qup = q[0];
+    qk = q[1];
+    qdn = opts.queues > 2 ? q[2] : q[0];
+
+    track(trk[0], d, opts.queues > 2 ? "upload" : "transfer");
+    track(trk[1], d, "compute");
+    track(trk[2], d, opts.queues > 2 ? "download" : "transfer");
+
+    for (s = 0; s < opts.depth; s += 1)
+    {
+        for (j = 0; j < 3; j += 1)
+        {
+            mem[s][j] = clCreateBuffer(x->ctx, j < 2 ? CL_MEM_READ_ONLY : CL_MEM_WRITE_ONLY,
+                                       sizeof(cl_float) * chunk, NULL, &err);
+            if (mem[s][j] == NULL)
+            {
+                fprintf(stderr, "%d.%d: clCreateBuffer[slot %d, mem%d] failed with %d\n", d->pid, d->did, s, j, err);
+                goto error;
+            }
+        }
+    }
+
+    printf("%d.%d: streaming %lu chunks of %lu floats, depth %d, %d queues\n",
+           d->pid, d->did, (unsigned long)nchunks, (unsigned long)chunk, opts.depth, opts.queues);
+
+    start = wallTime();
+
+    // software pipeline: at each step, stages run two chunks apart
+    for (step = 0; step < nchunks + 2; step += 1)
+    {
+        // upload chunk step
+        i = step;
+        if (i < nchunks)
+        {
+            s = i % opts.depth;
+            off = (size_t)i * chunk;
+            size = sizeof(cl_float) * (i == nchunks - 1 ? x->size - off : chunk);
+
+            nwait = evk[s] != NULL ? 1 : 0;
+            err = clEnqueueWriteBuffer(qup, mem[s][0], CL_FALSE, 0, size, x->buf0 + off,
+                                       nwait, &evk[s], profEvent(prof, trk[0], "write a", PROF_WRITE, size, 0));
+            if (err != CL_SUCCESS)
+            {
+                fprintf(stderr, "%d.%d: clEnqueueWriteBuffer[chunk %lu, mem0] failed with %d\n", d->pid, d->did, (unsigned long)i, err);
+                goto error;
+            }
+
+            if (evup[s] != NULL)
+            {
+                clReleaseEvent(evup[s]);
+                evup[s] = NULL;
+            }
+
+            err = clEnqueueWriteBuffer(qup, mem[s][1], CL_FALSE, 0, size, x->buf1 + off,
+                                       0, NULL, &evup[s]);
+            if (err != CL_SUCCESS)
+            {
+                fprintf(stderr, "%d.%d: clEnqueueWriteBuffer[chunk %lu, mem1] failed with %d\n", d->pid, d->did, (unsigned long)i, err);
+                goto error;
+            }
+
+            profAddEvent(prof, evup[s], trk[0], "write b", PROF_WRITE, size, 0);
+            clFlush(qup);
+        }
+
+        // compute chunk step - 1
+        i = step - 1;
+        if (step >= 1 && i < nchunks)
+        {
+            s = i % opts.depth;
+            off = (size_t)i * chunk;
+            n = (unsigned int)(i == nchunks - 1 ? x->size - off : chunk);
+
+            err = clSetKernelArg(kern, 0, sizeof(cl_mem), &mem[s][0]);
+            err |= clSetKernelArg(kern, 1, sizeof(cl_mem), &mem[s][1]);
+            err |= clSetKernelArg(kern, 2, sizeof(cl_mem), &mem[s][2]);
+            err |= clSetKernelArg(kern, 3, sizeof(unsigned int), &n);
+            if (err != CL_SUCCESS)
+            {
+                fprintf(stderr, "%d.%d: clSetKernelArg[chunk %lu] failed with %d\n", d->pid, d->did, (unsigned long)i, err);
+                goto error;
+            }
+
+            nwait = 0;
+            wait[nwait++] = evup[s];
+            if (evdn[s] != NULL)
+            {
+                wait[nwait++] = evdn[s];
+            }
+
+            if (evk[s] != NULL)
+            {
+                clReleaseEvent(evk[s]);
+                evk[s] = NULL;
+            }
+
+            size = (size_t)n;
+            err = clEnqueueNDRangeKernel(qk, kern, 1, NULL, &size, NULL, nwait, wait, &evk[s]);
+            if (err != CL_SUCCESS)
+            {
+                fprintf(stderr, "%d.%d: clEnqueueNDRangeKernel[chunk %lu] failed with %d\n", d->pid, d->did, (unsigned long)i, err);
+                goto error;
+            }
+
+            profAddEvent(prof, evk[s], trk[1], "vAdd", PROF_KERNEL, 3 * sizeof(cl_float) * size, (double)size);
+            clFlush(qk);
+        }
+
+        // download chunk step - 2
+        i = step - 2;
+        if (step >= 2 && i < nchunks)
+        {
+            s = i % opts.depth;
+            off = (size_t)i * chunk;
+            size = sizeof(cl_float) * (i == nchunks - 1 ? x->size - off : chunk);
+
+            if (evdn[s] != NULL)
+            {
+                clReleaseEvent(evdn[s]);
+                evdn[s] = NULL;
+            }
+
+            err = clEnqueueReadBuffer(qdn, mem[s][2], CL_FALSE, 0, size, x->buf2 + off,
+                                      1, &evk[s], &evdn[s]);
+            if (err != CL_SUCCESS)
+            {
+                fprintf(stderr, "%d.%d: clEnqueueReadBuffer[chunk %lu, mem2] failed with %d\n", d->pid, d->did, (unsigned long)i, err);
+                goto error;
+            }
+
+            profAddEvent(prof, evdn[s], trk[2], "read c", PROF_READ, size, 0);
+            clFlush(qdn);
+        }
+    }
+
+    for (j = 0; j < opts.queues; j += 1)
+    {
+        err = clFinish(q[j]);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clFinish[%d] failed with %d\n", d->pid, d->did, j, err);
+            goto error;
+        }
+    }
+
+    end = wallTime();
+
+    printf("%d.%d: stream path: %g seconds end-to-end, %.2f GB/s\n", d->pid, d->did,
+           end - start, 3.0 * sizeof(cl_float) * x->size / (end - start) / 1e9);
+
+    if (x->wall > 0)
+    {
+        printf("%d.%d: stream path: %.2fx copy path\n", d->pid, d->did, x->wall / (end - start));
+    }
+
+    ok = 1;
+
+error:
+    for (s = 0; s < MAX_DEPTH; s += 1)
+    {
+        if (evup[s] != NULL)
+        {
+            clReleaseEvent(evup[s]);
+        }
+
+        if (evk[s] != NULL)
+        {
+            clReleaseEvent(evk[s]);
+        }
+
+        if (evdn[s] != NULL)
+        {
+            clReleaseEvent(evdn[s]);
+        }
+
+        for (j = 0; j < 3; j += 1)
+        {
+            if (mem[s][j] != NULL)
+            {
+                clReleaseMemObject(mem[s][j]);
+            }
+        }
+    }
+
+    for (j = 0; j < 3; j += 1)
+    {
+        if (q[j] != NULL)
+        {
+            clReleaseCommandQueue(q[j]);
+        }
+    }
+
+    if (kern != NULL)
+    {
+        clReleaseKernel(kern);
+    }
+
+    if (prog != NULL)
+    {
+        clReleaseProgram(prog);
+    }
+
+    return ok;
+}
+
+// Zero-copy path: no clEnqueueWriteBuffer / clEnqueueReadBuffer.
+//
+// usehost: the page aligned host buffers are wrapped with
+//          CL_MEM_USE_HOST_PTR, the device works on them in place
+//          (host unified memory devices: cpu, integrated gpu).
+// allochost: the driver allocates host accessible (pinned) memory with
+//          CL_MEM_ALLOC_HOST_PTR, the host fills it through
+//          clEnqueueMapBuffer (discrete devices, dma from pinned memory).
+//
+// zero picks one from CL_DEVICE_HOST_UNIFIED_MEMORY.
+int testVectorZeroCopy(struct device *d, struct data *x)
+{
+    cl_mem mem[3];
+    cl_mem_flags flags;
+    cl_command_queue queue;
+    cl_program prog;
+    cl_kernel kern;
+    cl_bool unified;
+    cl_int err;
+    float *buf[3], *p;
+    size_t bytes, size;
+    double start, mapped, end, fill;
+    unsigned int n;
+    char trk[64];
+    int usehost, ok, j;
+
+    ok = 0;
+    prog = NULL;
+    queue = NULL;
+    memset(mem, 0, sizeof(mem));
+
+    buf[0] = x->buf0;
+    buf[1] = x->buf1;
+    buf[2] = x->buf2;
+    bytes = sizeof(cl_float) * x->size;
+
+    unified = d->unified;
+
+    if (strcmp(opts.mode, "zero") == 0)
+    {
+        usehost = unified == CL_TRUE;
+    }
+    else
+    {
+        usehost = strcmp(opts.mode, "usehost") == 0;
+    }
+
+    printf("%d.%d: host unified memory: %s, using %s\n", d->pid, d->did,
+           unified ? "yes" : "no", usehost ? "CL_MEM_USE_HOST_PTR" : "CL_MEM_ALLOC_HOST_PTR + map");
+
+    kern = createVectorKernel(d, x->ctx, &prog);
+    if (kern == NULL)
+    {
+        goto error;
+    }
+
+    queue = clCreateCommandQueue(x->ctx, d->device, queueProps(), &err);
+    if (queue == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateCommandQueue failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    track(trk, d, "queue");
+    start = wallTime();
+
+    for (j = 0; j < 3; j += 1)
+    {
+        flags = j < 2 ? CL_MEM_READ_ONLY : CL_MEM_WRITE_ONLY;
+        flags |= usehost ? CL_MEM_USE_HOST_PTR : CL_MEM_ALLOC_HOST_PTR;
+
+        mem[j] = clCreateBuffer(x->ctx, flags, bytes, usehost ? buf[j] : NULL, &err);
+        if (mem[j] == NULL)
+        {
+            fprintf(stderr, "%d.%d: clCreateBuffer[mem%d] failed with %d\n", d->pid, d->did, j, err);
+            goto error;
+        }
+    }
+
+    // allochost: the input has to land in the driver memory; a real
+    // producer would write there directly, here it is copied and the
+    // copy is timed apart
+    fill = 0;
+    if (!usehost)
+    {
+        for (j = 0; j < 2; j += 1)
+        {
+            p = (float *)clEnqueueMapBuffer(queue, mem[j], CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, bytes,
+                                            0, NULL, profEvent(prof, trk, "map a/b", PROF_MAP, bytes, 0), &err);
+            if (p == NULL)
+            {
+                fprintf(stderr, "%d.%d: clEnqueueMapBuffer[mem%d] failed with %d\n", d->pid, d->did, j, err);
+                goto error;
+            }
+
+            mapped = wallTime();
+            memcpy(p, buf[j], bytes);
+            fill += wallTime() - mapped;
+
+            err = clEnqueueUnmapMemObject(queue, mem[j], p, 0, NULL,
+                                          profEvent(prof, trk, "unmap a/b", PROF_UNMAP, bytes, 0));
+            if (err != CL_SUCCESS)
+            {
+                fprintf(stderr, "%d.%d: clEnqueueUnmapMemObject[mem%d] failed with %d\n", d->pid, d->did, j, err);
+                goto error;
+            }
+        }
+    }
+
+    for (j = 0; j < 3; j += 1)
+    {
+        err = clSetKernelArg(kern, j, sizeof(cl_mem), &mem[j]);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clSetKernelArg[%d] failed with %d\n", d->pid, d->did, j, err);
+            goto error;
+        }
+    }
+
+    n = (unsigned int)x->size;
+
+    err = clSetKernelArg(kern, 3, sizeof(unsigned int), &n);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clSetKernelArg[3] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    size = (size_t)x->size;
+
+    err = clEnqueueNDRangeKernel(queue, kern, 1, NULL, &size, NULL, 0, NULL,
+                                 profEvent(prof, trk, "vAdd", PROF_KERNEL, 3 * bytes, (double)size));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueNDRangeKernel failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    // mapping makes the result visible to the host: with usehost it
+    // is buf2 itself, with allochost it is the driver memory
+    p = (float *)clEnqueueMapBuffer(queue, mem[2], CL_TRUE, CL_MAP_READ, 0, bytes, 0, NULL,
+                                    profEvent(prof, trk, "map c", PROF_MAP, bytes, 0), &err);
+    if (p == NULL)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueMapBuffer[mem2] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    end = wallTime();
+
+    if (p != x->buf2)
+    {
+        memcpy(x->buf2, p, bytes);
+    }
+
+    err = clEnqueueUnmapMemObject(queue, mem[2], p, 0, NULL, profEvent(prof, trk, "unmap c", PROF_UNMAP, bytes, 0));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueUnmapMemObject[mem2] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    err = clFinish(queue);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clFinish failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    printf("%d.%d: zero-copy path: %g seconds end-to-end (%g in host fill), %.2f GB/s, %.2fx copy path\n",
+           d->pid, d->did, end - start, fill, 3.0 * bytes / (end - start) / 1e9, x->wall / (end - start));
+
+    // what each path allocated in this run: the copy path holds a, b, c
+    // on the host and on the device; usehost only wraps the host
+    // buffers; allochost adds three driver buffers and keeps the host
+    // ones, a and b being its source and c the copy of the result
+    printf("%d.%d: allocations: copy path %lu MB host + %lu MB device, %s %lu MB host + %lu MB driver\n",
+           d->pid, d->did, (unsigned long)(3 * bytes >> 20), (unsigned long)(3 * bytes >> 20),
+           usehost ? "usehost" : "allochost", (unsigned long)(3 * bytes >> 20),
+           (unsigned long)((usehost ? 0 : 3 * bytes) >> 20));
+
+    ok = 1;
+
+error:
+    for (j = 0; j < 3; j += 1)
+    {
+        if (mem[j] != NULL)
+        {
+            clReleaseMemObject(mem[j]);
+        }
+    }
+
+    if (queue != NULL)
+    {
+        clReleaseCommandQueue(queue);
+    }
+
+    if (kern != NULL)
+    {
+        clReleaseKernel(kern);
+    }
+
+    if (prog != NULL)
+    {
+        clReleaseProgram(prog);
+    }
+
+    return ok;
+}
+
+// Device SVM buffer capabilities, 0 when there is none (d->svm is only
+// queried on OpenCL 2.0 devices)
+static cl_device_svm_capabilities svmCaps(struct device *d)
+{
+    return d->svm & (CL_DEVICE_SVM_COARSE_GRAIN_BUFFER | CL_DEVICE_SVM_FINE_GRAIN_BUFFER);
+}
+
+// SVM path: a, b and c are clSVMAlloc allocations shared by the host and
+// the device, the kernel gets them with clSetKernelArgSVMPointer.
+//
+// coarse grain: the host side goes through clEnqueueSVMMap / Unmap,
+//          which is where the driver moves or syncs the data.
+// fine grain: the host reads and writes the allocations directly, the
+//          kernel completion is the only synchronisation.
+//
+// As for allochost, the host fill stands for an in place producer and is
+// timed apart.
+int testVectorSVM(struct device *d, struct data *x)
+{
+    cl_device_svm_capabilities caps;
+    cl_queue_properties props[3];
+    cl_command_queue queue;
+    cl_program prog;
+    cl_kernel kern;
+    cl_int err;
+    float *svm[3], *buf[3];
+    size_t bytes, size;
+    double start, mapped, end, fill;
+    unsigned int n;
+    char trk[64];
+    int fine, ok, j;
+
+    ok = 0;
+    prog = NULL;
+    queue = NULL;
+    memset(svm, 0, sizeof(svm));
+
+    buf[0] = x->buf0;
+    buf[1] = x->buf1;
+    buf[2] = x->buf2;
+    bytes = sizeof(cl_float) * x->size;
+
+    caps = svmCaps(d);
+    fine = (caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER) != 0;
+
+    printf("%d.%d: svm: %s grain buffers\n", d->pid, d->did, fine ? "fine" : "coarse");
+
+    kern = createVectorKernel(d, x->ctx, &prog);
+    if (kern == NULL)
+    {
+        goto error;
+    }
+
+    props[0] = CL_QUEUE_PROPERTIES;
+    props[1] = queueProps();
+    props[2] = 0;
+
+    queue = clCreateCommandQueueWithProperties(x->ctx, d->device, props, &err);
+    if (queue == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateCommandQueueWithProperties failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    track(trk, d, "queue");
+    start = wallTime();
+
+    for (j = 0; j < 3; j += 1)
+    {
+        svm[j] = (float *)clSVMAlloc(x->ctx, CL_MEM_READ_WRITE | (fine ? CL_MEM_SVM_FINE_GRAIN_BUFFER : 0),
+                                     bytes, 0);
+        if (svm[j] == NULL)
+        {
+            fprintf(stderr, "%d.%d: clSVMAlloc[svm%d] failed\n", d->pid, d->did, j);
+            goto error;
+        }
+    }
+
+    fill = 0;
+    for (j = 0; j < 2; j += 1)
+    {
+        if (!fine)
+        {
+            err = clEnqueueSVMMap(queue, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, svm[j], bytes, 0, NULL,
+                                  profEvent(prof, trk, "map a/b", PROF_MAP, bytes, 0));
+            if (err != CL_SUCCESS)
+            {
+                fprintf(stderr, "%d.%d: clEnqueueSVMMap[svm%d] failed with %d\n", d->pid, d->did, j, err);
+                goto error;
+            }
+        }
+
+        mapped = wallTime();
+        memcpy(svm[j], buf[j], bytes);
+        fill += wallTime() - mapped;
+
+        if (!fine)
+        {
+            err = clEnqueueSVMUnmap(queue, svm[j], 0, NULL, profEvent(prof, trk, "unmap a/b", PROF_UNMAP, bytes, 0));
+            if (err != CL_SUCCESS)
+            {
+                fprintf(stderr, "%d.%d: clEnqueueSVMUnmap[svm%d] failed with %d\n", d->pid, d->did, j, err);
+                goto error;
+            }
+        }
+    }
+
+    for (j = 0; j < 3; j += 1)
+    {
+        err = clSetKernelArgSVMPointer(kern, j, svm[j]);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clSetKernelArgSVMPointer[%d] failed with %d\n", d->pid, d->did, j, err);
+            goto error;
+        }
+    }
+
+    n = (unsigned int)x->size;
+
+    err = clSetKernelArg(kern, 3, sizeof(unsigned int), &n);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clSetKernelArg[3] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    size = (size_t)x->size;
+
+    err = clEnqueueNDRangeKernel(queue, kern, 1, NULL, &size, NULL, 0, NULL,
+                                 profEvent(prof, trk, "vAdd", PROF_KERNEL, 3 * bytes, (double)size));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueNDRangeKernel failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    // coarse grain: the map makes c visible, fine grain: the kernel end
+    if (fine)
+    {
+        err = clFinish(queue);
+    }
+    else
+    {
+        err = clEnqueueSVMMap(queue, CL_TRUE, CL_MAP_READ, svm[2], bytes, 0, NULL,
+                              profEvent(prof, trk, "map c", PROF_MAP, bytes, 0));
+    }
+
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: waiting for c failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    end = wallTime();
+
+    memcpy(x->buf2, svm[2], bytes);
+
+    if (!fine)
+    {
+        err = clEnqueueSVMUnmap(queue, svm[2], 0, NULL, profEvent(prof, trk, "unmap c", PROF_UNMAP, bytes, 0));
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clEnqueueSVMUnmap[svm2] failed with %d\n", d->pid, d->did, err);
+            goto error;
+        }
+    }
+
+    printf("%d.%d: svm path: %g seconds end-to-end (%g in host fill), %.2f GB/s, %.2fx copy path\n",
+           d->pid, d->did, end - start, fill, 3.0 * bytes / (end - start) / 1e9, x->wall / (end - start));
+
+    ok = 1;
+
+error:
+    // no SVM allocation may be freed while a command uses it
+    if (queue != NULL)
+    {
+        clFinish(queue);
+    }
+
+    for (j = 0; j < 3; j += 1)
+    {
+        if (svm[j] != NULL)
+        {
+            clSVMFree(x->ctx, svm[j]);
+        }
+    }
+
+    if (queue != NULL)
+    {
+        clReleaseCommandQueue(queue);
+    }
+
+    if (kern != NULL)
+    {
+        clReleaseKernel(kern);
+    }
+
+    if (prog != NULL)
+    {
+        clReleaseProgram(prog);
+    }
+
+    return ok;
+}
+
+// Staged path: uploads and downloads go through a clstage of opts.depth
+// pinned chunks of opts.chunk floats. Each kind of transfer is first timed
+// (best of STAGE_REPS) both directly from the pageable buffers and
+// through the stage, then the end-to-end run is staged upload, vAdd,
+// staged download.
+int testVectorStaged(struct device *d, struct data *x)
+{
+    static const char *names[4] = {"direct upload", "staged upload", "direct download", "staged download"};
+    struct clstage *stage;
+    cl_command_queue queue;
+    cl_program prog;
+    cl_kernel kern;
+    cl_mem mem[3];
+    cl_int err;
+    size_t bytes, size, moved;
+    double start, end, t, best[4];
+    unsigned int n;
+    int ok, j, k, r;
+
+    ok = 0;
+    prog = NULL;
+    queue = NULL;
+    stage = NULL;
+    memset(mem, 0, sizeof(mem));
+    bytes = sizeof(cl_float) * x->size;
+
+    kern = createVectorKernel(d, x->ctx, &prog);
+    if (kern == NULL)
+    {
+        goto error;
+    }
+
+    queue = clCreateCommandQueue(x->ctx, d->device, queueProps(), &err);
+    if (queue == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateCommandQueue failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    for (j = 0; j < 3; j += 1)
+    {
+        mem[j] = clCreateBuffer(x->ctx, j < 2 ? CL_MEM_READ_ONLY : CL_MEM_WRITE_ONLY, bytes, NULL, &err);
+        if (mem[j] == NULL)
+        {
+            fprintf(stderr, "%d.%d: clCreateBuffer[mem%d] failed with %d\n", d->pid, d->did, j, err);
+            goto error;
+        }
+
+        err = clSetKernelArg(kern, j, sizeof(cl_mem), &mem[j]);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clSetKernelArg[%d] failed with %d\n", d->pid, d->did, j, err);
+            goto error;
+        }
+    }
+
+    stage = createCLStage(x->ctx, queue, sizeof(cl_float) * (opts.chunk < x->size ? opts.chunk : x->size),
+                          (int)opts.depth);
+    if (stage == NULL)
+    {
+        fprintf(stderr, "%d.%d: %s", d->pid, d->did, getLastCLError());
+        goto error;
+    }
+
+    printf("%d.%d: staging through %u pinned chunks of %lu KB\n", d->pid, d->did, opts.depth,
+           (unsigned long)(sizeof(cl_float) * (opts.chunk < x->size ? opts.chunk : x->size) >> 10));
+
+    for (r = 0; r < STAGE_REPS; r += 1)
+    {
+        for (k = 0; k < 4; k += 1)
+        {
+            start = wallTime();
+
+            switch (k)
+            {
+            case 0:
+                err = clEnqueueWriteBuffer(queue, mem[0], CL_FALSE, 0, bytes, x->buf0, 0, NULL, NULL);
+                err |= clEnqueueWriteBuffer(queue, mem[1], CL_FALSE, 0, bytes, x->buf1, 0, NULL, NULL);
+                err |= clFinish(queue);
+                break;
+
+            case 1:
+                err = stageWrite(stage, mem[0], 0, x->buf0, bytes) && stageWrite(stage, mem[1], 0, x->buf1, bytes) ?
+                      clFinish(queue) : CL_OUT_OF_RESOURCES;
+                break;
+
+            case 2:
+                err = clEnqueueReadBuffer(queue, mem[2], CL_TRUE, 0, bytes, x->buf2, 0, NULL, NULL);
+                break;
+
+            default:
+                err = stageRead(stage, mem[2], 0, x->buf2, bytes) ? CL_SUCCESS : CL_OUT_OF_RESOURCES;
+                break;
+            }
+
+            t = wallTime() - start;
+
+            if (err != CL_SUCCESS)
+            {
+                fprintf(stderr, "%d.%d: %s failed with %d\n", d->pid, d->did, names[k], err);
+                goto error;
+            }
+
+            best[k] = r == 0 || t < best[k] ? t : best[k];
+        }
+    }
+
+    for (k = 0; k < 4; k += 2)
+    {
+        moved = k == 0 ? 2 * bytes : bytes;
+        printf("%d.%d: %s: direct %.2f GB/s, staged %.2f GB/s, %.2fx\n", d->pid, d->did,
+               k == 0 ? "upload" : "download", moved / best[k] / 1e9, moved / best[k + 1] / 1e9, best[k] / best[k + 1]);
+    }
+
+    memset(x->buf2, 0, bytes);
+
+    n = (unsigned int)x->size;
+    size = (size_t)x->size;
+
+    start = wallTime();
+
+    if (!stageWrite(stage, mem[0], 0, x->buf0, bytes) || !stageWrite(stage, mem[1], 0, x->buf1, bytes))
+    {
+        fprintf(stderr, "%d.%d: %s", d->pid, d->did, getLastCLError());
+        goto error;
+    }
+
+    err = clSetKernelArg(kern, 3, sizeof(unsigned int), &n);
+    err |= clEnqueueNDRangeKernel(queue, kern, 1, NULL, &size, NULL, 0, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: vAdd failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    if (!stageRead(stage, mem[2], 0, x->buf2, bytes))
+    {
+        fprintf(stderr, "%d.%d: %s", d->pid, d->did, getLastCLError());
+        goto error;
+    }
+
+    end = wallTime();
+
+    printf("%d.%d: staged path: %g seconds end-to-end, %.2f GB/s, %.2fx copy path\n",
+           d->pid, d->did, end - start, 3.0 * bytes / (end - start) / 1e9, x->wall / (end - start));
+
+    ok = 1;
+
+error:
+    freeCLStage(stage);
+
+    for (j = 0; j < 3; j += 1)
+    {
+        if (mem[j] != NULL)
+        {
+            clReleaseMemObject(mem[j]);
+        }
+    }
+
+    if (queue != NULL)
+    {
+        clReleaseCommandQueue(queue);
+    }
+
+    if (kern != NULL)
+    {
+        clReleaseKernel(kern);
+    }
+
+    if (prog != NULL)
+    {
+        clReleaseProgram(prog);
+    }
+
+    return ok;
+}
+
+// Time every vAdd variant (width x work per item x local size) on x's
+// buffers with event profiling, keep the fastest in x->prog / x->kern
+// along with its launch sizes. Data in the buffers does not matter here.
+int tuneVectorKernel(struct device *d, struct data *x)
+{
+    cl_program prog;
+    cl_kernel kern;
+    cl_event evt;
+    cl_ulong start, end, best, t;
+    size_t wgmax, local, global, nv, bglobal, blocal;
+    char options[32], trk[64];
+    cl_int err;
+    unsigned int w, i, l, r, bw, bi, n;
+    int cached;
+
+    n = (unsigned int)x->size;
+    best = 0;
+    bw = bi = 0;
+    bglobal = blocal = 0;
+
+    for (w = 0; w < sizeof(tuneWidths) / sizeof(tuneWidths[0]); w += 1)
+    {
+        sprintf(options, "-DW=%u", tuneWidths[w]);
+
+        prog = buildCLProgram(x->ctx, d, kernel_addv, options, &cached);
+        if (prog == NULL)
+        {
+            fprintf(stderr, "%d.%d: %s", d->pid, d->did, getLastCLError());
+            continue;
+        }
+
+        kern = clCreateKernel(prog, "vAddV", &err);
+        if (kern == NULL)
+        {
+            fprintf(stderr, "%d.%d: clCreateKernel[W=%u] failed with %d\n", d->pid, d->did, tuneWidths[w], err);
+            clReleaseProgram(prog);
+            continue;
+        }
+
+        err = clSetKernelArg(kern, 0, sizeof(cl_mem), &x->mem0);
+        err |= clSetKernelArg(kern, 1, sizeof(cl_mem), &x->mem1);
+        err |= clSetKernelArg(kern, 2, sizeof(cl_mem), &x->mem2);
+        err |= clSetKernelArg(kern, 3, sizeof(unsigned int), &n);
+        err |= clGetKernelWorkGroupInfo(kern, d->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(wgmax), &wgmax, NULL);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: vAddV[W=%u] setup failed with %d\n", d->pid, d->did, tuneWidths[w], err);
+            clReleaseKernel(kern);
+            clReleaseProgram(prog);
+            continue;
+        }
+
+        nv = x->size / tuneWidths[w];
+
+        for (i = 0; i < sizeof(tuneItems) / sizeof(tuneItems[0]); i += 1)
+        {
+            for (l = 0; l < sizeof(tuneLocals) / sizeof(tuneLocals[0]); l += 1)
+            {
+                local = tuneLocals[l];
+                if (local > wgmax)
+                {
+                    continue;
+                }
+
+                global = (nv + tuneItems[i] - 1) / tuneItems[i];
+                if (global == 0)
+                {
+                    global = 1;
+                }
+
+                if (local != 0)
+                {
+                    global = (global + local - 1) / local * local;
+                }
+
+                // best of TUNE_REPS
+                t = 0;
+                for (r = 0; r < TUNE_REPS; r += 1)
+                {
+                    err = clEnqueueNDRangeKernel(x->queue, kern, 1, NULL, &global,
+                                                 local != 0 ? &local : NULL, 0, NULL, &evt);
+                    if (err != CL_SUCCESS)
+                    {
+                        break;
+                    }
+
+                    profAddEvent(prof, evt, track(trk, d, "queue"), "vAddV (tune)", PROF_KERNEL,
+                                 3 * sizeof(cl_float) * x->size, (double)x->size);
+
+                    err = clWaitForEvents(1, &evt);
+                    err |= clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+                    err |= clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+                    clReleaseEvent(evt);
+                    if (err != CL_SUCCESS)
+                    {
+                        break;
+                    }
+
+                    if (t == 0 || end - start < t)
+                    {
+                        t = end - start;
+                    }
+                }
+
+                if (err != CL_SUCCESS || t == 0)
+                {
+                    fprintf(stderr, "%d.%d: vAddV[W=%u items=%u local=%d] failed with %d\n", d->pid, d->did,
+                            tuneWidths[w], tuneItems[i], (int)local, err);
+                    continue;
+                }
+
+                printf("%d.%d: vAddV W=%-2u items=%-2u local=%-3d %8.3f ms %7.2f GB/s\n", d->pid, d->did,
+                       tuneWidths[w], tuneItems[i], (int)local, (double)t / 1e6,
+                       3.0 * sizeof(cl_float) * x->size / (double)t);
+
+                if (best == 0 || t < best)
+                {
+                    best = t;
+                    bw = tuneWidths[w];
+                    bi = tuneItems[i];
+                    bglobal = global;
+                    blocal = local;
+
+                    if (x->kern != NULL)
+                    {
+                        clReleaseKernel(x->kern);
+                    }
+
+                    if (x->prog != NULL)
+                    {
+                        clReleaseProgram(x->prog);
+                    }
+
+                    clRetainKernel(kern);
+                    clRetainProgram(prog);
+                    x->kern = kern;
+                    x->prog = prog;
+                }
+            }
+        }
+
+        clReleaseKernel(kern);
+        clReleaseProgram(prog);
+    }
+
+    if (best == 0)
+    {
+        fprintf(stderr, "%d.%d: no vAdd variant ran\n", d->pid, d->did);
+        return 0;
+    }
+
+    x->global = bglobal;
+    x->local = blocal;
+
+    printf("%d.%d: fastest: W=%u items=%u local=%d, %.3f ms\n", d->pid, d->did,
+           bw, bi, (int)blocal, (double)best / 1e6);
+
+    return 1;
+}
+
+int testVectorStep3(struct device *d, struct data *x)
+{
+    cl_int err;
+    cl_ulong start, end;
+    double wstart, wend;
+    char trk[64];
+    unsigned int n;
+    int ok;
+
+    ok = 0;
+
+    x->kern = createVectorKernel(d, x->ctx, &x->prog);
+    if (x->kern == NULL)
+    {
+        goto error;
+    }
+
+    err = clSetKernelArg(x->kern, 0, sizeof(cl_mem), &x->mem0);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clSetKernelArg[0] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    err = clSetKernelArg(x->kern, 1, sizeof(cl_mem), &x->mem1);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clSetKernelArg[1] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    err = clSetKernelArg(x->kern, 2, sizeof(cl_mem), &x->mem2);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clSetKernelArg[2] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    n = (unsigned int)x->size;
+
+    err = clSetKernelArg(x->kern, 3, sizeof(unsigned int), &n);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clSetKernelArg[3] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    x->queue = clCreateCommandQueue(x->ctx, d->device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (x->queue == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateCommandQueue failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    x->global = (size_t)x->size;
+    x->local = 0;
+
+    if (opts.tune && !tuneVectorKernel(d, x))
+    {
+        goto error;
+    }
+
+    wstart = wallTime();
+
+    track(trk, d, "queue");
+
+    // async write
+    err = clEnqueueWriteBuffer(x->queue, x->mem0, CL_FALSE, 0, sizeof(cl_float) * x->size, x->buf0, 0, NULL,
+                               profEvent(prof, trk, "write a", PROF_WRITE, sizeof(cl_float) * x->size, 0));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueWriteBuffer[mem0] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    printf("%d.%d: mem0 uploaded\n", d->pid, d->did);
+
+    // async write
+    err = clEnqueueWriteBuffer(x->queue, x->mem1, CL_FALSE, 0, sizeof(cl_float) * x->size, x->buf1, 0, NULL,
+                               profEvent(prof, trk, "write b", PROF_WRITE, sizeof(cl_float) * x->size, 0));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueWriteBuffer[mem1] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    printf("%d.%d: mem1 uploaded\n", d->pid, d->did);
+
+    err = clEnqueueNDRangeKernel(x->queue, x->kern, 1, NULL, &x->global,
+                                 x->local != 0 ? &x->local : NULL, 0, NULL, &x->evt);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueNDRangeKernel failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    profAddEvent(prof, x->evt, trk, "vAdd", PROF_KERNEL, 3 * sizeof(cl_float) * x->size, (double)x->size);
+
+    printf("%d.%d: prog kernel queued\n", d->pid, d->did);
+
+    err = clFinish(x->queue);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueNDRangeKernel failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    printf("%d.%d: prog kernel finished\n", d->pid, d->did);
+
+    // block read
+    err = clEnqueueReadBuffer(x->queue, x->mem2, CL_TRUE, 0, sizeof(cl_float) * x->size, x->buf2, 0, NULL,
+                              profEvent(prof, trk, "read c", PROF_READ, sizeof(cl_float) * x->size, 0));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueReadBuffer[mem2] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    wend = wallTime();
+
+    printf("%d.%d: mem2 downloaded\n", d->pid, d->did);
+
+    err = clWaitForEvents(1, &x->evt);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clWaitForEvents failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+    
+    err = clGetEventProfilingInfo(x->evt, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clGetEventProfilingInfo[start] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    err = clGetEventProfilingInfo(x->evt, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clGetEventProfilingInfo[end] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    printf("%d.%d: duration: %g seconds\n", d->pid, d->did, (float)(end - start) / 1e9f);
+
+    x->kernel = (double)(end - start) / 1e9;
+
+    x->wall = wend - wstart;
+
+    printf("%d.%d: copy path: %g seconds end-to-end, %.2f GB/s\n", d->pid, d->did,
+           x->wall, 3.0 * sizeof(cl_float) * x->size / x->wall / 1e9);
+
+    ok = 1;
+
+error:
+    if (x->evt) {
+        err = clReleaseEvent(x->evt);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clReleaseEvent failed with %d\n", d->pid, d->did, err);
+        }
+    }
+
+    if (x->queue)
+    {
+        err = clReleaseCommandQueue(x->queue);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clReleaseCommandQueue failed with %d\n", d->pid, d->did, err);
+            goto error;
+        }
+    }
+
+    if (x->kern)
+    {
+        err = clReleaseKernel(x->kern);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clReleaseKernel failed with %d\n", d->pid, d->did, err);
+            goto error;
+        }
+    }
+
+    if (x->prog)
+    {
+        err = clReleaseProgram(x->prog);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clReleaseProgram failed with %d\n", d->pid, d->did, err);
+            goto error;
+        }
+    }
+
+    return ok;
+}
+
+int testVectorStep2(struct device *d, struct data *x)
+{
+    cl_int err;
+    int ok;
+
+    ok = 0;
+
+    x->mem0 = clCreateBuffer(x->ctx, CL_MEM_READ_ONLY, sizeof(cl_float) * x->size, NULL, &err);
+    if (x->mem0 == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateBuffer[mem0] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    printf("%d.%d: mem0 buffer allocated\n", d->pid, d->did);
+
+    x->mem1 = clCreateBuffer(x->ctx, CL_MEM_READ_ONLY, sizeof(cl_float) * x->size, NULL, &err);
+    if (x->mem1 == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateBuffer[mem1] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    printf("%d.%d: mem1 buffer allocated\n", d->pid, d->did);
+
+    x->mem2 = clCreateBuffer(x->ctx, CL_MEM_READ_ONLY, sizeof(cl_float) * x->size, NULL, &err);
+    if (x->mem2 == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateBuffer[mem2] failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    printf("%d.%d: mem2 buffer allocated\n", d->pid, d->did);
+
+    ok = testVectorStep3(d, x);
+
+error:
+    if (x->mem2 != NULL)
+    {
+        err = clReleaseMemObject(x->mem2);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clReleaseMemObject(mem2) failed with %d\n", d->pid, d->did, err);
+        }
+    }
+
+    if (x->mem1 != NULL)
+    {
+        err = clReleaseMemObject(x->mem1);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clReleaseMemObject(mem1) failed with %d\n", d->pid, d->did, err);
+        }
+    }
+
+    if (x->mem0 != NULL)
+    {
+        err = clReleaseMemObject(x->mem0);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clReleaseMemObject(mem0) failed with %d\n", d->pid, d->did, err);
+        }
+    }
+
+    return ok;
+}
+
+void testVectorStep1(struct device *d)
+{
+    struct data x;
+    cl_int err;
+    double start, dur;
+    char tag[32];
+    float *buf;
+    int ok;
+
+    memset(&x, 0, sizeof(x));
+    buf = NULL;
+
+    x.size = opts.size;
+
+    x.buf0 = (float *)allocHost(x.size * sizeof(float));
+    if (x.buf0 == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [x.buf0]\n");
+        goto error;
+    }
+
+    x.buf1 = (float *)allocHost(x.size * sizeof(float));
+    if (x.buf1 == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [x.buf1]\n");
+        goto error;
+    }
+
+    sprintf(tag, "%d.%d", d->pid, d->did);
+    generateVectors(tag, x.buf0, x.buf1, x.size);
+
+    x.buf2 = (float *)allocHost(x.size * sizeof(float));
+    if (x.buf2 == NULL)
     {
         fprintf(stderr, "Could not allocate memory [x.buf2]\n");
         goto error;
     }
 
-    x.ctx = clCreateContext(NULL, 1, &d->device, NULL, NULL, &err);
-    if (x.ctx == NULL)
+    x.ctx = clCreateContext(NULL, 1, &d->device, NULL, NULL, &err);
+    if (x.ctx == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateContext failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    printf("%d.%d: context created\n", d->pid, d->did);
+
+    if (!fitsDevice(d, x.size))
+    {
+        // no copy path reference: straight to the tiled path
+        printf("%d.%d: %lu floats do not fit the device, using the stream path\n",
+               d->pid, d->did, (unsigned long)x.size);
+        ok = testVectorStream(d, &x);
+    }
+    else
+    {
+        ok = testVectorStep2(d, &x);
+
+        if (ok && strcmp(opts.mode, "stream") == 0)
+        {
+            // the copy path above is kept as the reference
+            memset(x.buf2, 0, sizeof(float) * x.size);
+            ok = testVectorStream(d, &x);
+        }
+        else if (ok && strcmp(opts.mode, "staged") == 0)
+        {
+            memset(x.buf2, 0, sizeof(float) * x.size);
+            ok = testVectorStaged(d, &x);
+        }
+        else if (ok && strcmp(opts.mode, "svm") == 0)
+        {
+            // no SVM: the copy path result above is the one checked
+            if (svmCaps(d) == 0)
+            {
+                printf("%d.%d: no svm support, falling back to the buffer path\n", d->pid, d->did);
+            }
+            else
+            {
+                memset(x.buf2, 0, sizeof(float) * x.size);
+                ok = testVectorSVM(d, &x);
+            }
+        }
+        else if (ok && strcmp(opts.mode, "copy") != 0)
+        {
+            memset(x.buf2, 0, sizeof(float) * x.size);
+            ok = testVectorZeroCopy(d, &x);
+        }
+    }
+
+    if (ok)
+    {
+        buf = (float *)allocHost(sizeof(float) * x.size);
+        if (buf == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory [buf]\n");
+            goto error;
+        }
+
+        printf("%d.%d: computing vector addition with CPU (%s, %d threads)\n", d->pid, d->did,
+               getSimdName(opts.simd), getThreadCount(hostPool));
+
+        // first touch outside of the timing, the device buffers are not
+        // counted either
+        memset(buf, 0, sizeof(float) * x.size);
+
+        // wall clock: CLOCK_PROCESS_CPUTIME_ID sums the time of all threads
+        start = wallTime();
+        hostAdd(x.buf0, x.buf1, buf, x.size);
+        dur = wallTime() - start;
+
+        printf("%d.%d: vectors added in %g seconds, %.2f GB/s\n", d->pid, d->did,
+               dur, 3.0 * sizeof(float) * x.size / dur / 1e9);
+
+        if (x.kernel > 0 && x.wall > 0)
+        {
+            printf("%d.%d: device vs cpu: %.2fx kernel only, %.2fx end-to-end\n", d->pid, d->did,
+                   dur / x.kernel, dur / x.wall);
+        }
+
+        checkVectors(tag, x.buf0, x.buf1, x.buf2, buf, x.size);
+    }
+
+error:
+    if (buf)
+    {
+        free(buf);
+    }
+
+    if (x.ctx)
+    {
+        err = clReleaseContext(x.ctx);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clReleaseContext failed with %d\n", d->pid, d->did, err);
+        }
+    }
+
+    if (x.buf2)
+    {
+        free(x.buf2);
+    }
+
+    if (x.buf1)
+    {
+        free(x.buf1);
+    }
+
+    if (x.buf0)
+    {
+        free(x.buf0);
+    }
+}
+
+static double eventTime(cl_event evt)
+{
+    cl_ulong start, end;
+
+    if (clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) != CL_SUCCESS ||
+        clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) != CL_SUCCESS)
+    {
+        return 0;
+    }
+
+    return (double)(end - start) / 1e9;
+}
+
+// first command's start to last command's end
+static double eventSpan(cl_event first, cl_event last)
+{
+    cl_ulong start, end;
+
+    if (clGetEventProfilingInfo(first, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) != CL_SUCCESS ||
+        clGetEventProfilingInfo(last, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) != CL_SUCCESS)
+    {
+        return 0;
+    }
+
+    return (double)(end - start) / 1e9;
+}
+
+// Benchmark mode: the copy path of testVectorStep3 (upload a and b, vAdd,
+// download c) run opts.warmup times untimed then opts.reps times for each
+// size of a geometric sweep. Upload, kernel and download come from the
+// events, end-to-end is the wall clock around the whole run.
+#define STAGES      4
+
+static const char *stageNames[STAGES] = {"upload", "kernel", "download", "e2e"};
+
+static FILE *benchOut;
+static int benchRows;
+
+// csv: "" escapes a quote, json: \"
+static void writeQuoted(FILE *f, const char *s, int json)
+{
+    fputc('"', f);
+    for (; *s != 0; s += 1)
+    {
+        if (*s == '"' || (json && *s == '\\'))
+        {
+            fputc(json ? '\\' : '"', f);
+        }
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void writeBenchRow(struct device *d, const char *driver, size_t n, int stage, struct stats *s)
+{
+    double bytes, rate;
+    int json;
+
+    // moved bytes: a and b up, c down, all three for the kernel and e2e
+    bytes = (double)sizeof(cl_float) * n * (stage == 0 ? 2 : stage == 2 ? 1 : 3);
+    rate = s->median > 0 ? bytes / s->median / 1e9 : 0;
+
+    if (strcmp(opts.format, "text") == 0)
+    {
+        if (benchRows == 0)
+        {
+            fprintf(benchOut, "%-6s %12s %-8s %5s %10s %10s %10s %10s %10s %8s\n", "device", "size", "stage",
+                    "reps", "min ms", "median ms", "p95 ms", "mean ms", "stddev ms", "GB/s");
+        }
+
+        fprintf(benchOut, "%d.%-4d %12lu %-8s %5d %10.4f %10.4f %10.4f %10.4f %10.4f %8.2f\n", d->pid, d->did,
+                (unsigned long)n, stageNames[stage], s->count, s->min * 1e3, s->median * 1e3, s->p95 * 1e3,
+                s->mean * 1e3, s->stddev * 1e3, rate);
+    }
+    else
+    {
+        json = strcmp(opts.format, "json") == 0;
+
+        if (json)
+        {
+            fprintf(benchOut, "%s\n{\"device\":\"%d.%d\",\"name\":", benchRows == 0 ? "[" : ",", d->pid, d->did);
+            writeQuoted(benchOut, d->name, 1);
+            fprintf(benchOut, ",\"driver\":");
+            writeQuoted(benchOut, driver, 1);
+            fprintf(benchOut, ",\"size\":%lu,\"bytes\":%.0f,\"stage\":\"%s\",\"reps\":%d,\"min_ms\":%.6f,"
+                              "\"median_ms\":%.6f,\"p95_ms\":%.6f,\"mean_ms\":%.6f,\"stddev_ms\":%.6f,\"gbps\":%.3f}",
+                    (unsigned long)n, bytes, stageNames[stage], s->count, s->min * 1e3, s->median * 1e3,
+                    s->p95 * 1e3, s->mean * 1e3, s->stddev * 1e3, rate);
+        }
+        else
+        {
+            if (benchRows == 0)
+            {
+                fprintf(benchOut, "device,name,driver,size,bytes,stage,reps,"
+                                  "min_ms,median_ms,p95_ms,mean_ms,stddev_ms,gbps\n");
+            }
+
+            fprintf(benchOut, "%d.%d,", d->pid, d->did);
+            writeQuoted(benchOut, d->name, 0);
+            fputc(',', benchOut);
+            writeQuoted(benchOut, driver, 0);
+            fprintf(benchOut, ",%lu,%.0f,%s,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.3f\n",
+                    (unsigned long)n, bytes, stageNames[stage], s->count, s->min * 1e3, s->median * 1e3,
+                    s->p95 * 1e3, s->mean * 1e3, s->stddev * 1e3, rate);
+        }
+    }
+
+    fflush(benchOut);
+    benchRows += 1;
+}
+
+// One size of the sweep: x->size floats, kernel and queue from the caller
+static int benchVectorSize(struct device *d, struct data *x, const char *driver, const float *ref)
+{
+    cl_event evt[4];
+    struct stats s;
+    double *times, wstart, wend;
+    char tag[64], trk[64];
+    size_t bytes;
+    unsigned int n;
+    cl_int err;
+    int r, j, ok;
+
+    ok = 0;
+    memset(evt, 0, sizeof(evt));
+
+    bytes = sizeof(cl_float) * x->size;
+    n = (unsigned int)x->size;
+
+    sprintf(tag, "%d.%d [%lu]", d->pid, d->did, (unsigned long)x->size);
+    track(trk, d, "queue");
+
+    times = (double *)malloc(STAGES * opts.reps * sizeof(double));
+    if (times == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [times]\n");
+        return 0;
+    }
+
+    x->mem0 = clCreateBuffer(x->ctx, CL_MEM_READ_ONLY, bytes, NULL, &err);
+    x->mem1 = clCreateBuffer(x->ctx, CL_MEM_READ_ONLY, bytes, NULL, &err);
+    x->mem2 = clCreateBuffer(x->ctx, CL_MEM_WRITE_ONLY, bytes, NULL, &err);
+    if (x->mem0 == NULL || x->mem1 == NULL || x->mem2 == NULL)
+    {
+        fprintf(stderr, "%s: clCreateBuffer failed with %d\n", tag, err);
+        goto error;
+    }
+
+    err = clSetKernelArg(x->kern, 0, sizeof(cl_mem), &x->mem0);
+    err |= clSetKernelArg(x->kern, 1, sizeof(cl_mem), &x->mem1);
+    err |= clSetKernelArg(x->kern, 2, sizeof(cl_mem), &x->mem2);
+    err |= clSetKernelArg(x->kern, 3, sizeof(unsigned int), &n);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%s: clSetKernelArg failed with %d\n", tag, err);
+        goto error;
+    }
+
+    x->global = x->size;
+
+    // a stale result from a smaller size would pass the check
+    memset(x->buf2, 0, bytes);
+
+    for (r = -opts.warmup; r < opts.reps; r += 1)
+    {
+        wstart = wallTime();
+
+        err = clEnqueueWriteBuffer(x->queue, x->mem0, CL_FALSE, 0, bytes, x->buf0, 0, NULL, &evt[0]);
+        err |= clEnqueueWriteBuffer(x->queue, x->mem1, CL_FALSE, 0, bytes, x->buf1, 0, NULL, &evt[1]);
+        err |= clEnqueueNDRangeKernel(x->queue, x->kern, 1, NULL, &x->global, NULL, 0, NULL, &evt[2]);
+        err |= clEnqueueReadBuffer(x->queue, x->mem2, CL_TRUE, 0, bytes, x->buf2, 0, NULL, &evt[3]);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%s: run %d failed with %d\n", tag, r, err);
+            goto error;
+        }
+
+        wend = wallTime();
+
+        if (r >= 0)
+        {
+            times[0 * opts.reps + r] = eventSpan(evt[0], evt[1]);
+            times[1 * opts.reps + r] = eventTime(evt[2]);
+            times[2 * opts.reps + r] = eventTime(evt[3]);
+            times[3 * opts.reps + r] = wend - wstart;
+
+            profAddEvent(prof, evt[0], trk, "write a", PROF_WRITE, bytes, 0);
+            profAddEvent(prof, evt[1], trk, "write b", PROF_WRITE, bytes, 0);
+            profAddEvent(prof, evt[2], trk, "vAdd", PROF_KERNEL, 3 * bytes, (double)x->size);
+            profAddEvent(prof, evt[3], trk, "read c", PROF_READ, bytes, 0);
+        }
+
+        for (j = 0; j < 4; j += 1)
+        {
+            clReleaseEvent(evt[j]);
+            evt[j] = NULL;
+        }
+    }
+
+    if (!checkVectors(tag, x->buf0, x->buf1, x->buf2, ref, x->size))
+    {
+        goto error;
+    }
+
+    for (j = 0; j < STAGES; j += 1)
+    {
+        computeStats(times + j * opts.reps, opts.reps, &s);
+        writeBenchRow(d, driver, x->size, j, &s);
+    }
+
+    ok = 1;
+
+error:
+    for (j = 0; j < 4; j += 1)
+    {
+        if (evt[j] != NULL)
+        {
+            clReleaseEvent(evt[j]);
+        }
+    }
+
+    if (x->mem2 != NULL)
+    {
+        clReleaseMemObject(x->mem2);
+        x->mem2 = NULL;
+    }
+
+    if (x->mem1 != NULL)
+    {
+        clReleaseMemObject(x->mem1);
+        x->mem1 = NULL;
+    }
+
+    if (x->mem0 != NULL)
+    {
+        clReleaseMemObject(x->mem0);
+        x->mem0 = NULL;
+    }
+
+    free(times);
+    return ok;
+}
+
+void testVectorBench(struct device *d)
+{
+    struct data x;
+    size_t first, last, n;
+    char tag[32];
+    float *ref;
+    cl_int err;
+
+    memset(&x, 0, sizeof(x));
+    ref = NULL;
+
+    first = opts.sweep[0] != 0 ? opts.sweep[0] : opts.size;
+    last = opts.sweep[0] != 0 ? opts.sweep[1] : opts.size;
+
+    // generated once at the largest size: element i does not depend on n,
+    // so every smaller size is a prefix
+    x.buf0 = (float *)allocHost(last * sizeof(float));
+    x.buf1 = (float *)allocHost(last * sizeof(float));
+    x.buf2 = (float *)allocHost(last * sizeof(float));
+    ref = (float *)allocHost(last * sizeof(float));
+    if (x.buf0 == NULL || x.buf1 == NULL || x.buf2 == NULL || ref == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [bench buffers]\n");
+        goto error;
+    }
+
+    sprintf(tag, "%d.%d", d->pid, d->did);
+    generateVectors(tag, x.buf0, x.buf1, last);
+    hostAdd(x.buf0, x.buf1, ref, last);
+
+    x.ctx = clCreateContext(NULL, 1, &d->device, NULL, NULL, &err);
+    if (x.ctx == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateContext failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    x.kern = createVectorKernel(d, x.ctx, &x.prog);
+    if (x.kern == NULL)
+    {
+        goto error;
+    }
+
+    x.queue = clCreateCommandQueue(x.ctx, d->device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (x.queue == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateCommandQueue failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    printf("%d.%d: benchmark, %lu to %lu floats, %d warmup and %d timed runs per size\n", d->pid, d->did,
+           (unsigned long)first, (unsigned long)last, opts.warmup, opts.reps);
+
+    for (n = first; n <= last; n *= opts.factor)
+    {
+        x.size = n;
+
+        if (!fitsDevice(d, n))
+        {
+            printf("%d.%d: %lu floats do not fit the device, sweep stopped\n", d->pid, d->did, (unsigned long)n);
+            break;
+        }
+
+        if (!benchVectorSize(d, &x, d->driver, ref))
+        {
+            break;
+        }
+
+        if (n > last / opts.factor)
+        {
+            break;
+        }
+    }
+
+error:
+
+    if (x.queue)
+    {
+        clReleaseCommandQueue(x.queue);
+    }
+
+    if (x.kern)
+    {
+        clReleaseKernel(x.kern);
+    }
+
+    if (x.prog)
+    {
+        clReleaseProgram(x.prog);
+    }
+
+    if (x.ctx)
+    {
+        clReleaseContext(x.ctx);
+    }
+
+    free(ref);
+    free(x.buf2);
+    free(x.buf1);
+    free(x.buf0);
+}
+
+// c = a + b against a runtime: buffers are reused while they are large
+// enough, kernel arguments are only set again when one is reallocated
+static int runtimeVectorAdd(struct clrt *rt, const float *a, const float *b, float *c, size_t n)
+{
+    cl_kernel kern;
+    cl_mem mem[3];
+    size_t bytes, global;
+    unsigned int un;
+    char trk[64];
+    int fresh[3], j;
+    cl_int err;
+
+    bytes = sizeof(cl_float) * n;
+
+    kern = getCLKernel(rt, "vAdd");
+    mem[0] = getCLBuffer(rt, "a", bytes, CL_MEM_READ_ONLY, &fresh[0]);
+    mem[1] = getCLBuffer(rt, "b", bytes, CL_MEM_READ_ONLY, &fresh[1]);
+    mem[2] = getCLBuffer(rt, "c", bytes, CL_MEM_WRITE_ONLY, &fresh[2]);
+    if (kern == NULL || mem[0] == NULL || mem[1] == NULL || mem[2] == NULL)
+    {
+        fprintf(stderr, "%d.%d: %s", rt->d->pid, rt->d->did, getLastCLError());
+        return 0;
+    }
+
+    err = CL_SUCCESS;
+    for (j = 0; j < 3; j += 1)
+    {
+        if (fresh[j])
+        {
+            err |= clSetKernelArg(kern, j, sizeof(cl_mem), &mem[j]);
+        }
+    }
+
+    un = (unsigned int)n;
+    global = n;
+    track(trk, rt->d, "queue");
+
+    err |= clSetKernelArg(kern, 3, sizeof(unsigned int), &un);
+    err |= clEnqueueWriteBuffer(rt->queue, mem[0], CL_FALSE, 0, bytes, a, 0, NULL,
+                                profEvent(prof, trk, "write a", PROF_WRITE, bytes, 0));
+    err |= clEnqueueWriteBuffer(rt->queue, mem[1], CL_FALSE, 0, bytes, b, 0, NULL,
+                                profEvent(prof, trk, "write b", PROF_WRITE, bytes, 0));
+    err |= clEnqueueNDRangeKernel(rt->queue, kern, 1, NULL, &global, NULL, 0, NULL,
+                                  profEvent(prof, trk, "vAdd", PROF_KERNEL, 3 * bytes, (double)n));
+    err |= clEnqueueReadBuffer(rt->queue, mem[2], CL_TRUE, 0, bytes, c, 0, NULL,
+                               profEvent(prof, trk, "read c", PROF_READ, bytes, 0));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: runtime vAdd failed with %d\n", rt->d->pid, rt->d->did, err);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Runtime mode: context, queue, program and buffers are set up once, then
+// the addition is called opts.reps times like a library call in a loop.
+// Reports the one-time setup and the per-call cost.
+void testVectorRuntime(struct device *d)
+{
+    struct clrt *rt;
+    struct stats s;
+    float *a, *b, *c, *ref;
+    double *times, start, setup;
+    char tag[32];
+    int r;
+
+    rt = NULL;
+    a = b = c = ref = NULL;
+    times = NULL;
+
+    a = (float *)allocHost(opts.size * sizeof(float));
+    b = (float *)allocHost(opts.size * sizeof(float));
+    c = (float *)allocHost(opts.size * sizeof(float));
+    ref = (float *)allocHost(opts.size * sizeof(float));
+    times = (double *)malloc(opts.reps * sizeof(double));
+    if (a == NULL || b == NULL || c == NULL || ref == NULL || times == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [runtime buffers]\n");
+        goto error;
+    }
+
+    sprintf(tag, "%d.%d", d->pid, d->did);
+    generateVectors(tag, a, b, opts.size);
+    hostAdd(a, b, ref, opts.size);
+
+    start = wallTime();
+
+    rt = createCLRuntime(d, queueProps());
+    if (rt == NULL || !addCLProgram(rt, kernel_add, NULL))
+    {
+        fprintf(stderr, "%s: %s", tag, getLastCLError());
+        goto error;
+    }
+
+    setup = wallTime() - start;
+
+    // the first call also allocates the buffers
+    for (r = -opts.warmup; r < opts.reps; r += 1)
+    {
+        start = wallTime();
+        if (!runtimeVectorAdd(rt, a, b, c, opts.size))
+        {
+            goto error;
+        }
+
+        if (r >= 0)
+        {
+            times[r] = wallTime() - start;
+        }
+    }
+
+    if (!checkVectors(tag, a, b, c, ref, opts.size))
+    {
+        goto error;
+    }
+
+    computeStats(times, opts.reps, &s);
+
+    printf("%s: runtime setup %.3f ms (context, queue, program)\n", tag, setup * 1e3);
+    printf("%s: %d calls of %lu floats: min %.1f us, median %.1f us, p95 %.1f us\n", tag, s.count,
+           (unsigned long)opts.size, s.min * 1e6, s.median * 1e6, s.p95 * 1e6);
+    printCLPoolStats(rt->pool, stdout);
+
+error:
+    freeCLRuntime(rt);
+    free(times);
+    free(ref);
+    free(c);
+    free(b);
+    free(a);
+}
+
+// Batch mode: many small independent adds in one launch. The jobs' a and
+// b are packed after an offsets table into a single input buffer, vAddSeg
+// runs one work-group per job, and the packed c comes back in a single
+// read: one upload, one launch and one download for the whole batch.
+struct job
+{
+    const float *a;
+    const float *b;
+    float *c;
+    unsigned int n;
+};
+
+struct batch
+{
+    struct clrt *rt;
+    cl_uint *in;            // offsets table, then a, then b
+    float *out;
+    size_t capacity;        // floats per vector in the staging buffers
+    size_t local;
+};
+
+static int initBatch(struct batch *bt, struct clrt *rt)
+{
+    cl_kernel kern;
+    size_t wgmax;
+
+    memset(bt, 0, sizeof(*bt));
+    bt->rt = rt;
+
+    kern = getCLKernel(rt, "vAddSeg");
+    if (kern == NULL ||
+        clGetKernelWorkGroupInfo(kern, rt->d->device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(wgmax), &wgmax, NULL) != CL_SUCCESS)
+    {
+        return 0;
+    }
+
+    // jobs of a few hundred floats: more lanes would idle
+    bt->local = wgmax < BATCH_LOCAL ? wgmax : BATCH_LOCAL;
+    return 1;
+}
+
+static void freeBatch(struct batch *bt)
+{
+    free(bt->in);
+    free(bt->out);
+}
+
+// offsets of the a part in the input buffer, in uints: after the table,
+// on a 64 bytes boundary
+static size_t batchBase(int njobs)
+{
+    return ((size_t)njobs + 1 + 15) & ~(size_t)15;
+}
+
+// jobs[0 .. njobs), total floats at most BATCH_MAX
+static int runBatchPart(struct batch *bt, struct job *jobs, int njobs, size_t total)
+{
+    struct clrt *rt;
+    cl_kernel kern;
+    cl_mem in, out;
+    size_t base, bytes, global, off;
+    unsigned int ujobs;
+    char trk[64];
+    int fresh[2], j;
+    cl_int err;
+
+    rt = bt->rt;
+    base = batchBase(njobs);
+    bytes = sizeof(cl_uint) * (base + 2 * total);
+
+    if (bt->capacity < base + 2 * total)
+    {
+        free(bt->in);
+        free(bt->out);
+
+        bt->capacity = base + 2 * total;
+        bt->in = (cl_uint *)allocHost(sizeof(cl_uint) * bt->capacity);
+        bt->out = (float *)allocHost(sizeof(float) * bt->capacity);
+        if (bt->in == NULL || bt->out == NULL)
+        {
+            fprintf(stderr, "Could not allocate memory [batch]\n");
+            bt->capacity = 0;
+            return 0;
+        }
+    }
+
+    // gather
+    off = 0;
+    for (j = 0; j < njobs; j += 1)
+    {
+        bt->in[j] = (cl_uint)off;
+        memcpy((float *)(bt->in + base) + off, jobs[j].a, sizeof(float) * jobs[j].n);
+        memcpy((float *)(bt->in + base) + total + off, jobs[j].b, sizeof(float) * jobs[j].n);
+        off += jobs[j].n;
+    }
+    bt->in[njobs] = (cl_uint)off;
+
+    kern = getCLKernel(rt, "vAddSeg");
+    in = getCLBuffer(rt, "batch in", bytes, CL_MEM_READ_ONLY, &fresh[0]);
+    out = getCLBuffer(rt, "batch out", sizeof(cl_float) * total, CL_MEM_WRITE_ONLY, &fresh[1]);
+    if (kern == NULL || in == NULL || out == NULL)
+    {
+        fprintf(stderr, "%d.%d: %s", rt->d->pid, rt->d->did, getLastCLError());
+        return 0;
+    }
+
+    ujobs = (unsigned int)njobs;
+    global = (size_t)njobs * bt->local;
+    track(trk, rt->d, "queue");
+
+    err = clSetKernelArg(kern, 0, sizeof(cl_mem), &in);
+    err |= clSetKernelArg(kern, 1, sizeof(cl_mem), &out);
+    err |= clSetKernelArg(kern, 2, sizeof(unsigned int), &ujobs);
+    err |= clEnqueueWriteBuffer(rt->queue, in, CL_FALSE, 0, bytes, bt->in, 0, NULL,
+                                profEvent(prof, trk, "write batch", PROF_WRITE, bytes, 0));
+    err |= clEnqueueNDRangeKernel(rt->queue, kern, 1, NULL, &global, &bt->local, 0, NULL,
+                                  profEvent(prof, trk, "vAddSeg", PROF_KERNEL, 3 * sizeof(cl_float) * total,
+                                            (double)total));
+    err |= clEnqueueReadBuffer(rt->queue, out, CL_TRUE, 0, sizeof(cl_float) * total, bt->out, 0, NULL,
+                               profEvent(prof, trk, "read batch", PROF_READ, sizeof(cl_float) * total, 0));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: batch of %d jobs failed with %d\n", rt->d->pid, rt->d->did, njobs, err);
+        return 0;
+    }
+
+    // scatter
+    for (j = 0; j < njobs; j += 1)
+    {
+        memcpy(jobs[j].c, bt->out + bt->in[j], sizeof(float) * jobs[j].n);
+    }
+
+    return 1;
+}
+
+// All the jobs, in as few launches as BATCH_MAX allows
+static int runBatch(struct batch *bt, struct job *jobs, int njobs)
+{
+    size_t total;
+    int first, j;
+
+    first = 0;
+    total = 0;
+
+    for (j = 0; j < njobs; j += 1)
+    {
+        if (j > first && total + jobs[j].n > BATCH_MAX)
+        {
+            if (!runBatchPart(bt, jobs + first, j - first, total))
+            {
+                return 0;
+            }
+
+            first = j;
+            total = 0;
+        }
+
+        total += jobs[j].n;
+    }
+
+    return first == njobs || runBatchPart(bt, jobs + first, njobs - first, total);
+}
+
+void testVectorBatch(struct device *d)
+{
+    struct clrt *rt;
+    struct batch bt;
+    struct job *jobs;
+    float *a, *b, *c, *ref;
+    double start, single, batched;
+    size_t off;
+    char tag[32];
+    int njobs, nsingle, j;
+
+    rt = NULL;
+    jobs = NULL;
+    a = b = c = ref = NULL;
+    memset(&bt, 0, sizeof(bt));
+
+    a = (float *)allocHost(opts.size * sizeof(float));
+    b = (float *)allocHost(opts.size * sizeof(float));
+    c = (float *)allocHost(opts.size * sizeof(float));
+    ref = (float *)allocHost(opts.size * sizeof(float));
+    jobs = (struct job *)malloc((opts.size / JOB_MIN + 1) * sizeof(*jobs));
+    if (a == NULL || b == NULL || c == NULL || ref == NULL || jobs == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [batch buffers]\n");
+        goto error;
+    }
+
+    sprintf(tag, "%d.%d", d->pid, d->did);
+    generateVectors(tag, a, b, opts.size);
+    hostAdd(a, b, ref, opts.size);
+
+    // job sizes from stream 2 of the generator, JOB_MIN to JOB_MAX floats
+    njobs = 0;
+    for (off = 0; off < opts.size; off += jobs[njobs].n, njobs += 1)
+    {
+        jobs[njobs].n = JOB_MIN + (unsigned int)(uniformAt(opts.seed, 2, njobs) * (JOB_MAX - JOB_MIN));
+        if (jobs[njobs].n > opts.size - off)
+        {
+            jobs[njobs].n = (unsigned int)(opts.size - off);
+        }
+
+        jobs[njobs].a = a + off;
+        jobs[njobs].b = b + off;
+        jobs[njobs].c = c + off;
+    }
+
+    rt = createCLRuntime(d, queueProps());
+    if (rt == NULL || !addCLProgram(rt, kernel_add, NULL) || !addCLProgram(rt, kernel_addseg, NULL) ||
+        !initBatch(&bt, rt))
+    {
+        fprintf(stderr, "%s: %s", tag, getLastCLError());
+        goto error;
+    }
+
+    // one job at a time, on the first SINGLE_JOBS jobs (after one warmup)
+    nsingle = njobs < SINGLE_JOBS ? njobs : SINGLE_JOBS;
+    if (!runtimeVectorAdd(rt, jobs[0].a, jobs[0].b, jobs[0].c, jobs[0].n))
+    {
+        goto error;
+    }
+
+    start = wallTime();
+    for (j = 0; j < nsingle; j += 1)
+    {
+        if (!runtimeVectorAdd(rt, jobs[j].a, jobs[j].b, jobs[j].c, jobs[j].n))
+        {
+            goto error;
+        }
+    }
+    single = (wallTime() - start) / nsingle;
+
+    memset(c, 0, sizeof(float) * opts.size);
+
+    // warmup at full size, then timed
+    if (!runBatch(&bt, jobs, njobs))
+    {
+        goto error;
+    }
+
+    memset(c, 0, sizeof(float) * opts.size);
+
+    start = wallTime();
+    if (!runBatch(&bt, jobs, njobs))
+    {
+        goto error;
+    }
+    batched = (wallTime() - start) / njobs;
+
+    printf("%s: %d jobs of %d to %d floats\n", tag, njobs, JOB_MIN, JOB_MAX);
+    printf("%s: one launch per job: %.2f us per job, %.0f jobs/s\n", tag, single * 1e6, 1 / single);
+    printf("%s: batched: %.2f us per job, %.0f jobs/s, %.2f GB/s, %.1fx\n", tag, batched * 1e6, 1 / batched,
+           3.0 * sizeof(float) * opts.size / (batched * njobs) / 1e9, single / batched);
+
+    checkVectors(tag, a, b, c, ref, opts.size);
+
+error:
+    freeBatch(&bt);
+    freeCLRuntime(rt);
+    free(jobs);
+    free(ref);
+    free(c);
+    free(b);
+    free(a);
+}
+
+// Low precision mode: vAdd with a, b and c stored as f32, f16, bf16 or
+// int8, computed in fp32. Each format is converted on the host (threads,
+// SIMD), uploaded, added, downloaded and converted back; the device part
+// and the conversions are timed apart over opts.reps runs, and c is
+// checked against the fp32 reference within the rounding of the format:
+//   f16, bf16: 2.01 u (|a| + |b|) + 2^-23, u = 2^-11 and 2^-8
+//   int8: sa + sb, half a step on a, b and c (sc = sa + sb)
+//   f32: exact
+#define LOWP_F32        0
+#define LOWP_F16        1
+#define LOWP_BF16       2
+#define LOWP_I8         3
+#define LOWP_COUNT      4
+#define LOWP_THREADS    256
+
+static const char *lowpNames[LOWP_COUNT] = {"f32", "f16", "bf16", "i8"};
+static const char *lowpKernels[LOWP_COUNT] = {"vAdd", "vAddF16", "vAddBF16", "vAddI8"};
+static const size_t lowpBytes[LOWP_COUNT] = {4, 2, 2, 1};
+static const float lowpUnit[LOWP_COUNT] = {0, 1.0f / 2048, 1.0f / 256, 0};
+
+struct lowpConvert
+{
+    int fmt;
+    int decode;
+    const void *src;
+    void *dst;
+    size_t n;
+    float scale;            // int8
+};
+
+struct lowpCheck
+{
+    int fmt;
+    const float *a;
+    const float *b;
+    const float *c;
+    const float *ref;
+    size_t n;
+    float bound;            // int8
+    const float *x;         // lowpScale
+
+    float max[LOWP_THREADS];
+    size_t count[LOWP_THREADS];
+    size_t first[LOWP_THREADS];
+};
+
+// round to nearest even, overflow to inf, subnormals kept
+static cl_ushort floatToHalf(float f)
+{
+    cl_uint u, sign, odd;
+    float magic;
+
+    magic = 0.5f;
+    memcpy(&u, &f, sizeof(u));
+    sign = (u >> 16) & 0x8000;
+    u &= 0x7fffffff;
+
+    if (u >= 0x47800000)
+    {
+        return (cl_ushort)(sign | (u > 0x7f800000 ? 0x7e00 : 0x7c00));
+    }
+
+    if (u < 0x38800000)
+    {
+        // below 2^-14: adding 0.5 lines the half subnormal bits up with
+        // the float mantissa, the fpu does the rounding
+        memcpy(&f, &u, sizeof(f));
+        f += magic;
+        memcpy(&u, &f, sizeof(u));
+        return (cl_ushort)(sign | (u - 0x3f000000));
+    }
+
+    odd = (u >> 13) & 1;
+    u += 0xc8000fff + odd;
+    return (cl_ushort)(sign | (u >> 13));
+}
+
+static float halfToFloat(cl_ushort h)
+{
+    cl_uint u, exp;
+    float f, magic;
+
+    magic = 6.103515625e-05f;   // 2^-14
+    u = (cl_uint)(h & 0x7fff) << 13;
+    exp = u & 0x0f800000;
+    u += 0x38000000;
+
+    if (exp == 0x0f800000)
+    {
+        // inf, nan
+        u += 0x38000000;
+    }
+    else if (exp == 0)
+    {
+        // zero, subnormal
+        u += 0x00800000;
+        memcpy(&f, &u, sizeof(f));
+        f -= magic;
+        memcpy(&u, &f, sizeof(u));
+    }
+
+    u |= (cl_uint)(h & 0x8000) << 16;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static cl_ushort floatToBF16(float f)
+{
+    cl_uint u;
+
+    memcpy(&u, &f, sizeof(u));
+    return (cl_ushort)((u + 0x7fff + ((u >> 16) & 1)) >> 16);
+}
+
+static float bf16ToFloat(cl_ushort h)
+{
+    cl_uint u;
+    float f;
+
+    u = (cl_uint)h << 16;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static void encodeScalar(int fmt, const float *src, void *dst, size_t n, float scale)
+{
+    float inv, q;
+    size_t i;
+
+    inv = 1.0f / scale;
+
+    switch (fmt)
+    {
+    case LOWP_F16:
+        for (i = 0; i < n; i += 1)
+        {
+            ((cl_ushort *)dst)[i] = floatToHalf(src[i]);
+        }
+        break;
+
+    case LOWP_BF16:
+        for (i = 0; i < n; i += 1)
+        {
+            ((cl_ushort *)dst)[i] = floatToBF16(src[i]);
+        }
+        break;
+
+    case LOWP_I8:
+        for (i = 0; i < n; i += 1)
+        {
+            // rintf: nearest even, as cvtps2dq
+            q = rintf(src[i] * inv);
+            ((cl_char *)dst)[i] = (cl_char)(q > 127 ? 127 : q < -127 ? -127 : q);
+        }
+        break;
+
+    default:
+        memcpy(dst, src, n * sizeof(float));
+        break;
+    }
+}
+
+static void decodeScalar(int fmt, const void *src, float *dst, size_t n, float scale)
+{
+    size_t i;
+
+    switch (fmt)
+    {
+    case LOWP_F16:
+        for (i = 0; i < n; i += 1)
+        {
+            dst[i] = halfToFloat(((const cl_ushort *)src)[i]);
+        }
+        break;
+
+    case LOWP_BF16:
+        for (i = 0; i < n; i += 1)
+        {
+            dst[i] = bf16ToFloat(((const cl_ushort *)src)[i]);
+        }
+        break;
+
+    case LOWP_I8:
+        for (i = 0; i < n; i += 1)
+        {
+            dst[i] = ((const cl_char *)src)[i] * scale;
+        }
+        break;
+
+    default:
+        memcpy(dst, src, n * sizeof(float));
+        break;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// 8 floats per step, the same roundings as the scalar code
+__attribute__((target("avx2,f16c"))) static void encodeAVX2(int fmt, const float *src, void *dst, size_t n,
+                                                            float scale)
+{
+    __m256i u, r, one, half, lo, hi;
+    __m256 inv;
+    __m128i p;
+    size_t i;
+
+    one = _mm256_set1_epi32(1);
+    half = _mm256_set1_epi32(0x7fff);
+    lo = _mm256_set1_epi32(-127);
+    hi = _mm256_set1_epi32(127);
+    inv = _mm256_set1_ps(1.0f / scale);
+    i = 0;
+
+    switch (fmt)
+    {
+    case LOWP_F16:
+        for (; i + 8 <= n; i += 8)
+        {
+            p = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128((__m128i *)((cl_ushort *)dst + i), p);
+        }
+        break;
+
+    case LOWP_BF16:
+        for (; i + 8 <= n; i += 8)
+        {
+            u = _mm256_castps_si256(_mm256_loadu_ps(src + i));
+            r = _mm256_add_epi32(u, _mm256_add_epi32(half, _mm256_and_si256(_mm256_srli_epi32(u, 16), one)));
+            r = _mm256_srli_epi32(r, 16);
+            p = _mm_packus_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+            _mm_storeu_si128((__m128i *)((cl_ushort *)dst + i), p);
+        }
+        break;
+
+    case LOWP_I8:
+        for (; i + 8 <= n; i += 8)
+        {
+            r = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(src + i), inv));
+            r = _mm256_max_epi32(_mm256_min_epi32(r, hi), lo);
+            p = _mm_packs_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+            _mm_storel_epi64((__m128i *)((cl_char *)dst + i), _mm_packs_epi16(p, p));
+        }
+        break;
+    }
+
+    encodeScalar(fmt, src + i, (char *)dst + i * lowpBytes[fmt], n - i, scale);
+}
+
+__attribute__((target("avx2,f16c"))) static void decodeAVX2(int fmt, const void *src, float *dst, size_t n,
+                                                            float scale)
+{
+    const char *s;
+    __m256 sc;
+    size_t i;
+
+    s = (const char *)src;
+    sc = _mm256_set1_ps(scale);
+    i = 0;
+
+    switch (fmt)
+    {
+    case LOWP_F16:
+        for (; i + 8 <= n; i += 8)
+        {
+            _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(s + 2 * i))));
+        }
+        break;
+
+    case LOWP_BF16:
+        for (; i + 8 <= n; i += 8)
+        {
+            _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(_mm256_slli_epi32(
+                                          _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(s + 2 * i))), 16)));
+        }
+        break;
+
+    case LOWP_I8:
+        for (; i + 8 <= n; i += 8)
+        {
+            _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(
+                                                        _mm_loadl_epi64((const __m128i *)(s + i)))), sc));
+        }
+        break;
+    }
+
+    decodeScalar(fmt, s + i * lowpBytes[fmt], dst + i, n - i, scale);
+}
+#endif
+
+// Conversions are bound by memory: AVX2 (with F16C) is used at the avx2
+// and avx512 levels, the scalar loops below
+static int lowpSimd()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (opts.simd >= SIMD_AVX2 && __builtin_cpu_supports("f16c"))
+    {
+        return SIMD_AVX2;
+    }
+#endif
+
+    return SIMD_SCALAR;
+}
+
+static void lowpConvertThread(void *arg, int index, int count)
+{
+    struct lowpConvert *cv;
+    const char *src;
+    char *dst;
+    size_t begin, end, ws, wd;
+
+    cv = (struct lowpConvert *)arg;
+    splitRange(cv->n, 32, index, count, &begin, &end);
+
+    ws = cv->decode ? lowpBytes[cv->fmt] : sizeof(float);
+    wd = cv->decode ? sizeof(float) : lowpBytes[cv->fmt];
+    src = (const char *)cv->src + begin * ws;
+    dst = (char *)cv->dst + begin * wd;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (lowpSimd() == SIMD_AVX2)
+    {
+        if (cv->decode)
+        {
+            decodeAVX2(cv->fmt, src, (float *)dst, end - begin, cv->scale);
+        }
+        else
+        {
+            encodeAVX2(cv->fmt, (const float *)src, dst, end - begin, cv->scale);
+        }
+        return;
+    }
+#endif
+
+    if (cv->decode)
+    {
+        decodeScalar(cv->fmt, src, (float *)dst, end - begin, cv->scale);
+    }
+    else
+    {
+        encodeScalar(cv->fmt, (const float *)src, dst, end - begin, cv->scale);
+    }
+}
+
+static void lowpConvert(int fmt, int decode, const void *src, void *dst, size_t n, float scale)
+{
+    struct lowpConvert cv;
+
+    cv.fmt = fmt;
+    cv.decode = decode;
+    cv.src = src;
+    cv.dst = dst;
+    cv.n = n;
+    cv.scale = scale;
+
+    runThreadPool(hostPool, lowpConvertThread, &cv);
+}
+
+static void lowpMaxThread(void *arg, int index, int count)
+{
+    struct lowpCheck *ck;
+    size_t begin, end, i;
+    float m;
+
+    ck = (struct lowpCheck *)arg;
+    splitRange(ck->n, 16, index, count, &begin, &end);
+
+    m = 0;
+    for (i = begin; i < end; i += 1)
+    {
+        m = fabsf(ck->x[i]) > m ? fabsf(ck->x[i]) : m;
+    }
+
+    ck->max[index] = m;
+}
+
+// int8 scale of x: its largest magnitude on 127
+static float lowpScale(struct lowpCheck *ck, const float *x, size_t n)
+{
+    struct threadPool *pool;
+    float m;
+    int i;
+
+    pool = getThreadCount(hostPool) <= LOWP_THREADS ? hostPool : NULL;
+
+    ck->x = x;
+    ck->n = n;
+    runThreadPool(pool, lowpMaxThread, ck);
+
+    m = 0;
+    for (i = 0; i < getThreadCount(pool); i += 1)
+    {
+        m = ck->max[i] > m ? ck->max[i] : m;
+    }
+
+    return m > 0 ? m / 127 : 1;
+}
+
+static void lowpCheckThread(void *arg, int index, int count)
+{
+    struct lowpCheck *ck;
+    size_t begin, end, i;
+    float e, bound;
+
+    ck = (struct lowpCheck *)arg;
+    splitRange(ck->n, 16, index, count, &begin, &end);
+
+    ck->max[index] = 0;
+    ck->count[index] = 0;
+    ck->first[index] = 0;
+
+    for (i = begin; i < end; i += 1)
+    {
+        e = fabsf(ck->c[i] - ck->ref[i]);
+        if (ck->fmt == LOWP_I8)
+        {
+            bound = ck->bound;
+        }
+        else if (ck->fmt == LOWP_F32)
+        {
+            bound = 0;
+        }
+        else
+        {
+            bound = 2.01f * lowpUnit[ck->fmt] * (fabsf(ck->a[i]) + fabsf(ck->b[i])) + 1.0f / (1 << 23);
+        }
+
+        // !(e <= bound): nan is an error too
+        if (!(e <= bound))
+        {
+            if (ck->count[index] == 0)
+            {
+                ck->first[index] = i;
+            }
+            ck->count[index] += 1;
+        }
+
+        ck->max[index] = e > ck->max[index] ? e : ck->max[index];
+    }
+}
+
+// Number of results outside the bound of fmt, with the first one and the
+// largest error
+static size_t lowpVerify(struct lowpCheck *ck, size_t *first, float *maxerr)
+{
+    struct threadPool *pool;
+    size_t count;
+    int i;
+
+    pool = getThreadCount(hostPool) <= LOWP_THREADS ? hostPool : NULL;
+    runThreadPool(pool, lowpCheckThread, ck);
+
+    count = 0;
+    *first = 0;
+    *maxerr = 0;
+    for (i = 0; i < getThreadCount(pool); i += 1)
+    {
+        if (ck->count[i] != 0 && count == 0)
+        {
+            *first = ck->first[i];
+        }
+        count += ck->count[i];
+        *maxerr = ck->max[i] > *maxerr ? ck->max[i] : *maxerr;
+    }
+
+    return count;
+}
+
+// One run in fmt: t[0] host encoding of a and b, t[1] upload, vAdd and
+// download, t[2] host decoding of c. f32 goes straight from a, b to c.
+static int lowpRun(struct clrt *rt, struct lowpCheck *ck, int fmt, void **pk, float *c, float *scale, double *t)
+{
+    cl_kernel kern;
+    cl_mem mem[3];
+    size_t bytes, global;
+    const void *src[2];
+    unsigned int un;
+    char trk[64];
+    float rc;
+    double start;
+    cl_int err;
+    int j;
+
+    bytes = lowpBytes[fmt] * ck->n;
+    src[0] = ck->a;
+    src[1] = ck->b;
+
+    start = wallTime();
+
+    if (fmt != LOWP_F32)
+    {
+        if (fmt == LOWP_I8)
+        {
+            scale[0] = lowpScale(ck, src[0], ck->n);
+            scale[1] = lowpScale(ck, src[1], ck->n);
+            scale[2] = scale[0] + scale[1];
+        }
+
+        lowpConvert(fmt, 0, src[0], pk[0], ck->n, scale[0]);
+        lowpConvert(fmt, 0, src[1], pk[1], ck->n, scale[1]);
+        src[0] = pk[0];
+        src[1] = pk[1];
+    }
+
+    t[0] = wallTime() - start;
+
+    kern = getCLKernel(rt, lowpKernels[fmt]);
+    mem[0] = getCLBuffer(rt, "a", bytes, CL_MEM_READ_ONLY, NULL);
+    mem[1] = getCLBuffer(rt, "b", bytes, CL_MEM_READ_ONLY, NULL);
+    mem[2] = getCLBuffer(rt, "c", bytes, CL_MEM_WRITE_ONLY, NULL);
+    if (kern == NULL || mem[0] == NULL || mem[1] == NULL || mem[2] == NULL)
+    {
+        fprintf(stderr, "%d.%d: %s", rt->d->pid, rt->d->did, getLastCLError());
+        return 0;
+    }
+
+    // the buffers are shared by the four kernels
+    un = (unsigned int)ck->n;
+    err = CL_SUCCESS;
+    for (j = 0; j < 3; j += 1)
+    {
+        err |= clSetKernelArg(kern, j, sizeof(cl_mem), &mem[j]);
+    }
+    err |= clSetKernelArg(kern, 3, sizeof(unsigned int), &un);
+
+    if (fmt == LOWP_I8)
+    {
+        rc = 1.0f / scale[2];
+        err |= clSetKernelArg(kern, 4, sizeof(float), &scale[0]);
+        err |= clSetKernelArg(kern, 5, sizeof(float), &scale[1]);
+        err |= clSetKernelArg(kern, 6, sizeof(float), &rc);
+    }
+
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: %s: clSetKernelArg failed with %d\n", rt->d->pid, rt->d->did, lowpKernels[fmt], err);
+        return 0;
+    }
+
+    global = ck->n;
+    track(trk, rt->d, "queue");
+
+    start = wallTime();
+
+    err = clEnqueueWriteBuffer(rt->queue, mem[0], CL_FALSE, 0, bytes, src[0], 0, NULL,
+                               profEvent(prof, trk, "write a", PROF_WRITE, bytes, 0));
+    err |= clEnqueueWriteBuffer(rt->queue, mem[1], CL_FALSE, 0, bytes, src[1], 0, NULL,
+                                profEvent(prof, trk, "write b", PROF_WRITE, bytes, 0));
+    err |= clEnqueueNDRangeKernel(rt->queue, kern, 1, NULL, &global, NULL, 0, NULL,
+                                  profEvent(prof, trk, lowpKernels[fmt], PROF_KERNEL, 3 * bytes, (double)ck->n));
+    err |= clEnqueueReadBuffer(rt->queue, mem[2], CL_TRUE, 0, bytes, fmt == LOWP_F32 ? (void *)c : pk[2], 0, NULL,
+                               profEvent(prof, trk, "read c", PROF_READ, bytes, 0));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: %s failed with %d\n", rt->d->pid, rt->d->did, lowpKernels[fmt], err);
+        return 0;
+    }
+
+    t[1] = wallTime() - start;
+
+    start = wallTime();
+    if (fmt != LOWP_F32)
+    {
+        lowpConvert(fmt, 1, pk[2], c, ck->n, scale[2]);
+    }
+    t[2] = wallTime() - start;
+
+    return 1;
+}
+
+void testVectorLowp(struct device *d)
+{
+    struct lowpCheck *ck;
+    struct clrt *rt;
+    struct stats s;
+    float *a, *b, *c, *ref, scale[3], maxerr;
+    double *times, t[3], med[3], base[2];
+    size_t count, first;
+    void *pk[3];
+    char tag[32];
+    int fmt, r, k;
+
+    rt = NULL;
+    ck = NULL;
+    a = b = c = ref = NULL;
+    pk[0] = pk[1] = pk[2] = NULL;
+    times = NULL;
+    base[0] = base[1] = 0;
+
+    sprintf(tag, "%d.%d", d->pid, d->did);
+
+    if (!fitsDevice(d, opts.size))
+    {
+        fprintf(stderr, "%s: lowp: %lu floats do not fit the device\n", tag, (unsigned long)opts.size);
+        return;
+    }
+
+    a = (float *)allocHost(opts.size * sizeof(float));
+    b = (float *)allocHost(opts.size * sizeof(float));
+    c = (float *)allocHost(opts.size * sizeof(float));
+    ref = (float *)allocHost(opts.size * sizeof(float));
+    for (k = 0; k < 3; k += 1)
+    {
+        // the widest packed format is 2 bytes per float
+        pk[k] = allocHost(opts.size * sizeof(cl_ushort));
+    }
+    times = (double *)malloc(3 * opts.reps * sizeof(double));
+    ck = (struct lowpCheck *)calloc(1, sizeof(*ck));
+    if (a == NULL || b == NULL || c == NULL || ref == NULL || pk[0] == NULL || pk[1] == NULL || pk[2] == NULL ||
+        times == NULL || ck == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [lowp buffers]\n");
+        goto error;
+    }
+
+    generateVectors(tag, a, b, opts.size);
+    hostAdd(a, b, ref, opts.size);
+
+    rt = createCLRuntime(d, queueProps());
+    if (rt == NULL || !addCLProgram(rt, kernel_add, NULL) || !addCLProgram(rt, kernel_addlp, NULL))
+    {
+        fprintf(stderr, "%s: %s", tag, getLastCLError());
+        goto error;
+    }
+
+    printf("%s: fp32 arithmetic on f32, f16, bf16 and i8 storage, host conversion %s, %d threads\n", tag,
+           getSimdName(lowpSimd()), getThreadCount(hostPool));
+
+    for (fmt = 0; fmt < LOWP_COUNT; fmt += 1)
+    {
+        scale[0] = scale[1] = scale[2] = 1;
+
+        for (r = -opts.warmup; r < opts.reps; r += 1)
+        {
+            ck->a = a;
+            ck->b = b;
+            ck->n = opts.size;
+
+            if (!lowpRun(rt, ck, fmt, pk, c, scale, t))
+            {
+                goto error;
+            }
+
+            for (k = 0; r >= 0 && k < 3; k += 1)
+            {
+                times[k * opts.reps + r] = t[k];
+            }
+        }
+
+        for (k = 0; k < 3; k += 1)
+        {
+            computeStats(times + k * opts.reps, opts.reps, &s);
+            med[k] = s.median;
+        }
+
+        // f32 is the baseline of the speedups
+        if (fmt == LOWP_F32)
+        {
+            base[0] = med[1];
+            base[1] = med[0] + med[1] + med[2];
+        }
+
+        printf("%s: %-4s %lu bytes/float: device %.2f ms, %.2f GB/s moved, %.2f GB/s f32-equivalent (%.2fx f32)\n",
+               tag, lowpNames[fmt], (unsigned long)lowpBytes[fmt], med[1] * 1e3,
+               3.0 * lowpBytes[fmt] * opts.size / med[1] / 1e9, 3.0 * sizeof(float) * opts.size / med[1] / 1e9,
+               base[0] / med[1]);
+        printf("%s: %-4s host conversion %.2f ms, end-to-end %.2f ms (%.2fx f32)\n", tag, lowpNames[fmt],
+               (med[0] + med[2]) * 1e3, (med[0] + med[1] + med[2]) * 1e3, base[1] / (med[0] + med[1] + med[2]));
+
+        ck->fmt = fmt;
+        ck->a = a;
+        ck->b = b;
+        ck->c = c;
+        ck->ref = ref;
+        ck->n = opts.size;
+        ck->bound = 1.001f * (scale[0] + scale[1]);
+
+        count = lowpVerify(ck, &first, &maxerr);
+        if (count != 0)
+        {
+            printf("%s: %-4s check error: %lu of %lu floats out of bound, max error %g, first at %lu: "
+                   "%f + %f = %f != %f\n", tag, lowpNames[fmt], (unsigned long)count, (unsigned long)opts.size,
+                   maxerr, (unsigned long)first, a[first], b[first], c[first], ref[first]);
+        }
+        else
+        {
+            printf("%s: %-4s check ok: max error %g\n", tag, lowpNames[fmt], maxerr);
+        }
+    }
+
+error:
+    freeCLRuntime(rt);
+    free(ck);
+    free(times);
+    for (k = 0; k < 3; k += 1)
+    {
+        free(pk[k]);
+    }
+    free(ref);
+    free(c);
+    free(b);
+    free(a);
+}
+
+// Expression mode: e = (a + b) * c - d through the expression engine,
+// fused in one kernel, against one kernel per operator with the
+// intermediate results going through global memory.
+static int exprRun(struct clrt *rt, struct exprGraph *g, struct exprNode *out, cl_mem *in, cl_mem res,
+                   size_t n, double *t)
+{
+    cl_event evt;
+    int ok;
+
+    ok = evalExpr(rt, g, &out, 1, in, &res, n, &evt);
+    if (!ok)
+    {
+        fprintf(stderr, "%d.%d: %s", rt->d->pid, rt->d->did, getLastCLError());
+        return 0;
+    }
+
+    ok = clWaitForEvents(1, &evt) == CL_SUCCESS;
+    *t += eventTime(evt);
+    clReleaseEvent(evt);
+
+    return ok;
+}
+
+void testVectorExpr(struct device *d)
+{
+    struct exprGraph *g;
+    struct exprNode *in[4], *fused, *op[3];
+    struct clrt *rt;
+    float *host[4], *e, *ref;
+    cl_mem mem[4], out, tmp[2], args[2];
+    double fusedTime, splitTime;
+    size_t count, first, bytes, i;
+    char tag[32], name[8];
+    cl_int err;
+    int j, r;
+
+    rt = NULL;
+    g = NULL;
+    e = ref = NULL;
+    memset(host, 0, sizeof(host));
+
+    sprintf(tag, "%d.%d", d->pid, d->did);
+    bytes = sizeof(float) * opts.size;
+
+    for (j = 0; j < 4; j += 1)
+    {
+        host[j] = (float *)allocHost(bytes);
+    }
+    e = (float *)allocHost(bytes);
+    ref = (float *)allocHost(bytes);
+    if (host[0] == NULL || host[1] == NULL || host[2] == NULL || host[3] == NULL || e == NULL || ref == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [expression buffers]\n");
+        goto error;
+    }
+
+    generateVectors(tag, host[0], host[1], opts.size);
+    fillUniform(hostPool, host[2], opts.size, opts.seed, 2);
+    fillUniform(hostPool, host[3], opts.size, opts.seed, 3);
+
+    for (i = 0; i < opts.size; i += 1)
+    {
+        ref[i] = (host[0][i] + host[1][i]) * host[2][i] - host[3][i];
+    }
+
+    rt = createCLRuntime(d, CL_QUEUE_PROFILING_ENABLE);
+    g = createExprGraph();
+    if (rt == NULL || g == NULL)
+    {
+        fprintf(stderr, "%s: %s", tag, getLastCLError());
+        goto error;
+    }
+
+    for (j = 0; j < 4; j += 1)
+    {
+        sprintf(name, "in%d", j);
+        mem[j] = getCLBuffer(rt, name, bytes, CL_MEM_READ_ONLY, NULL);
+    }
+    out = getCLBuffer(rt, "out", bytes, CL_MEM_WRITE_ONLY, NULL);
+    tmp[0] = getCLBuffer(rt, "tmp0", bytes, CL_MEM_READ_WRITE, NULL);
+    tmp[1] = getCLBuffer(rt, "tmp1", bytes, CL_MEM_READ_WRITE, NULL);
+    if (mem[0] == NULL || mem[1] == NULL || mem[2] == NULL || mem[3] == NULL || out == NULL ||
+        tmp[0] == NULL || tmp[1] == NULL)
+    {
+        fprintf(stderr, "%s: %s", tag, getLastCLError());
+        goto error;
+    }
+
+    err = CL_SUCCESS;
+    for (j = 0; j < 4; j += 1)
+    {
+        err |= clEnqueueWriteBuffer(rt->queue, mem[j], CL_TRUE, 0, bytes, host[j], 0, NULL, NULL);
+    }
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%s: clEnqueueWriteBuffer failed with %d\n", tag, err);
+        goto error;
+    }
+
+    for (j = 0; j < 4; j += 1)
+    {
+        in[j] = exprInput(g, j);
+    }
+
+    // (a + b) * c - d as one expression ...
+    fused = exprOp(g, EXPR_SUB, exprOp(g, EXPR_MUL, exprOp(g, EXPR_ADD, in[0], in[1]), in[2]), in[3]);
+
+    // ... and as three: t0 = x0 + x1, t1 = x0 * x1, e = x0 - x1
+    op[0] = exprOp(g, EXPR_ADD, in[0], in[1]);
+    op[1] = exprOp(g, EXPR_MUL, in[0], in[1]);
+    op[2] = exprOp(g, EXPR_SUB, in[0], in[1]);
+
+    // first round builds the kernels
+    for (r = 0; r < 2; r += 1)
+    {
+        fusedTime = splitTime = 0;
+
+        if (!exprRun(rt, g, fused, mem, out, opts.size, &fusedTime))
+        {
+            goto error;
+        }
+
+        if (!exprRun(rt, g, op[0], mem, tmp[0], opts.size, &splitTime))
+        {
+            goto error;
+        }
+
+        args[0] = tmp[0];
+        args[1] = mem[2];
+        if (!exprRun(rt, g, op[1], args, tmp[1], opts.size, &splitTime))
+        {
+            goto error;
+        }
+
+        args[0] = tmp[1];
+        args[1] = mem[3];
+        if (!exprRun(rt, g, op[2], args, tmp[0], opts.size, &splitTime))
+        {
+            goto error;
+        }
+    }
+
+    printf("%s: (a + b) * c - d fused: %g seconds, %.2f GB/s (5 vectors moved)\n", tag,
+           fusedTime, 5.0 * bytes / fusedTime / 1e9);
+    printf("%s: (a + b) * c - d split: %g seconds, %.2f GB/s (9 vectors moved), fused is %.2fx\n", tag,
+           splitTime, 9.0 * bytes / splitTime / 1e9, splitTime / fusedTime);
+
+    for (j = 0; j < 2; j += 1)
+    {
+        err = clEnqueueReadBuffer(rt->queue, j == 0 ? out : tmp[0], CL_TRUE, 0, bytes, e, 0, NULL, NULL);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%s: clEnqueueReadBuffer failed with %d\n", tag, err);
+            goto error;
+        }
+
+        count = compareFloats(hostPool, e, ref, opts.size, opts.ulp, &first);
+        if (count != 0)
+        {
+            printf("%s: check error (%s): %lu of %lu floats off by more than %u ulp, first at %lu: %f != %f\n",
+                   tag, j == 0 ? "fused" : "split", (unsigned long)count, (unsigned long)opts.size, opts.ulp,
+                   (unsigned long)first, e[first], ref[first]);
+        }
+        else
+        {
+            printf("%s: check ok (%s)\n", tag, j == 0 ? "fused" : "split");
+        }
+    }
+
+error:
+    freeExprGraph(g);
+    freeCLRuntime(rt);
+    free(ref);
+    free(e);
+    for (j = 0; j < 4; j += 1)
+    {
+        free(host[j]);
+    }
+}
+
+// Devgen mode: mem0 and mem1 are filled on the device by vFill, nothing
+// is uploaded and no host copy of the vectors exists. The result is
+// checked on SAMPLES slices of SAMPLE_LEN floats: the host regenerates
+// a and b there (uniformAt), and the device copy of a has to match bit
+// for bit.
+void testVectorDevGen(struct device *d)
+{
+    struct data x;
+    cl_program fprog;
+    cl_kernel fill;
+    cl_event evt[3];
+    cl_mem mem[2];
+    cl_int err;
+    cl_ulong n;
+    size_t global, off, k, m, count, first;
+    float *a, *b, *c, *ref, *dev;
+    char *src, tag[32], trk[64];
+    cl_uint stream, size;
+    int cached, j;
+    double start;
+
+    memset(&x, 0, sizeof(x));
+    memset(evt, 0, sizeof(evt));
+    fprog = NULL;
+    fill = NULL;
+    src = NULL;
+    a = NULL;
+
+    x.size = opts.size;
+    n = (cl_ulong)x.size;
+    sprintf(tag, "%d.%d", d->pid, d->did);
+
+    if (!fitsDevice(d, x.size))
+    {
+        fprintf(stderr, "%s: %lu floats do not fit the device\n", tag, (unsigned long)x.size);
+        return;
+    }
+
+    // sample scratch: a, b, c, reference and device copy of a
+    m = x.size < SAMPLES * SAMPLE_LEN ? x.size : SAMPLES * SAMPLE_LEN;
+    a = (float *)malloc(5 * m * sizeof(float));
+    if (a == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [samples]\n");
+        goto error;
+    }
+
+    b = a + m;
+    c = b + m;
+    ref = c + m;
+    dev = ref + m;
+
+    x.ctx = clCreateContext(NULL, 1, &d->device, NULL, NULL, &err);
+    if (x.ctx == NULL)
+    {
+        fprintf(stderr, "%s: clCreateContext failed with %d\n", tag, err);
+        goto error;
+    }
+
+    x.queue = clCreateCommandQueue(x.ctx, d->device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (x.queue == NULL)
+    {
+        fprintf(stderr, "%s: clCreateCommandQueue failed with %d\n", tag, err);
+        goto error;
+    }
+
+    x.mem0 = clCreateBuffer(x.ctx, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, sizeof(cl_float) * x.size, NULL, &err);
+    x.mem1 = clCreateBuffer(x.ctx, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(cl_float) * x.size, NULL, &err);
+    x.mem2 = clCreateBuffer(x.ctx, CL_MEM_WRITE_ONLY | CL_MEM_HOST_READ_ONLY, sizeof(cl_float) * x.size, NULL, &err);
+    if (x.mem0 == NULL || x.mem1 == NULL || x.mem2 == NULL)
+    {
+        fprintf(stderr, "%s: clCreateBuffer failed with %d\n", tag, err);
+        goto error;
+    }
+
+    src = (char *)malloc(strlen(philoxCLSource) + strlen(kernel_fill) + 1);
+    if (src == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [source]\n");
+        goto error;
+    }
+
+    strcpy(src, philoxCLSource);
+    strcat(src, kernel_fill);
+
+    fprog = buildCLProgram(x.ctx, d, src, NULL, &cached);
+    if (fprog == NULL)
+    {
+        fprintf(stderr, "%s: %s", tag, getLastCLError());
+        goto error;
+    }
+
+    fill = clCreateKernel(fprog, "vFill", &err);
+    if (fill == NULL)
+    {
+        fprintf(stderr, "%s: clCreateKernel[vFill] failed with %d\n", tag, err);
+        goto error;
+    }
+
+    x.kern = createVectorKernel(d, x.ctx, &x.prog);
+    if (x.kern == NULL)
+    {
+        goto error;
+    }
+
+    start = wallTime();
+
+    mem[0] = x.mem0;
+    mem[1] = x.mem1;
+    global = (x.size + 3) / 4;
+
+    for (j = 0; j < 2; j += 1)
+    {
+        stream = (cl_uint)j;
+
+        err = clSetKernelArg(fill, 0, sizeof(cl_mem), &mem[j]);
+        err |= clSetKernelArg(fill, 1, sizeof(cl_uint), &opts.seed);
+        err |= clSetKernelArg(fill, 2, sizeof(cl_uint), &stream);
+        err |= clSetKernelArg(fill, 3, sizeof(cl_ulong), &n);
+        err |= clEnqueueNDRangeKernel(x.queue, fill, 1, NULL, &global, NULL, 0, NULL, &evt[j]);
+        profAddEvent(prof, evt[j], track(trk, d, "queue"), "vFill", PROF_FILL, sizeof(cl_float) * x.size, 0);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%s: vFill[mem%d] failed with %d\n", tag, j, err);
+            goto error;
+        }
+    }
+
+    global = (size_t)x.size;
+    size = (cl_uint)x.size;
+
+    err = clSetKernelArg(x.kern, 0, sizeof(cl_mem), &x.mem0);
+    err |= clSetKernelArg(x.kern, 1, sizeof(cl_mem), &x.mem1);
+    err |= clSetKernelArg(x.kern, 2, sizeof(cl_mem), &x.mem2);
+    err |= clSetKernelArg(x.kern, 3, sizeof(unsigned int), &size);
+    err |= clEnqueueNDRangeKernel(x.queue, x.kern, 1, NULL, &global, NULL, 0, NULL, &evt[2]);
+    profAddEvent(prof, evt[2], trk, "vAdd", PROF_KERNEL, 3 * sizeof(cl_float) * x.size, (double)x.size);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%s: vAdd failed with %d\n", tag, err);
+        goto error;
+    }
+
+    err = clFinish(x.queue);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%s: clFinish failed with %d\n", tag, err);
+        goto error;
+    }
+
+    printf("%s: device generation: %g seconds, %.2f GB/s written\n", tag,
+           eventTime(evt[0]) + eventTime(evt[1]),
+           2.0 * sizeof(cl_float) * x.size / (eventTime(evt[0]) + eventTime(evt[1])) / 1e9);
+    printf("%s: vAdd kernel: %g seconds, %.2f GB/s\n", tag, eventTime(evt[2]),
+           3.0 * sizeof(cl_float) * x.size / eventTime(evt[2]) / 1e9);
+    printf("%s: %g seconds end-to-end, no transfer\n", tag, wallTime() - start);
+
+    // sampled check: slices spread from the first to the last float
+    for (k = 0; k < m; k += SAMPLE_LEN)
+    {
+        size_t len;
+
+        len = m - k < SAMPLE_LEN ? m - k : SAMPLE_LEN;
+        off = m < x.size ? (x.size - len) / (SAMPLES - 1) * (k / SAMPLE_LEN) : k;
+
+        err = clEnqueueReadBuffer(x.queue, x.mem0, CL_FALSE, sizeof(cl_float) * off, sizeof(cl_float) * len,
+                                  dev + k, 0, NULL, profEvent(prof, trk, "read a sample", PROF_READ, sizeof(cl_float) * len, 0));
+        err |= clEnqueueReadBuffer(x.queue, x.mem2, CL_FALSE, sizeof(cl_float) * off, sizeof(cl_float) * len,
+                                   c + k, 0, NULL, profEvent(prof, trk, "read c sample", PROF_READ, sizeof(cl_float) * len, 0));
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%s: clEnqueueReadBuffer[sample %lu] failed with %d\n", tag, (unsigned long)k, err);
+            goto error;
+        }
+
+        for (j = 0; j < (int)len; j += 1)
+        {
+            a[k + j] = uniformAt(opts.seed, 0, off + j);
+            b[k + j] = uniformAt(opts.seed, 1, off + j);
+        }
+    }
+
+    err = clFinish(x.queue);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%s: clFinish failed with %d\n", tag, err);
+        goto error;
+    }
+
+    count = compareFloats(NULL, dev, a, m, 0, &first);
+    if (count != 0)
+    {
+        printf("%s: generator check error: %lu of %lu sampled floats differ from the host, first %g != %g\n",
+               tag, (unsigned long)count, (unsigned long)m, dev[first], a[first]);
+        goto error;
+    }
+
+    hostAdd(a, b, ref, m);
+    checkVectors(tag, a, b, c, ref, m);
+
+error:
+    for (j = 0; j < 3; j += 1)
+    {
+        if (evt[j] != NULL)
+        {
+            clReleaseEvent(evt[j]);
+        }
+    }
+
+    if (fill != NULL)
+    {
+        clReleaseKernel(fill);
+    }
+
+    if (fprog != NULL)
+    {
+        clReleaseProgram(fprog);
+    }
+
+    if (x.kern != NULL)
+    {
+        clReleaseKernel(x.kern);
+    }
+
+    if (x.prog != NULL)
+    {
+        clReleaseProgram(x.prog);
+    }
+
+    if (x.mem2 != NULL)
+    {
+        clReleaseMemObject(x.mem2);
+    }
+
+    if (x.mem1 != NULL)
+    {
+        clReleaseMemObject(x.mem1);
+    }
+
+    if (x.mem0 != NULL)
+    {
+        clReleaseMemObject(x.mem0);
+    }
+
+    if (x.queue != NULL)
+    {
+        clReleaseCommandQueue(x.queue);
+    }
+
+    if (x.ctx != NULL)
+    {
+        clReleaseContext(x.ctx);
+    }
+
+    free(src);
+    free(a);
+}
+
+// Map a vector of n floats from path, or anonymous memory when path is
+// NULL. Inputs (stream >= 0) are read from an existing file, which gives
+// n when it is 0 and is only opened and mapped for reading, or created
+// and generated from the Philox stream; the output (stream < 0) is
+// created or truncated to n floats.
+static float *mapVector(const char *path, size_t *n, int stream)
+{
+    struct stat st;
+    float *p;
+    size_t bytes;
+    int fd, created;
+
+    if (path == NULL)
+    {
+        bytes = sizeof(float) * *n;
+        p = (float *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            fprintf(stderr, "Could not map %lu bytes\n", (unsigned long)bytes);
+            return NULL;
+        }
+
+        if (stream >= 0)
+        {
+            fillUniform(hostPool, p, *n, opts.seed, (cl_uint)stream);
+        }
+
+        return p;
+    }
+
+    created = 0;
+    fd = open(path, stream >= 0 ? O_RDONLY : O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 && stream >= 0 && errno == ENOENT)
+    {
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        created = 1;
+    }
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "Could not open %s\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    if (stream >= 0 && !created)
+    {
+        if (*n == 0)
+        {
+            *n = (size_t)st.st_size / sizeof(float);
+        }
+
+        if ((size_t)st.st_size < sizeof(float) * *n || *n == 0)
+        {
+            fprintf(stderr, "%s: %lu bytes, %lu floats wanted\n", path,
+                    (unsigned long)st.st_size, (unsigned long)*n);
+            close(fd);
+            return NULL;
+        }
+    }
+    else if (*n == 0 || ftruncate(fd, (off_t)(sizeof(float) * *n)) != 0)
+    {
+        fprintf(stderr, "Could not size %s to %lu floats\n", path, (unsigned long)*n);
+        close(fd);
+        return NULL;
+    }
+
+    // existing inputs are never written: read-only files and mounts work
+    bytes = sizeof(float) * *n;
+    p = (float *)mmap(NULL, bytes, stream >= 0 && !created ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map %s\n", path);
+        return NULL;
+    }
+
+    if (created)
+    {
+        printf("%s: generating %lu floats (philox, seed %u, stream %d)\n", path, (unsigned long)*n, opts.seed, stream);
+        fillUniform(hostPool, p, *n, opts.seed, (cl_uint)stream);
+    }
+
+    // read once, front to back
+    madvise(p, bytes, MADV_SEQUENTIAL);
+
+    return p;
+}
+
+// Tiled mode: out-of-core vAdd. The vectors live in files mapped with
+// mmap (-a, -b, -o) or in anonymous mappings, and go through the ring of
+// device buffers of the stream path one slice at a time, so neither the
+// device nor anonymous host memory has to hold them. The check walks the
+// result slice by slice as well.
+void testVectorTiled(struct device *d)
+{
+    struct data x;
+    cl_int err;
+    size_t n, off, len, chunk, count, first, c;
+    float *ref;
+    char tag[32];
+    int j;
+
+    memset(&x, 0, sizeof(x));
+    ref = NULL;
+    sprintf(tag, "%d.%d", d->pid, d->did);
+
+    // 0 when the size comes from the first input file
+    n = opts.size;
+
+    x.buf0 = mapVector(opts.files[0], &n, 0);
+    if (x.buf0 == NULL)
+    {
+        goto error;
+    }
+
+    x.size = n;
+
+    x.buf1 = mapVector(opts.files[1], &n, 1);
+    x.buf2 = x.buf1 != NULL ? mapVector(opts.files[2], &n, -1) : NULL;
+    if (x.buf2 == NULL)
+    {
+        goto error;
+    }
+
+    printf("%s: %lu floats per vector, %.2f GB in total\n", tag, (unsigned long)x.size,
+           3.0 * sizeof(float) * x.size / 1e9);
+
+    x.ctx = clCreateContext(NULL, 1, &d->device, NULL, NULL, &err);
+    if (x.ctx == NULL)
+    {
+        fprintf(stderr, "%s: clCreateContext failed with %d\n", tag, err);
+        goto error;
+    }
+
+    if (!testVectorStream(d, &x))
+    {
+        goto error;
+    }
+
+    chunk = opts.chunk < x.size ? opts.chunk : x.size;
+
+    ref = (float *)allocHost(sizeof(float) * chunk);
+    if (ref == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [ref]\n");
+        goto error;
+    }
+
+    printf("%s: comparing results ...\n", tag);
+
+    count = 0;
+    first = 0;
+    for (off = 0; off < x.size; off += len)
+    {
+        len = x.size - off < chunk ? x.size - off : chunk;
+
+        hostAdd(x.buf0 + off, x.buf1 + off, ref, len);
+        c = compareFloats(hostPool, x.buf2 + off, ref, len, opts.ulp, &first);
+        if (c != 0 && count == 0)
+        {
+            printf("%s: first check error at %lu: %f + %f != %f\n", tag, (unsigned long)(off + first),
+                   x.buf0[off + first], x.buf1[off + first], x.buf2[off + first]);
+        }
+        count += c;
+    }
+
+    if (count != 0)
+    {
+        printf("%s: check error: %lu of %lu floats off by more than %u ulp\n", tag,
+               (unsigned long)count, (unsigned long)x.size, opts.ulp);
+    }
+    else
+    {
+        printf("%s: check ok: added %lu floats\n", tag, (unsigned long)x.size);
+    }
+
+error:
+    if (x.ctx != NULL)
+    {
+        clReleaseContext(x.ctx);
+    }
+
+    free(ref);
+
+    for (j = 0; j < 3; j += 1)
+    {
+        float *p;
+
+        p = j == 0 ? x.buf0 : j == 1 ? x.buf1 : x.buf2;
+        if (p != NULL)
+        {
+            munmap(p, sizeof(float) * x.size);
+        }
+    }
+}
+
+// One member of the device pool used by the multi mode
+struct member
+{
+    struct device *d;
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_program prog;
+    cl_kernel kern;
+    cl_mem mem[3];
+    double weight;
+    unsigned int off;
+    unsigned int count;
+};
+
+static int enqueueMember(struct member *m, float *a, float *b, float *c, unsigned int n)
+{
+    size_t size;
+    char trk[64];
+    cl_int err;
+    int j;
+
+    for (j = 0; j < 3; j += 1)
+    {
+        if (m->mem[j] == NULL)
+        {
+            m->mem[j] = clCreateBuffer(m->ctx, j < 2 ? CL_MEM_READ_ONLY : CL_MEM_WRITE_ONLY,
+                                       sizeof(cl_float) * n, NULL, &err);
+            if (m->mem[j] == NULL)
+            {
+                fprintf(stderr, "%d.%d: clCreateBuffer[mem%d] failed with %d\n", m->d->pid, m->d->did, j, err);
+                return 0;
+            }
+        }
+
+        err = clSetKernelArg(m->kern, j, sizeof(cl_mem), &m->mem[j]);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clSetKernelArg[%d] failed with %d\n", m->d->pid, m->d->did, j, err);
+            return 0;
+        }
+    }
+
+    track(trk, m->d, "queue");
+
+    err = clSetKernelArg(m->kern, 3, sizeof(unsigned int), &n);
+    err |= clEnqueueWriteBuffer(m->queue, m->mem[0], CL_FALSE, 0, sizeof(cl_float) * n, a, 0, NULL,
+                                profEvent(prof, trk, "write a", PROF_WRITE, sizeof(cl_float) * n, 0));
+    err |= clEnqueueWriteBuffer(m->queue, m->mem[1], CL_FALSE, 0, sizeof(cl_float) * n, b, 0, NULL,
+                                profEvent(prof, trk, "write b", PROF_WRITE, sizeof(cl_float) * n, 0));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: upload failed with %d\n", m->d->pid, m->d->did, err);
+        return 0;
+    }
+
+    size = (size_t)n;
+
+    err = clEnqueueNDRangeKernel(m->queue, m->kern, 1, NULL, &size, NULL, 0, NULL,
+                                 profEvent(prof, trk, "vAdd", PROF_KERNEL, 3 * sizeof(cl_float) * n, (double)n));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueNDRangeKernel failed with %d\n", m->d->pid, m->d->did, err);
+        return 0;
+    }
+
+    err = clEnqueueReadBuffer(m->queue, m->mem[2], CL_FALSE, 0, sizeof(cl_float) * n, c, 0, NULL,
+                              profEvent(prof, trk, "read c", PROF_READ, sizeof(cl_float) * n, 0));
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueReadBuffer failed with %d\n", m->d->pid, m->d->did, err);
+        return 0;
+    }
+
+    clFlush(m->queue);
+    return 1;
+}
+
+static void releaseMember(struct member *m)
+{
+    int j;
+
+    for (j = 0; j < 3; j += 1)
+    {
+        if (m->mem[j] != NULL)
+        {
+            clReleaseMemObject(m->mem[j]);
+            m->mem[j] = NULL;
+        }
+    }
+}
+
+// Multi mode: all devices form one pool and share a single vAdd. Devices
+// of a platform share a context, each device gets its own queue and a
+// slice of the vector proportional to its weight: the end-to-end rate
+// of a short calibration run (split cal), or CL_DEVICE_MAX_COMPUTE_UNITS
+// (split cu). Slices are enqueued on every queue before waiting on any,
+// and read back into one output buffer.
+void testVectorMulti(struct device *devices)
+{
+    struct member *pool, *m;
+    struct device *d;
+    cl_device_id *dids;
+    cl_int err;
+    unsigned int size, n, k, nd, i, j, calib;
+    float *buf0, *buf1, *buf2, *ref;
+    double total, start, end, best;
+
+    pool = NULL;
+    dids = NULL;
+    buf0 = buf1 = buf2 = ref = NULL;
+
+    n = 0;
+    for (d = devices; d != NULL; d = d->next)
+    {
+        n += 1;
+    }
+
+    pool = (struct member *)calloc(n, sizeof(*pool));
+    dids = (cl_device_id *)malloc(n * sizeof(*dids));
+    if (pool == NULL || dids == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [pool]\n");
+        goto error;
+    }
+
+    if (opts.size > 0xffffffffu)
+    {
+        fprintf(stderr, "pool: at most %u floats\n", 0xffffffffu);
+        goto error;
+    }
+
+    size = (unsigned int)opts.size;
+
+    buf0 = (float *)allocHost(size * sizeof(float));
+    buf1 = (float *)allocHost(size * sizeof(float));
+    buf2 = (float *)allocHost(size * sizeof(float));
+    if (buf0 == NULL || buf1 == NULL || buf2 == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [buffers]\n");
+        goto error;
+    }
+
+    generateVectors("pool", buf0, buf1, size);
+
+    // one context per platform, one queue per device
+    for (d = devices, i = 0; d != NULL; d = d->next, i += 1)
+    {
+        m = &pool[i];
+        m->d = d;
+
+        for (j = 0; j < i; j += 1)
+        {
+            if (pool[j].d->platform == d->platform && pool[j].ctx != NULL)
+            {
+                m->ctx = pool[j].ctx;
+                clRetainContext(m->ctx);
+                break;
+            }
+        }
+
+        if (m->ctx == NULL)
+        {
+            struct device *e;
+
+            nd = 0;
+            for (e = devices; e != NULL; e = e->next)
+            {
+                if (e->platform == d->platform)
+                {
+                    dids[nd++] = e->device;
+                }
+            }
+
+            m->ctx = clCreateContext(NULL, nd, dids, NULL, NULL, &err);
+            if (m->ctx == NULL)
+            {
+                fprintf(stderr, "%d.%d: clCreateContext failed with %d\n", d->pid, d->did, err);
+                goto error;
+            }
+        }
+
+        m->queue = clCreateCommandQueue(m->ctx, d->device, queueProps(), &err);
+        if (m->queue == NULL)
+        {
+            fprintf(stderr, "%d.%d: clCreateCommandQueue failed with %d\n", d->pid, d->did, err);
+            goto error;
+        }
+
+        m->kern = createVectorKernel(d, m->ctx, &m->prog);
+        if (m->kern == NULL)
+        {
+            goto error;
+        }
+    }
+
+    // weights
+    calib = CALIB_SIZE < size ? CALIB_SIZE : size;
+    total = 0;
+    best = 0;
+
+    for (i = 0; i < n; i += 1)
+    {
+        m = &pool[i];
+
+        if (strcmp(opts.split, "cu") == 0)
+        {
+            m->weight = m->d->computeUnits != 0 ? (double)m->d->computeUnits : 1.0;
+        }
+        else
+        {
+            // first round warms up the driver, second is measured
+            for (k = 0; k < 2; k += 1)
+            {
+                start = wallTime();
+
+                if (!enqueueMember(m, buf0, buf1, buf2, calib) || clFinish(m->queue) != CL_SUCCESS)
+                {
+                    goto error;
+                }
+
+                end = wallTime();
+            }
+
+            m->weight = (double)calib / (end - start);
+            releaseMember(m);
+
+            printf("%d.%d: calibration: %.2f GB/s end-to-end\n", m->d->pid, m->d->did,
+                   3.0 * sizeof(cl_float) * m->weight / 1e9);
+
+            if (m->weight > best)
+            {
+                best = m->weight;
+            }
+        }
+
+        total += m->weight;
+    }
+
+    // proportional split, slices rounded to 1024 floats, the last one
+    // takes what is left
+    k = 0;
+    for (i = 0; i < n; i += 1)
+    {
+        m = &pool[i];
+        m->off = k;
+
+        if (i == n - 1)
+        {
+            m->count = size - k;
+        }
+        else
+        {
+            m->count = (unsigned int)((double)size * m->weight / total) & ~1023u;
+            if (m->count > size - k)
+            {
+                m->count = size - k;
+            }
+        }
+
+        k += m->count;
+
+        printf("%d.%d: %u floats at %u (%.1f%%)\n", m->d->pid, m->d->did,
+               m->count, m->off, 100.0 * m->count / size);
+    }
+
+    memset(buf2, 0, size * sizeof(float));
+
+    start = wallTime();
+
+    for (i = 0; i < n; i += 1)
+    {
+        m = &pool[i];
+        if (m->count == 0)
+        {
+            continue;
+        }
+
+        if (!enqueueMember(m, buf0 + m->off, buf1 + m->off, buf2 + m->off, m->count))
+        {
+            goto error;
+        }
+    }
+
+    for (i = 0; i < n; i += 1)
+    {
+        m = &pool[i];
+
+        err = clFinish(m->queue);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clFinish failed with %d\n", m->d->pid, m->d->did, err);
+            goto error;
+        }
+
+        printf("%d.%d: slice done after %g seconds\n", m->d->pid, m->d->did, wallTime() - start);
+    }
+
+    end = wallTime();
+
+    printf("pool: %d devices, %g seconds end-to-end, %.2f GB/s\n", n,
+           end - start, 3.0 * sizeof(cl_float) * size / (end - start) / 1e9);
+
+    if (best > 0)
+    {
+        printf("pool: best single device estimate %g seconds, %.2fx\n",
+               (double)size / best, (end - start) > 0 ? (double)size / best / (end - start) : 0.0);
+    }
+
+    ref = (float *)allocHost(size * sizeof(float));
+    if (ref == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [ref]\n");
+        goto error;
+    }
+
+    hostAdd(buf0, buf1, ref, size);
+    checkVectors("pool", buf0, buf1, buf2, ref, size);
+
+error:
+    if (pool != NULL)
+    {
+        for (i = 0; i < n; i += 1)
+        {
+            m = &pool[i];
+            releaseMember(m);
+
+            if (m->kern != NULL)
+            {
+                clReleaseKernel(m->kern);
+            }
+
+            if (m->prog != NULL)
+            {
+                clReleaseProgram(m->prog);
+            }
+
+            if (m->queue != NULL)
+            {
+                clReleaseCommandQueue(m->queue);
+            }
+
+            if (m->ctx != NULL)
+            {
+                clReleaseContext(m->ctx);
+            }
+        }
+    }
+
+    free(pool);
+    free(dids);
+    free(buf0);
+    free(buf1);
+    free(buf2);
+    free(ref);
+}
+
+// Async mode: the vector is cut in opts.chunk jobs, shared by all the
+// devices and driven from this one thread. Each device has opts.depth
+// slots (buffers and a kernel); a job is upload, vAdd and download on one
+// slot, handed to submitCLJob. When a job completes its slot takes the
+// next chunk at once, so faster devices get more of them, and the chunk
+// just done is checked against the host reference while the others run.
+//
+// Devices that support it get one out-of-order queue, the commands of a
+// job being ordered by their events; the others get one in-order queue
+// per slot.
+struct asyncDevice;
+
+struct slot
+{
+    struct asyncDevice *ad;
+    int index;
+    cl_command_queue queue;
+    cl_kernel kern;
+    cl_mem mem[3];
+    size_t off;             // chunk in flight
+    size_t n;
+};
+
+struct asyncDevice
+{
+    struct device *d;
+    cl_context ctx;
+    cl_program prog;
+    cl_command_queue queue; // out-of-order, shared by the slots; NULL: one queue per slot
+    struct slot slots[MAX_DEPTH];
+    unsigned long jobs;
+    size_t floats;
+    double last;            // completion of its last job, from the start
+    int failed;
+};
+
+static int submitSlot(struct cljobs *jobs, struct slot *s, float *a, float *b, float *c)
+{
+    struct device *d;
+    cl_event evts[4];
+    char trk[64], name[16];
+    unsigned int n;
+    cl_int err;
+    int j, ok;
+
+    ok = 0;
+    d = s->ad->d;
+    n = (unsigned int)s->n;
+    memset(evts, 0, sizeof(evts));
+
+    err = clSetKernelArg(s->kern, 3, sizeof(unsigned int), &n);
+    err |= clEnqueueWriteBuffer(s->queue, s->mem[0], CL_FALSE, 0, sizeof(cl_float) * s->n, a + s->off,
+                                0, NULL, &evts[0]);
+    err |= clEnqueueWriteBuffer(s->queue, s->mem[1], CL_FALSE, 0, sizeof(cl_float) * s->n, b + s->off,
+                                0, NULL, &evts[1]);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: upload failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    err = clEnqueueNDRangeKernel(s->queue, s->kern, 1, NULL, &s->n, NULL, 2, evts, &evts[2]);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueNDRangeKernel failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    err = clEnqueueReadBuffer(s->queue, s->mem[2], CL_FALSE, 0, sizeof(cl_float) * s->n, c + s->off,
+                              1, &evts[2], &evts[3]);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clEnqueueReadBuffer failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    sprintf(name, "slot %d", s->index);
+    track(trk, d, name);
+    profAddEvent(prof, evts[0], trk, "write a", PROF_WRITE, sizeof(cl_float) * s->n, 0);
+    profAddEvent(prof, evts[1], trk, "write b", PROF_WRITE, sizeof(cl_float) * s->n, 0);
+    profAddEvent(prof, evts[2], trk, "vAdd", PROF_KERNEL, 3 * sizeof(cl_float) * s->n, (double)s->n);
+    profAddEvent(prof, evts[3], trk, "read c", PROF_READ, sizeof(cl_float) * s->n, 0);
+
+    if (submitCLJob(jobs, s->queue, evts[3], s) == NULL)
+    {
+        fprintf(stderr, "%d.%d: %s", d->pid, d->did, getLastCLError());
+        goto error;
+    }
+
+    // now owned by the job
+    evts[3] = NULL;
+    ok = 1;
+
+error:
+    for (j = 0; j < 4; j += 1)
+    {
+        if (evts[j] != NULL)
+        {
+            clReleaseEvent(evts[j]);
+        }
+    }
+
+    return ok;
+}
+
+static int initAsyncDevice(struct asyncDevice *ad, size_t chunk)
+{
+    cl_command_queue_properties qprops;
+    struct device *d;
+    struct slot *s;
+    cl_int err;
+    unsigned int i;
+    int j;
+
+    d = ad->d;
+
+    ad->ctx = clCreateContext(NULL, 1, &d->device, NULL, NULL, &err);
+    if (ad->ctx == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateContext failed with %d\n", d->pid, d->did, err);
+        return 0;
+    }
+
+    if (clGetDeviceInfo(d->device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(qprops), &qprops, NULL) == CL_SUCCESS &&
+        (qprops & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0)
+    {
+        ad->queue = clCreateCommandQueue(ad->ctx, d->device, queueProps() | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE,
+                                         &err);
+        if (ad->queue == NULL)
+        {
+            fprintf(stderr, "%d.%d: clCreateCommandQueue failed with %d\n", d->pid, d->did, err);
+            return 0;
+        }
+    }
+
+    printf("%d.%d: %u slots, %s\n", d->pid, d->did, opts.depth,
+           ad->queue != NULL ? "one out-of-order queue" : "one in-order queue per slot");
+
+    for (i = 0; i < opts.depth; i += 1)
+    {
+        s = &ad->slots[i];
+        s->ad = ad;
+        s->index = (int)i;
+
+        if (ad->queue != NULL)
+        {
+            s->queue = ad->queue;
+            clRetainCommandQueue(s->queue);
+        }
+        else
+        {
+            s->queue = clCreateCommandQueue(ad->ctx, d->device, queueProps(), &err);
+            if (s->queue == NULL)
+            {
+                fprintf(stderr, "%d.%d: clCreateCommandQueue failed with %d\n", d->pid, d->did, err);
+                return 0;
+            }
+        }
+
+        if (i == 0)
+        {
+            s->kern = createVectorKernel(d, ad->ctx, &ad->prog);
+        }
+        else
+        {
+            s->kern = clCreateKernel(ad->prog, "vAdd", &err);
+        }
+
+        if (s->kern == NULL)
+        {
+            fprintf(stderr, "%d.%d: could not create the vAdd kernel of slot %u\n", d->pid, d->did, i);
+            return 0;
+        }
+
+        for (j = 0; j < 3; j += 1)
+        {
+            s->mem[j] = clCreateBuffer(ad->ctx, j < 2 ? CL_MEM_READ_ONLY : CL_MEM_WRITE_ONLY,
+                                       sizeof(cl_float) * chunk, NULL, &err);
+            if (s->mem[j] == NULL)
+            {
+                fprintf(stderr, "%d.%d: clCreateBuffer[slot %u, mem%d] failed with %d\n", d->pid, d->did, i, j, err);
+                return 0;
+            }
+
+            err = clSetKernelArg(s->kern, j, sizeof(cl_mem), &s->mem[j]);
+            if (err != CL_SUCCESS)
+            {
+                fprintf(stderr, "%d.%d: clSetKernelArg[%d] failed with %d\n", d->pid, d->did, j, err);
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+static void releaseAsyncDevice(struct asyncDevice *ad)
+{
+    struct slot *s;
+    unsigned int i;
+    int j;
+
+    for (i = 0; i < opts.depth; i += 1)
+    {
+        s = &ad->slots[i];
+
+        // commands enqueued by a job that could not be submitted
+        if (s->queue != NULL)
+        {
+            clFinish(s->queue);
+        }
+
+        for (j = 0; j < 3; j += 1)
+        {
+            if (s->mem[j] != NULL)
+            {
+                clReleaseMemObject(s->mem[j]);
+            }
+        }
+
+        if (s->kern != NULL)
+        {
+            clReleaseKernel(s->kern);
+        }
+
+        if (s->queue != NULL)
+        {
+            clReleaseCommandQueue(s->queue);
+        }
+    }
+
+    if (ad->queue != NULL)
+    {
+        clReleaseCommandQueue(ad->queue);
+    }
+
+    if (ad->prog != NULL)
+    {
+        clReleaseProgram(ad->prog);
+    }
+
+    if (ad->ctx != NULL)
+    {
+        clReleaseContext(ad->ctx);
+    }
+}
+
+// next chunk for slot s, 0 when the vector is done
+static int nextChunk(struct slot *s, size_t *next, size_t chunk)
+{
+    if (*next >= opts.size || s->ad->failed)
+    {
+        return 0;
+    }
+
+    s->off = *next;
+    s->n = opts.size - *next < chunk ? opts.size - *next : chunk;
+    *next += s->n;
+    return 1;
+}
+
+void testVectorAsync(struct device *devices)
+{
+    struct asyncDevice *ads, *ad;
+    struct cljobs *jobs;
+    struct cljob *j;
+    struct device *d;
+    struct slot *s;
+    float *buf0, *buf1, *buf2, *ref;
+    size_t chunk, next, done, off, cnt, count, first, bad;
+    double start, end, t, check;
+    unsigned int n, i, k;
+
+    ads = NULL;
+    jobs = NULL;
+    buf0 = buf1 = buf2 = ref = NULL;
+
+    n = 0;
+    for (d = devices; d != NULL; d = d->next)
+    {
+        n += selectedDevice(d) ? 1 : 0;
+    }
+
+    if (n == 0)
+    {
+        return;
+    }
+
+    ads = (struct asyncDevice *)calloc(n, sizeof(*ads));
+    if (ads == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [async devices]\n");
+        goto error;
+    }
+
+    if (opts.size > 0xffffffffu)
+    {
+        fprintf(stderr, "async: at most %u floats\n", 0xffffffffu);
+        goto error;
+    }
+
+    // one chunk size for all, within every device's limits
+    chunk = opts.chunk < opts.size ? opts.chunk : opts.size;
+    for (d = devices, i = 0; d != NULL; d = d->next)
+    {
+        if (!selectedDevice(d))
+        {
+            continue;
+        }
+
+        ads[i++].d = d;
+        if (deviceChunk(d, opts.depth) < chunk)
+        {
+            chunk = deviceChunk(d, opts.depth);
+        }
+    }
+
+    buf0 = (float *)allocHost(opts.size * sizeof(float));
+    buf1 = (float *)allocHost(opts.size * sizeof(float));
+    buf2 = (float *)allocHost(opts.size * sizeof(float));
+    ref = (float *)allocHost(opts.size * sizeof(float));
+    if (buf0 == NULL || buf1 == NULL || buf2 == NULL || ref == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [buffers]\n");
+        goto error;
+    }
+
+    generateVectors("async", buf0, buf1, opts.size);
+    hostAdd(buf0, buf1, ref, opts.size);
+    memset(buf2, 0, opts.size * sizeof(float));
+
+    jobs = createCLJobs();
+    if (jobs == NULL)
+    {
+        fprintf(stderr, "async: %s", getLastCLError());
+        goto error;
+    }
+
+    for (i = 0; i < n; i += 1)
+    {
+        if (!initAsyncDevice(&ads[i], chunk))
+        {
+            goto error;
+        }
+    }
+
+    printf("async: %lu floats in jobs of %lu over %u devices\n", (unsigned long)opts.size,
+           (unsigned long)chunk, n);
+
+    start = wallTime();
+    next = 0;
+
+    for (k = 0; k < opts.depth; k += 1)
+    {
+        for (i = 0; i < n; i += 1)
+        {
+            s = &ads[i].slots[k];
+            if (nextChunk(s, &next, chunk) && !submitSlot(jobs, s, buf0, buf1, buf2))
+            {
+                ads[i].failed = 1;
+            }
+        }
+    }
+
+    done = 0;
+    bad = 0;
+    check = 0;
+
+    while ((j = waitCLJob(jobs)) != NULL)
     {
-        fprintf(stderr, "%d.%d: clCreateContext failed with %d\n", d->pid, d->did, err);
-        goto error;
+        s = (struct slot *)j->arg;
+        ad = s->ad;
+
+        if (j->status != CL_COMPLETE)
+        {
+            fprintf(stderr, "%d.%d: job at %lu failed with %d\n", ad->d->pid, ad->d->did,
+                    (unsigned long)s->off, j->status);
+            ad->failed = 1;
+            freeCLJob(j);
+            continue;
+        }
+
+        freeCLJob(j);
+
+        ad->jobs += 1;
+        ad->floats += s->n;
+        ad->last = wallTime() - start;
+        done += s->n;
+
+        // the slot goes back to work before the check
+        off = s->off;
+        cnt = s->n;
+        if (nextChunk(s, &next, chunk) && !submitSlot(jobs, s, buf0, buf1, buf2))
+        {
+            ad->failed = 1;
+        }
+
+        t = wallTime();
+        count = compareFloats(hostPool, buf2 + off, ref + off, cnt, opts.ulp, &first);
+        check += wallTime() - t;
+
+        if (count != 0)
+        {
+            printf("%d.%d: check error: %lu floats off by more than %u ulp in the job at %lu, first at %lu\n",
+                   ad->d->pid, ad->d->did, (unsigned long)count, opts.ulp, (unsigned long)off,
+                   (unsigned long)(off + first));
+            bad += count;
+        }
     }
 
-    printf("%d.%d: context created\n", d->pid, d->did);
-    if (testVectorStep2(d, &x) != 0)
+    end = wallTime();
+
+    for (i = 0; i < n; i += 1)
     {
-        float *buf;
+        ad = &ads[i];
+        printf("%d.%d: %lu jobs, %lu floats (%.1f%%), %.2f GB/s%s\n", ad->d->pid, ad->d->did, ad->jobs,
+               (unsigned long)ad->floats, 100.0 * ad->floats / opts.size,
+               ad->last > 0 ? 3.0 * sizeof(cl_float) * ad->floats / ad->last / 1e9 : 0.0,
+               ad->failed ? ", failed" : "");
+    }
 
-        buf = (float *) malloc(sizeof(float) * x.size);
-        if (buf == 0) {
-            fprintf(stderr, "Could not allocate memory [buf]\n");
-            goto error;
-        }
+    printf("async: %g seconds end-to-end, %.2f GB/s, %g seconds of checks overlapped with the devices\n",
+           end - start, 3.0 * sizeof(cl_float) * done / (end - start) / 1e9, check);
 
-        printf("%d.%d: computing vector addition with CPU\n", d->pid, d->did);
+    if (done != opts.size)
+    {
+        printf("async: check error: %lu of %lu floats not computed\n", (unsigned long)(opts.size - done),
+               (unsigned long)opts.size);
+    }
+    else if (bad == 0)
+    {
+        printf("async: check ok: added %lu floats\n", (unsigned long)opts.size);
+    }
 
-        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &start);
+error:
+    // jobs still running write into buf2
+    freeCLJobs(jobs);
 
-        for (i = 0; i < x.size; i += 1)
+    if (ads != NULL)
+    {
+        for (i = 0; i < n; i += 1)
         {
-            buf[i] = x.buf0[i] + x.buf1[i];
+            releaseAsyncDevice(&ads[i]);
         }
+    }
+
+    free(ads);
+    free(buf0);
+    free(buf1);
+    free(buf2);
+    free(ref);
+}
+
+// Per device modes: announce d and run opts.mode on it
+static void runDevice(struct device *d)
+{
+    char *dtype;
+
+    dtype = "unknown";
+    switch (d->type)
+    {
+    case CL_DEVICE_TYPE_CPU:
+        dtype = "cpu";
+        break;
+
+    case CL_DEVICE_TYPE_GPU:
+        dtype = "gpu";
+        break;
+
+    case CL_DEVICE_TYPE_ACCELERATOR:
+        dtype = "accel";
+        break;
+    }
+
+    printf("%d.%d: %s [%s]\n", d->pid, d->did, d->name, dtype);
+    printf("%d.%d: %u compute units at %u MHz, %lu MB global, %lu KB local, float%u, %s (%s)\n", d->pid, d->did,
+           d->computeUnits, d->clock, (unsigned long)(d->globalMem >> 20), (unsigned long)(d->localMem >> 10),
+           d->vecWidth[VEC_FLOAT], d->version != NULL ? d->version : "?", d->cached ? "cached" : "queried");
+
+    if (strcmp(opts.mode, "devgen") == 0)
+    {
+        testVectorDevGen(d);
+    }
+    else if (strcmp(opts.mode, "bench") == 0)
+    {
+        testVectorBench(d);
+    }
+    else if (strcmp(opts.mode, "runtime") == 0)
+    {
+        testVectorRuntime(d);
+    }
+    else if (strcmp(opts.mode, "batch") == 0)
+    {
+        testVectorBatch(d);
+    }
+    else if (strcmp(opts.mode, "expr") == 0)
+    {
+        testVectorExpr(d);
+    }
+    else if (strcmp(opts.mode, "lowp") == 0)
+    {
+        testVectorLowp(d);
+    }
+    else if (strcmp(opts.mode, "tiled") == 0)
+    {
+        testVectorTiled(d);
+    }
+    else if (strcmp(opts.mode, "multi") != 0 && strcmp(opts.mode, "async") != 0)
+    {
+        testVectorStep1(d);
+    }
+}
+
+// Concurrent devices (-j): one host thread per device, each running the
+// same mode as it would alone. The host thread pool and the OpenCL error
+// string are shared safely; each device's output lines keep their prefix.
+struct deviceRun
+{
+    struct device *d;
+    pthread_t thread;
+    double start;
+    double end;
+    int started;
+};
 
-        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+static void *deviceThread(void *arg)
+{
+    struct deviceRun *r;
+
+    r = (struct deviceRun *)arg;
+    r->start = wallTime();
+    runDevice(r->d);
+    r->end = wallTime();
+
+    return NULL;
+}
 
-	    if ((end.tv_nsec-start.tv_nsec)<0) {
-		    dur = (float) (end.tv_sec-start.tv_sec-1) + 
-                (float) (1000000000+end.tv_nsec-start.tv_nsec) / 1e9;
-	    } else {
-		    dur = (float) (end.tv_sec-start.tv_sec) +
-		        (float) (end.tv_nsec-start.tv_nsec) / 1e9;
-	    }
+void testDevicesConcurrent(struct device *devices)
+{
+    struct deviceRun *runs;
+    struct device *d;
+    double start, end, sum;
+    int n, i;
+
+    n = 0;
+    for (d = devices; d != NULL; d = d->next)
+    {
+        n += selectedDevice(d) ? 1 : 0;
+    }
 
-        printf("%d.%d: vectors added in %g seconds\n", d->pid, d->did, dur);
+    runs = (struct deviceRun *)calloc(n > 0 ? n : 1, sizeof(*runs));
+    if (runs == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory [device threads]\n");
+        return;
+    }
 
-        printf("%d.%d: comparing results ...\n", d->pid, d->did);
+    start = wallTime();
 
-        for (i = 0; i < x.size; i += 1)
+    for (d = devices, i = 0; d != NULL; d = d->next)
+    {
+        if (!selectedDevice(d))
         {
-            if (x.buf2[i] != buf[i])
-            {
-                printf("%d.%d: check error at %d: %f + %f != %f\n",
-                       d->pid, d->did, i, x.buf0[i], x.buf1[i], x.buf2[i]);
-                goto error;
-            }
+            continue;
+        }
+
+        runs[i].d = d;
+        if (pthread_create(&runs[i].thread, NULL, deviceThread, &runs[i]) != 0)
+        {
+            fprintf(stderr, "%d.%d: could not start a thread, running it here\n", d->pid, d->did);
+            deviceThread(&runs[i]);
+        }
+        else
+        {
+            runs[i].started = 1;
         }
 
-        printf("%d.%d: check ok: added %d floats\n", d->pid, d->did, x.size);
+        i += 1;
     }
 
-error:
-    if (x.ctx)
+    for (i = 0; i < n; i += 1)
     {
-        err = clReleaseContext(x.ctx);
-        if (err != CL_SUCCESS)
+        if (runs[i].started)
         {
-            fprintf(stderr, "%d.%d: clReleaseContext failed with %d\n", d->pid, d->did, err);
+            pthread_join(runs[i].thread, NULL);
         }
     }
 
-    if (x.buf2)
+    end = wallTime();
+
+    sum = 0;
+    for (i = 0; i < n; i += 1)
     {
-        free(x.buf2);
+        sum += runs[i].end - runs[i].start;
+        printf("%d.%d: done in %g seconds\n", runs[i].d->pid, runs[i].d->did, runs[i].end - runs[i].start);
     }
 
-    if (x.buf1)
+    printf("concurrent: %d devices in %g seconds (%g one after another, %.2fx)\n", n, end - start, sum,
+           end > start ? sum / (end - start) : 0.0);
+
+    // only the copy path moves exactly a, b and c once per device: the
+    // other modes also run it as their reference, repeat their runs or
+    // move other vectors
+    if (strcmp(opts.mode, "copy") == 0)
     {
-        free(x.buf1);
+        printf("concurrent: %.2f GB/s aggregate\n", 3.0 * sizeof(cl_float) * opts.size * n / (end - start) / 1e9);
     }
 
-    if (x.buf0)
+    collectCLProf(prof);
+    free(runs);
+}
+
+// -D bandwidth, compute or latency: rank the devices for that class of
+// work and keep the best one. Returns 0 when no device could be ranked.
+static int selectBestDevice(struct device *devices)
+{
+    struct device **ranked, *d;
+    int kind, n, i;
+
+    for (kind = RANK_BANDWIDTH; kind <= RANK_LATENCY; kind += 1)
     {
-        free(x.buf0);
+        if (strcmp(opts.select, getRankName(kind)) == 0)
+        {
+            break;
+        }
+    }
+
+    if (kind > RANK_LATENCY)
+    {
+        // pid.did
+        return 1;
+    }
+
+    ranked = rankCLDevices(devices, kind, &n);
+    if (ranked == NULL)
+    {
+        fprintf(stderr, EXENAME ": %s", getLastCLError());
+        return 0;
+    }
+
+    printf("devices ranked for %s-bound work:\n", getRankName(kind));
+    for (i = 0; i < n; i += 1)
+    {
+        d = ranked[i];
+        if (d->calibrated < 0)
+        {
+            printf("  %d.%d: %s, calibration failed\n", d->pid, d->did, d->name);
+            continue;
+        }
+
+        printf("  %d.%d: %s, %.2f GB/s transfer, %.2f GB/s memory, %.1f GFLOP/s, %.1fus launch (%s)\n", d->pid,
+               d->did, d->name, d->transferRate, d->memoryRate, d->flopRate, d->launchTime * 1e6,
+               d->calibrated == 2 ? "cached" : "measured");
+    }
+
+    bestDevice = n > 0 && getRankScore(ranked[0], kind) > 0 ? ranked[0] : NULL;
+    free(ranked);
+
+    if (bestDevice == NULL)
+    {
+        fprintf(stderr, EXENAME ": no device could be calibrated\n");
+        fprintf(stderr, "\t%s\n", getLastCLError());
+        return 0;
     }
+
+    printf("selected %d.%d: %s\n\n", bestDevice->pid, bestDevice->did, bestDevice->name);
+    return 1;
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: " EXENAME " [-m mode] [-n size] [-c chunk] [-d depth] [-q queues] [-s split] [-t] [-j]\n"
+            "\t[-T threads] [-x simd] [-r seed] [-u ulp] [-a file] [-b file] [-o file] [-P file]\n"
+            "\t[-D pid.did] [-S first:last[:factor]] [-w warmup] [-i reps] [-F format] [-R file]\n");
+    fprintf(stderr, "\t-m mode    copy: one upload, one kernel, one download (default)\n");
+    fprintf(stderr, "\t           stream: chunked upload/compute/download pipeline\n");
+    fprintf(stderr, "\t           zero: usehost or allochost, from CL_DEVICE_HOST_UNIFIED_MEMORY\n");
+    fprintf(stderr, "\t           usehost: zero-copy with CL_MEM_USE_HOST_PTR\n");
+    fprintf(stderr, "\t           allochost: zero-copy with CL_MEM_ALLOC_HOST_PTR + map/unmap\n");
+    fprintf(stderr, "\t           staged: copy path through pinned staging chunks (-c, -d) vs direct transfers\n");
+    fprintf(stderr, "\t           svm: OpenCL 2.0 shared virtual memory, copy path if unsupported\n");
+    fprintf(stderr, "\t           multi: one vAdd split across all devices\n");
+    fprintf(stderr, "\t           devgen: inputs generated on the device, sampled check\n");
+    fprintf(stderr, "\t           tiled: out-of-core stream path over mmap'ed vectors\n");
+    fprintf(stderr, "\t           bench: copy path statistics over repeated runs and a size sweep\n");
+    fprintf(stderr, "\t           runtime: repeated vAdd calls against a long-lived runtime\n");
+    fprintf(stderr, "\t           batch: -n floats as small jobs, one launch per job vs one segmented launch\n");
+    fprintf(stderr, "\t           expr: (a + b) * c - d, fused in one kernel vs one kernel per operator\n");
+    fprintf(stderr, "\t           async: chunks as callback-driven jobs over all devices, from one thread\n");
+    fprintf(stderr, "\t           lowp: f32, f16, bf16 and int8 storage with fp32 arithmetic, error-bounded check\n");
+    fprintf(stderr, "\t-n size    floats per vector, k/M/G suffix allowed (default 100M, tiled: size of -a)\n");
+    fprintf(stderr, "\t-c chunk   floats per chunk (stream, tiled, staged) or job (async), k/M/G suffix allowed (default 4M)\n");
+    fprintf(stderr, "\t-d depth   chunks in flight (stream, staged), jobs in flight per device (async), 2 to %d (default 3)\n", MAX_DEPTH);
+    fprintf(stderr, "\t-q queues  2: transfer + compute, 3: upload + compute + download (default 3)\n");
+    fprintf(stderr, "\t-s split   multi: cal (calibration run) or cu (compute units), default cal\n");
+    fprintf(stderr, "\t-t         autotune vAdd (vector width, work per item, local size) before the copy path\n");
+    fprintf(stderr, "\t-j         run the devices concurrently, one host thread each (not with bench, tiled,\n"
+            "\t           multi or async)\n");
+    fprintf(stderr, "\t-T threads host threads (default: one per cpu)\n");
+    fprintf(stderr, "\t-x simd    host SIMD: scalar, sse, avx2 or avx512 (default: best supported)\n");
+    fprintf(stderr, "\t-r seed    input generator seed (default 1)\n");
+    fprintf(stderr, "\t-u ulp     check tolerance in ulp (default 0)\n");
+    fprintf(stderr, "\t-a file    tiled: input a, generated if missing (default: anonymous memory)\n");
+    fprintf(stderr, "\t-b file    tiled: input b, generated if missing (default: anonymous memory)\n");
+    fprintf(stderr, "\t-o file    tiled: output c (default: anonymous memory)\n");
+    fprintf(stderr, "\t-P file    profile every command, write a Chrome trace (chrome://tracing, ui.perfetto.dev)\n");
+    fprintf(stderr, "\t-D pid.did only test this device (all modes but multi), or the best one for a class of\n"
+            "\t           work: bandwidth, compute or latency (calibrated once, then cached)\n");
+    fprintf(stderr, "\t-S sweep   bench: sizes first, first * factor, ... up to last (factor default 4)\n");
+    fprintf(stderr, "\t-w warmup  bench, runtime, lowp: untimed runs per size (default 2)\n");
+    fprintf(stderr, "\t-i reps    bench, runtime, lowp: timed runs per size (default 10)\n");
+    fprintf(stderr, "\t-F format  bench results: text, csv or json (default text)\n");
+    fprintf(stderr, "\t-R file    bench results file (default stdout)\n");
 }
 
 int main(int argc, char **argv)
 {
     struct device *devices, *d;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:n:c:d:q:s:tjT:x:r:u:a:b:o:P:D:S:w:i:F:R:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'm':
+            opts.mode = optarg;
+            break;
+
+        case 'n':
+            opts.size = parseSize(optarg);
+            break;
+
+        case 'c':
+            opts.chunk = parseSize(optarg);
+            break;
+
+        case 'a':
+            opts.files[0] = optarg;
+            break;
+
+        case 'b':
+            opts.files[1] = optarg;
+            break;
+
+        case 'o':
+            opts.files[2] = optarg;
+            break;
+
+        case 'P':
+            opts.trace = optarg;
+            break;
+
+        case 'D':
+            opts.select = optarg;
+            break;
+
+        case 'S':
+            if (!parseSweep(optarg))
+            {
+                usage();
+                return -1;
+            }
+            break;
+
+        case 'w':
+            opts.warmup = atoi(optarg);
+            break;
+
+        case 'i':
+            opts.reps = atoi(optarg);
+            break;
+
+        case 'F':
+            opts.format = optarg;
+            break;
+
+        case 'R':
+            opts.results = optarg;
+            break;
+
+        case 'd':
+            opts.depth = atoi(optarg);
+            break;
+
+        case 'q':
+            opts.queues = atoi(optarg);
+            break;
+
+        case 's':
+            opts.split = optarg;
+            break;
+
+        case 't':
+            opts.tune = 1;
+            break;
+
+        case 'j':
+            opts.concurrent = 1;
+            break;
+
+        case 'T':
+            opts.threads = atoi(optarg);
+            break;
+
+        case 'r':
+            opts.seed = (cl_uint)strtoul(optarg, NULL, 0);
+            break;
+
+        case 'u':
+            opts.ulp = (cl_uint)strtoul(optarg, NULL, 0);
+            break;
+
+        case 'x':
+            for (opts.simd = SIMD_AVX512; opts.simd >= SIMD_SCALAR; opts.simd -= 1)
+            {
+                if (strcmp(optarg, getSimdName(opts.simd)) == 0)
+                {
+                    break;
+                }
+            }
+
+            if (opts.simd < SIMD_SCALAR)
+            {
+                usage();
+                return -1;
+            }
+            break;
+
+        default:
+            usage();
+            return -1;
+        }
+    }
+
+    for (c = 0; modes[c] != NULL; c += 1)
+    {
+        if (strcmp(opts.mode, modes[c]) == 0)
+        {
+            break;
+        }
+    }
+
+    if (modes[c] == NULL)
+    {
+        fprintf(stderr, EXENAME ": unknown mode %s\n", opts.mode);
+        usage();
+        return -1;
+    }
+
+    if (strcmp(opts.split, "cal") != 0 && strcmp(opts.split, "cu") != 0)
+    {
+        fprintf(stderr, EXENAME ": unknown split %s\n", opts.split);
+        usage();
+        return -1;
+    }
+
+    if (opts.size == 0 && (strcmp(opts.mode, "tiled") != 0 || opts.files[0] == NULL))
+    {
+        opts.size = VEC_SIZE;
+    }
+
+    if (opts.warmup < 0 || opts.reps < 1 ||
+        (strcmp(opts.format, "text") != 0 && strcmp(opts.format, "csv") != 0 && strcmp(opts.format, "json") != 0))
+    {
+        usage();
+        return -1;
+    }
+
+    // bench shares its results file, tiled its files, multi and async
+    // already drive all devices at once
+    if (opts.concurrent && (strcmp(opts.mode, "bench") == 0 || strcmp(opts.mode, "tiled") == 0 ||
+                            strcmp(opts.mode, "multi") == 0 || strcmp(opts.mode, "async") == 0))
+    {
+        fprintf(stderr, EXENAME ": -j does not apply to mode %s\n", opts.mode);
+        usage();
+        return -1;
+    }
+
+    if (opts.chunk == 0 || opts.depth < 2 || opts.depth > MAX_DEPTH || opts.queues < 2 || opts.queues > 3)
+    {
+        usage();
+        return -1;
+    }
+
+    // never above what the cpu supports
+    if (opts.simd < 0 || opts.simd > getSimdLevel())
+    {
+        opts.simd = getSimdLevel();
+    }
+
+    hostPool = createThreadPool(opts.threads);
+    if (hostPool == NULL)
+    {
+        fprintf(stderr, EXENAME ": %s", getLastCLError());
+        return -1;
+    }
+
+    if (opts.trace != NULL)
+    {
+        prof = createCLProf();
+        if (prof == NULL)
+        {
+            fprintf(stderr, EXENAME ": %s", getLastCLError());
+            return -1;
+        }
+    }
 
-    srand(1);
+    benchOut = stdout;
+    if (opts.results != NULL)
+    {
+        benchOut = fopen(opts.results, "w");
+        if (benchOut == NULL)
+        {
+            fprintf(stderr, EXENAME ": could not create %s\n", opts.results);
+            return -1;
+        }
+    }
 
     devices = enumCLDevices();
     if (devices == NULL)
@@ -432,31 +5335,70 @@ int main(int argc, char **argv)
         return -1;
     }
 
-    for (d = devices; d != NULL; d = d->next)
+    if (opts.select != NULL && !selectBestDevice(devices))
     {
-        char *dtype;
+        freeCLDevices(devices);
+        return -1;
+    }
 
-        dtype = "unknown";
-        switch (d->type)
+    if (opts.concurrent)
+    {
+        testDevicesConcurrent(devices);
+    }
+    else
+    {
+        for (d = devices; d != NULL; d = d->next)
         {
-        case CL_DEVICE_TYPE_CPU:
-            dtype = "cpu";
-            break;
+            if (selectedDevice(d))
+            {
+                runDevice(d);
 
-        case CL_DEVICE_TYPE_GPU:
-            dtype = "gpu";
-            break;
+                // read the timestamps while this device's events are fresh
+                collectCLProf(prof);
+            }
+        }
+    }
 
-        case CL_DEVICE_TYPE_ACCELERATOR:
-            dtype = "accel";
-            break;
+    if (strcmp(opts.mode, "multi") == 0)
+    {
+        testVectorMulti(devices);
+        collectCLProf(prof);
+    }
+
+    if (strcmp(opts.mode, "async") == 0)
+    {
+        testVectorAsync(devices);
+        collectCLProf(prof);
+    }
+
+    if (prof != NULL)
+    {
+        printf("\n");
+        printCLProfSummary(prof, stdout);
+
+        if (!writeCLProfTrace(prof, opts.trace))
+        {
+            fprintf(stderr, EXENAME ": %s", getLastCLError());
+        }
+        else
+        {
+            printf("trace written to %s\n", opts.trace);
         }
 
-        printf("%d.%d: %s [%s]\n", d->pid, d->did, d->name, dtype);
+        freeCLProf(prof);
+    }
 
-        testVectorStep1(d);
+    if (strcmp(opts.format, "json") == 0 && strcmp(opts.mode, "bench") == 0)
+    {
+        fprintf(benchOut, benchRows != 0 ? "\n]\n" : "[]\n");
+    }
+
+    if (benchOut != stdout)
+    {
+        fclose(benchOut);
     }
 
     freeCLDevices(devices);
+    freeThreadPool(hostPool);
     return 0;
 }
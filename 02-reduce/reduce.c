@@ -0,0 +1,713 @@
+// reduce.c
+//
+// Reductions of a vector on the device: sum, dot product, min, max and
+// euclidean norm.
+//
+// Each work-item first reduces a grid-stride slice of the input in a
+// register (optionally with Kahan compensation), then its work-group
+// combines the values with a local memory tree, or with sub-group
+// operations when cl_khr_subgroups (or cl_intel_subgroups) is there.
+// The per-group results are finished either by a second pass of the same
+// kernel on a single work-group, or by an atomic compare-and-swap on a
+// single result.
+//
+// Checked against a threaded double precision host reference.
+//
+
+// compile with: gcc -Wall -O2 -o reduce reduce.c ../common/clenum.c ../common/clerror.c ../common/clcache.c
+//                   ../common/threads.c ../common/random.c -lOpenCL -lpthread -lm
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "../common/clutil.h"
+
+#define EXENAME     "reduce"
+#define VEC_SIZE    (100 * 1024 * 1024)
+#define MAX_LOCAL   256
+#define MAX_GROUPS  4096
+#define MAX_THREADS 256
+#define TOL         1e-4        // relative error allowed for sums
+#define TOL_KAHAN   1e-5
+
+#define OP_SUM      0
+#define OP_DOT      1
+#define OP_MIN      2
+#define OP_MAX      3
+#define OP_NORM     4
+#define NOPS        5
+
+static const char *opNames[NOPS] = {"sum", "dot", "min", "max", "norm"};
+
+// Built with -DOP=0..4 and optionally -DKAHAN, -DSUBGROUP (and
+// -DKHR_SUBGROUPS for the pragma), -DATOMIC. pass 0 reads x (and y),
+// pass 1 reduces the per-group results in x.
+const char *kernel_reduce = "#if defined(SUBGROUP) && defined(KHR_SUBGROUPS)\n"
+                            "#pragma OPENCL EXTENSION cl_khr_subgroups : enable\n"
+                            "#endif\n"
+                            "#if OP == 2\n"
+                            "#define INIT INFINITY\n"
+                            "#define COMBINE(a, b) fmin(a, b)\n"
+                            "#define SG_REDUCE sub_group_reduce_min\n"
+                            "#elif OP == 3\n"
+                            "#define INIT (-INFINITY)\n"
+                            "#define COMBINE(a, b) fmax(a, b)\n"
+                            "#define SG_REDUCE sub_group_reduce_max\n"
+                            "#else\n"
+                            "#define INIT 0.0f\n"
+                            "#define COMBINE(a, b) ((a) + (b))\n"
+                            "#define SG_REDUCE sub_group_reduce_add\n"
+                            "#endif\n"
+                            "#if OP == 1\n"
+                            "#define LOAD(i) (x[i] * y[i])\n"
+                            "#elif OP == 4\n"
+                            "#define LOAD(i) (x[i] * x[i])\n"
+                            "#else\n"
+                            "#define LOAD(i) x[i]\n"
+                            "#endif\n"
+                            "void atomicCombine(volatile __global uint* p, float v)"
+                            "{"
+                            "   uint prev, old = *p;"
+                            "   do"
+                            "   {"
+                            "       prev = old;"
+                            "       old = atomic_cmpxchg(p, prev, as_uint(COMBINE(as_float(prev), v)));"
+                            "   } while (old != prev);"
+                            "}\n"
+                            "__kernel void reduce(__global const float* x, __global const float* y,"
+                            "                     __global float* out, const uint n, const uint pass,"
+                            "                     __local float* scratch)"
+                            "{"
+                            "   size_t i, gsz = get_global_size(0);"
+                            "   uint lid = get_local_id(0);"
+                            "   float v, acc = INIT;\n"
+                            "#ifdef KAHAN\n"
+                            "   float t, comp = 0.0f;\n"
+                            "#endif\n"
+                            "   for (i = get_global_id(0); i < n; i += gsz)"
+                            "   {"
+                            "       v = pass == 0 ? LOAD(i) : x[i];\n"
+                            "#ifdef KAHAN\n"
+                            "       v -= comp;"
+                            "       t = acc + v;"
+                            "       comp = (t - acc) - v;"
+                            "       acc = t;\n"
+                            "#else\n"
+                            "       acc = COMBINE(acc, v);\n"
+                            "#endif\n"
+                            "   }\n"
+                            "#ifdef SUBGROUP\n"
+                            "   acc = SG_REDUCE(acc);"
+                            "   if (get_sub_group_local_id() == 0)"
+                            "       scratch[get_sub_group_id()] = acc;"
+                            "   barrier(CLK_LOCAL_MEM_FENCE);"
+                            "   if (get_sub_group_id() == 0)"
+                            "   {"
+                            "       acc = INIT;"
+                            "       for (i = get_sub_group_local_id(); i < get_num_sub_groups(); i += get_sub_group_size())"
+                            "           acc = COMBINE(acc, scratch[i]);"
+                            "       acc = SG_REDUCE(acc);"
+                            "   }\n"
+                            "#else\n"
+                            "   scratch[lid] = acc;"
+                            "   barrier(CLK_LOCAL_MEM_FENCE);"
+                            "   for (uint s = get_local_size(0) / 2; s > 0; s >>= 1)"
+                            "   {"
+                            "       if (lid < s)"
+                            "           scratch[lid] = COMBINE(scratch[lid], scratch[lid + s]);"
+                            "       barrier(CLK_LOCAL_MEM_FENCE);"
+                            "   }"
+                            "   acc = scratch[0];\n"
+                            "#endif\n"
+                            "   if (lid == 0)"
+                            "   {\n"
+                            "#ifdef ATOMIC\n"
+                            "       atomicCombine((volatile __global uint*)out, acc);\n"
+                            "#else\n"
+                            "       out[get_group_id(0)] = acc;\n"
+                            "#endif\n"
+                            "   }"
+                            "}";
+
+struct options
+{
+    size_t size;            // floats per vector
+    int threads;            // host threads, 0: one per cpu
+    cl_uint seed;           // input generator seed
+    int reps;               // timed runs per variant, the best one is kept
+    char *select;           // pid.did of the only device to test, NULL: all
+    int op;                 // only this reduction, -1: all
+};
+
+static struct options opts = {VEC_SIZE, 0, 1, 5, NULL, -1};
+
+static struct threadPool *hostPool;
+
+struct data
+{
+    struct device *d;
+    size_t size;
+
+    cl_context ctx;
+    cl_command_queue queue;
+
+    cl_mem x;
+    cl_mem y;
+    cl_mem partial;         // per-group results
+    cl_mem result;
+
+    size_t local;           // work-group size, a power of two
+    size_t groups;
+    char *sgext;            // sub-group extension, NULL: none
+};
+
+// Host reference, in double: sum, dot, min, max, sum of squares
+struct hostReduce
+{
+    const float *x;
+    const float *y;
+    size_t n;
+    double r[MAX_THREADS][NOPS];
+};
+
+static double wallTime()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static size_t parseSize(const char *s)
+{
+    char *end;
+    unsigned long long v;
+
+    v = strtoull(s, &end, 0);
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        v *= 1024;
+        break;
+
+    case 'm':
+    case 'M':
+        v *= 1024 * 1024;
+        break;
+
+    case 'g':
+    case 'G':
+        v *= 1024 * 1024 * 1024;
+        break;
+    }
+
+    return (size_t)v;
+}
+
+static void hostReduceThread(void *arg, int index, int count)
+{
+    struct hostReduce *h;
+    double sum, dot, sq, mn, mx, v;
+    size_t i, begin, end;
+
+    h = (struct hostReduce *)arg;
+    splitRange(h->n, 16, index, count, &begin, &end);
+
+    sum = dot = sq = 0;
+    mn = INFINITY;
+    mx = -INFINITY;
+
+    for (i = begin; i < end; i += 1)
+    {
+        v = h->x[i];
+        sum += v;
+        dot += v * h->y[i];
+        sq += v * v;
+        mn = v < mn ? v : mn;
+        mx = v > mx ? v : mx;
+    }
+
+    h->r[index][OP_SUM] = sum;
+    h->r[index][OP_DOT] = dot;
+    h->r[index][OP_MIN] = mn;
+    h->r[index][OP_MAX] = mx;
+    h->r[index][OP_NORM] = sq;
+}
+
+static void hostReduce(const float *x, const float *y, size_t n, double ref[NOPS])
+{
+    struct threadPool *pool;
+    struct hostReduce *h;
+    int i;
+
+    // one row of partials per thread: above MAX_THREADS, one thread
+    pool = getThreadCount(hostPool) <= MAX_THREADS ? hostPool : NULL;
+
+    h = (struct hostReduce *)malloc(sizeof(*h));
+    if (h == NULL)
+    {
+        memset(ref, 0, NOPS * sizeof(double));
+        return;
+    }
+
+    h->x = x;
+    h->y = y;
+    h->n = n;
+
+    runThreadPool(pool, hostReduceThread, h);
+
+    memcpy(ref, h->r[0], NOPS * sizeof(double));
+    for (i = 1; i < getThreadCount(pool); i += 1)
+    {
+        ref[OP_SUM] += h->r[i][OP_SUM];
+        ref[OP_DOT] += h->r[i][OP_DOT];
+        ref[OP_MIN] = h->r[i][OP_MIN] < ref[OP_MIN] ? h->r[i][OP_MIN] : ref[OP_MIN];
+        ref[OP_MAX] = h->r[i][OP_MAX] > ref[OP_MAX] ? h->r[i][OP_MAX] : ref[OP_MAX];
+        ref[OP_NORM] += h->r[i][OP_NORM];
+    }
+
+    ref[OP_NORM] = sqrt(ref[OP_NORM]);
+    free(h);
+}
+
+static double eventTime(cl_event evt)
+{
+    cl_ulong start, end;
+
+    if (clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) != CL_SUCCESS ||
+        clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) != CL_SUCCESS)
+    {
+        return 0;
+    }
+
+    return (double)(end - start) / 1e9;
+}
+
+static cl_kernel createReduceKernel(struct data *x, int op, int subgroup, int atomic, int kahan)
+{
+    cl_program prog;
+    cl_kernel kern;
+    char options[128];
+    cl_int err;
+    int cached;
+
+    sprintf(options, "-DOP=%d%s%s%s%s", op, subgroup ? " -DSUBGROUP" : "",
+            subgroup && strcmp(x->sgext, "cl_khr_subgroups") == 0 ? " -DKHR_SUBGROUPS" : "",
+            atomic ? " -DATOMIC" : "", kahan ? " -DKAHAN" : "");
+
+    prog = buildCLProgram(x->ctx, x->d, kernel_reduce, options, &cached);
+    if (prog == NULL)
+    {
+        fprintf(stderr, "%d.%d: %s", x->d->pid, x->d->did, getLastCLError());
+        return NULL;
+    }
+
+    kern = clCreateKernel(prog, "reduce", &err);
+    if (kern == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateKernel failed with %d\n", x->d->pid, x->d->did, err);
+    }
+
+    // the kernel keeps its program
+    clReleaseProgram(prog);
+    return kern;
+}
+
+// One pass of kern over n floats of in, with groups work-groups
+static int enqueueReduce(struct data *x, cl_kernel kern, cl_mem in, cl_mem out, size_t n, size_t groups,
+                         cl_uint pass, cl_event *evt)
+{
+    size_t global;
+    cl_uint un;
+    cl_int err;
+
+    un = (cl_uint)n;
+    global = groups * x->local;
+
+    err = clSetKernelArg(kern, 0, sizeof(cl_mem), &in);
+    err |= clSetKernelArg(kern, 1, sizeof(cl_mem), &x->y);
+    err |= clSetKernelArg(kern, 2, sizeof(cl_mem), &out);
+    err |= clSetKernelArg(kern, 3, sizeof(cl_uint), &un);
+    err |= clSetKernelArg(kern, 4, sizeof(cl_uint), &pass);
+    err |= clSetKernelArg(kern, 5, sizeof(cl_float) * x->local, NULL);
+    err |= clEnqueueNDRangeKernel(x->queue, kern, 1, NULL, &global, &x->local, 0, NULL, evt);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: reduce pass %u failed with %d\n", x->d->pid, x->d->did, pass, err);
+        return 0;
+    }
+
+    return 1;
+}
+
+// Best of opts.reps runs (after a warmup one), device time of all passes
+static int runReduce(struct data *x, cl_kernel kern, int op, int atomic, float *res, double *best)
+{
+    cl_event evt[2];
+    cl_int err;
+    float init;
+    double t;
+    int r, ok;
+
+    *best = 0;
+    evt[1] = NULL;
+    init = op == OP_MIN ? INFINITY : op == OP_MAX ? -INFINITY : 0.0f;
+
+    for (r = 0; r <= opts.reps; r += 1)
+    {
+        if (atomic)
+        {
+            err = clEnqueueWriteBuffer(x->queue, x->result, CL_FALSE, 0, sizeof(float), &init, 0, NULL, NULL);
+            if (err != CL_SUCCESS)
+            {
+                fprintf(stderr, "%d.%d: clEnqueueWriteBuffer failed with %d\n", x->d->pid, x->d->did, err);
+                return 0;
+            }
+
+            ok = enqueueReduce(x, kern, x->x, x->result, x->size, x->groups, 0, &evt[0]);
+        }
+        else
+        {
+            ok = enqueueReduce(x, kern, x->x, x->partial, x->size, x->groups, 0, &evt[0]);
+            if (ok && !enqueueReduce(x, kern, x->partial, x->result, x->groups, 1, 1, &evt[1]))
+            {
+                // the first pass is enqueued, its event is ours
+                clReleaseEvent(evt[0]);
+                if (evt[1] != NULL)
+                {
+                    clReleaseEvent(evt[1]);
+                }
+                return 0;
+            }
+        }
+
+        if (!ok)
+        {
+            return 0;
+        }
+
+        err = clEnqueueReadBuffer(x->queue, x->result, CL_TRUE, 0, sizeof(float), res, 0, NULL, NULL);
+
+        t = eventTime(evt[0]);
+        clReleaseEvent(evt[0]);
+        if (evt[1] != NULL)
+        {
+            t += eventTime(evt[1]);
+            clReleaseEvent(evt[1]);
+            evt[1] = NULL;
+        }
+
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clEnqueueReadBuffer failed with %d\n", x->d->pid, x->d->did, err);
+            return 0;
+        }
+
+        if (r > 0 && (*best == 0 || t < *best))
+        {
+            *best = t;
+        }
+    }
+
+    return 1;
+}
+
+static int setupReduce(struct data *x, const float *a, const float *b)
+{
+    cl_uint cunits;
+    size_t wgmax, bytes;
+    cl_int err;
+
+    bytes = sizeof(cl_float) * x->size;
+
+    cunits = x->d->computeUnits != 0 ? x->d->computeUnits : 1;
+    wgmax = x->d->maxWorkGroup != 0 ? x->d->maxWorkGroup : 1;
+
+    for (x->local = MAX_LOCAL; x->local > wgmax; x->local /= 2)
+    {
+    }
+
+    // enough groups to fill the device, each item then loops over the rest
+    x->groups = 16 * (size_t)cunits;
+    if (x->groups > MAX_GROUPS)
+    {
+        x->groups = MAX_GROUPS;
+    }
+    if (x->groups > (x->size + x->local - 1) / x->local)
+    {
+        x->groups = (x->size + x->local - 1) / x->local;
+    }
+
+    if (hasCLExtension(x->d, "cl_khr_subgroups"))
+    {
+        x->sgext = "cl_khr_subgroups";
+    }
+    else if (hasCLExtension(x->d, "cl_intel_subgroups"))
+    {
+        x->sgext = "cl_intel_subgroups";
+    }
+
+    x->ctx = clCreateContext(NULL, 1, &x->d->device, NULL, NULL, &err);
+    if (x->ctx == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateContext failed with %d\n", x->d->pid, x->d->did, err);
+        return 0;
+    }
+
+    x->queue = clCreateCommandQueue(x->ctx, x->d->device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (x->queue == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateCommandQueue failed with %d\n", x->d->pid, x->d->did, err);
+        return 0;
+    }
+
+    x->x = clCreateBuffer(x->ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, (void *)a, &err);
+    x->y = clCreateBuffer(x->ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, (void *)b, &err);
+    x->partial = clCreateBuffer(x->ctx, CL_MEM_READ_WRITE, sizeof(cl_float) * x->groups, NULL, &err);
+    x->result = clCreateBuffer(x->ctx, CL_MEM_READ_WRITE, sizeof(cl_float), NULL, &err);
+    if (x->x == NULL || x->y == NULL || x->partial == NULL || x->result == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateBuffer failed with %d\n", x->d->pid, x->d->did, err);
+        return 0;
+    }
+
+    printf("%d.%d: %lu groups of %lu, sub-groups: %s\n", x->d->pid, x->d->did, (unsigned long)x->groups,
+           (unsigned long)x->local, x->sgext != NULL ? x->sgext : "no");
+
+    return 1;
+}
+
+static void releaseReduce(struct data *x)
+{
+    if (x->result != NULL)
+    {
+        clReleaseMemObject(x->result);
+    }
+
+    if (x->partial != NULL)
+    {
+        clReleaseMemObject(x->partial);
+    }
+
+    if (x->y != NULL)
+    {
+        clReleaseMemObject(x->y);
+    }
+
+    if (x->x != NULL)
+    {
+        clReleaseMemObject(x->x);
+    }
+
+    if (x->queue != NULL)
+    {
+        clReleaseCommandQueue(x->queue);
+    }
+
+    if (x->ctx != NULL)
+    {
+        clReleaseContext(x->ctx);
+    }
+}
+
+void testReduce(struct device *d, const float *a, const float *b, const double ref[NOPS])
+{
+    struct data x;
+    cl_kernel kern;
+    double t, value, err, tol;
+    float res;
+    int op, subgroup, atomic, kahan;
+
+    memset(&x, 0, sizeof(x));
+    x.d = d;
+    x.size = opts.size;
+
+    if (!setupReduce(&x, a, b))
+    {
+        goto error;
+    }
+
+    printf("%-5s %-9s %-7s %-5s %16s %10s %10s %8s\n", "op", "group", "finish", "kahan",
+           "result", "rel error", "ms", "GB/s");
+
+    for (op = 0; op < NOPS; op += 1)
+    {
+        if (opts.op >= 0 && op != opts.op)
+        {
+            continue;
+        }
+
+        for (subgroup = 0; subgroup <= (x.sgext != NULL ? 1 : 0); subgroup += 1)
+        {
+            for (atomic = 0; atomic <= 1; atomic += 1)
+            {
+                // compensation only makes sense for sums
+                for (kahan = 0; kahan <= (op == OP_MIN || op == OP_MAX ? 0 : 1); kahan += 1)
+                {
+                    kern = createReduceKernel(&x, op, subgroup, atomic, kahan);
+                    if (kern == NULL)
+                    {
+                        continue;
+                    }
+
+                    if (!runReduce(&x, kern, op, atomic, &res, &t))
+                    {
+                        clReleaseKernel(kern);
+                        continue;
+                    }
+
+                    clReleaseKernel(kern);
+
+                    value = op == OP_NORM ? sqrt((double)res) : (double)res;
+                    err = ref[op] != 0 ? fabs(value - ref[op]) / fabs(ref[op]) : fabs(value);
+                    tol = op == OP_MIN || op == OP_MAX ? 0 : kahan ? TOL_KAHAN : TOL;
+
+                    printf("%-5s %-9s %-7s %-5s %16.8g %10.2e %10.4f %8.2f%s\n", opNames[op],
+                           subgroup ? "sub-group" : "local", atomic ? "atomic" : "2 pass", kahan ? "yes" : "no",
+                           value, err, t * 1e3, (op == OP_DOT ? 2.0 : 1.0) * sizeof(float) * x.size / t / 1e9,
+                           err > tol ? "  check error" : "");
+                }
+            }
+        }
+    }
+
+error:
+    releaseReduce(&x);
+}
+
+static int selectedDevice(struct device *d)
+{
+    unsigned int pid, did;
+
+    if (opts.select == NULL)
+    {
+        return 1;
+    }
+
+    return sscanf(opts.select, "%u.%u", &pid, &did) == 2 && pid == d->pid && did == d->did;
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: " EXENAME " [-n size] [-o op] [-i reps] [-T threads] [-r seed] [-D pid.did]\n");
+    fprintf(stderr, "\t-n size    floats per vector, k/M/G suffix allowed (default 100M)\n");
+    fprintf(stderr, "\t-o op      sum, dot, min, max or norm (default: all)\n");
+    fprintf(stderr, "\t-i reps    timed runs per variant, the best one is kept (default 5)\n");
+    fprintf(stderr, "\t-T threads host threads (default: one per cpu)\n");
+    fprintf(stderr, "\t-r seed    input generator seed (default 1)\n");
+    fprintf(stderr, "\t-D pid.did only test this device\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct device *devices, *d;
+    float *a, *b;
+    double ref[NOPS], start;
+    int c;
+
+    while ((c = getopt(argc, argv, "n:o:i:T:r:D:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'n':
+            opts.size = parseSize(optarg);
+            break;
+
+        case 'o':
+            for (opts.op = NOPS - 1; opts.op >= 0; opts.op -= 1)
+            {
+                if (strcmp(optarg, opNames[opts.op]) == 0)
+                {
+                    break;
+                }
+            }
+
+            if (opts.op < 0)
+            {
+                usage();
+                return -1;
+            }
+            break;
+
+        case 'i':
+            opts.reps = atoi(optarg);
+            break;
+
+        case 'T':
+            opts.threads = atoi(optarg);
+            break;
+
+        case 'r':
+            opts.seed = (cl_uint)strtoul(optarg, NULL, 0);
+            break;
+
+        case 'D':
+            opts.select = optarg;
+            break;
+
+        default:
+            usage();
+            return -1;
+        }
+    }
+
+    if (opts.size == 0 || opts.size > 0xffffffffu || opts.reps < 1)
+    {
+        usage();
+        return -1;
+    }
+
+    hostPool = createThreadPool(opts.threads);
+    if (hostPool == NULL)
+    {
+        fprintf(stderr, EXENAME ": %s", getLastCLError());
+        return -1;
+    }
+
+    a = (float *)malloc(sizeof(float) * opts.size);
+    b = (float *)malloc(sizeof(float) * opts.size);
+    if (a == NULL || b == NULL)
+    {
+        fprintf(stderr, EXENAME ": Could not allocate memory [vectors]\n");
+        return -1;
+    }
+
+    fillUniform(hostPool, a, opts.size, opts.seed, 0);
+    fillUniform(hostPool, b, opts.size, opts.seed, 1);
+
+    start = wallTime();
+    hostReduce(a, b, opts.size, ref);
+
+    printf("host: %lu floats, sum %.8g, dot %.8g, min %.8g, max %.8g, norm %.8g (%g seconds, %d threads)\n",
+           (unsigned long)opts.size, ref[OP_SUM], ref[OP_DOT], ref[OP_MIN], ref[OP_MAX], ref[OP_NORM],
+           wallTime() - start, getThreadCount(hostPool));
+
+    devices = enumCLDevices();
+    if (devices == NULL)
+    {
+        fprintf(stderr, EXENAME ": no opencl device found\n");
+        fprintf(stderr, "\t%s\n", getLastCLError());
+        return -1;
+    }
+
+    for (d = devices; d != NULL; d = d->next)
+    {
+        if (!selectedDevice(d))
+        {
+            continue;
+        }
+
+        printf("%d.%d: %s\n", d->pid, d->did, d->name);
+        testReduce(d, a, b, ref);
+    }
+
+    freeCLDevices(devices);
+    free(b);
+    free(a);
+    freeThreadPool(hostPool);
+    return 0;
+}
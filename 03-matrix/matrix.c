@@ -0,0 +1,745 @@
+// matrix.c
+//
+// Matrix multiplication: C = A * B, row-major n x n floats.
+//
+// Three kernels, from the textbook one to the one that gets close to peak:
+//   naive: one work-item per element of C, A and B read from global memory
+//   tiled: TS x TS tiles of A and B staged in local memory
+//   reg:   each work-group computes a TSM x TSN tile of C, each work-item
+//          a WPTM x WPTN block of it held in registers; tiles of TSK are
+//          loaded with WIDTH wide vector loads, A transposed in local
+//          memory
+// The tile sizes are build options (-D), picked per device from what its
+// work-group size and local memory allow, or searched with -t.
+//
+// Compared in GFLOP/s with a blocked, threaded host SGEMM.
+//
+
+// compile with: gcc -Wall -O2 -o matrix matrix.c ../common/clenum.c ../common/clerror.c ../common/clcache.c
+//                   ../common/threads.c ../common/random.c -lOpenCL -lpthread -lm
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "../common/clutil.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define EXENAME     "matrix"
+#define MAT_SIZE    2048
+#define MAT_ALIGN   128         // sizes are rounded up to this, a multiple of every tile
+#define TOL         1e-3        // relative error allowed against the host
+
+// host blocking: rows of C per job, k and columns per block
+#define HOST_MB     32
+#define HOST_KB     256
+#define HOST_NB     512
+
+const char *kernel_gemm = "#define IDX(r, c, ld) ((r) * (ld) + (c))\n"
+                          "__kernel void gemmNaive(const uint M, const uint N, const uint K,"
+                          "                        __global const float* A, __global const float* B, __global float* C)"
+                          "{"
+                          "   uint j = get_global_id(0);"
+                          "   uint i = get_global_id(1);"
+                          "   float acc = 0.0f;"
+                          "   if (i >= M || j >= N)"
+                          "       return;"
+                          "   for (uint k = 0; k < K; k++)"
+                          "       acc += A[IDX(i, k, K)] * B[IDX(k, j, N)];"
+                          "   C[IDX(i, j, N)] = acc;"
+                          "}\n"
+                          "#ifdef TS\n"
+                          "__kernel __attribute__((reqd_work_group_size(TS, TS, 1)))"
+                          "void gemmTiled(const uint M, const uint N, const uint K,"
+                          "               __global const float* A, __global const float* B, __global float* C)"
+                          "{"
+                          "   __local float As[TS][TS];"
+                          "   __local float Bs[TS][TS];"
+                          "   uint col = get_local_id(0);"
+                          "   uint row = get_local_id(1);"
+                          "   uint gc = TS * get_group_id(0) + col;"
+                          "   uint gr = TS * get_group_id(1) + row;"
+                          "   float acc = 0.0f;"
+                          "   for (uint t = 0; t < K; t += TS)"
+                          "   {"
+                          "       As[row][col] = A[IDX(gr, t + col, K)];"
+                          "       Bs[row][col] = B[IDX(t + row, gc, N)];"
+                          "       barrier(CLK_LOCAL_MEM_FENCE);"
+                          "       for (uint k = 0; k < TS; k++)"
+                          "           acc += As[row][k] * Bs[k][col];"
+                          "       barrier(CLK_LOCAL_MEM_FENCE);"
+                          "   }"
+                          "   C[IDX(gr, gc, N)] = acc;"
+                          "}\n"
+                          "#endif\n"
+                          "#ifdef TSM\n"
+                          "#define RTSM (TSM / WPTM)\n"
+                          "#define RTSN (TSN / WPTN)\n"
+                          "#if WIDTH == 1\n"
+                          "#define LOADW(i, p) (p)[i]\n"
+                          "#define STOREW(v, i, p) (p)[i] = (v)\n"
+                          "typedef float floatw;\n"
+                          "#else\n"
+                          "#define CAT(a, b) a##b\n"
+                          "#define XCAT(a, b) CAT(a, b)\n"
+                          "#define LOADW XCAT(vload, WIDTH)\n"
+                          "#define STOREW XCAT(vstore, WIDTH)\n"
+                          "typedef XCAT(float, WIDTH) floatw;\n"
+                          "#endif\n"
+                          "__kernel __attribute__((reqd_work_group_size(RTSN, RTSM, 1)))"
+                          "void gemmReg(const uint M, const uint N, const uint K,"
+                          "             __global const float* A, __global const float* B, __global float* C)"
+                          "{"
+                          "   __local float As[TSK][TSM];"
+                          "   __local float Bs[TSK][TSN];"
+                          "   float acc[WPTM][WPTN];"
+                          "   float a, b[WPTN], v[WIDTH];"
+                          "   uint tidn = get_local_id(0);"
+                          "   uint tidm = get_local_id(1);"
+                          "   uint tid = tidm * RTSN + tidn;"
+                          "   uint offn = TSN * get_group_id(0);"
+                          "   uint offm = TSM * get_group_id(1);"
+                          "   uint l, r, c, w, k, wm, wn;"
+                          "   for (wm = 0; wm < WPTM; wm++)"
+                          "       for (wn = 0; wn < WPTN; wn++)"
+                          "           acc[wm][wn] = 0.0f;"
+                          "   for (uint t = 0; t < K; t += TSK)"
+                          "   {"
+                          "       for (l = tid; l < TSM * TSK / WIDTH; l += RTSM * RTSN)"
+                          "       {"
+                          "           r = l / (TSK / WIDTH);"
+                          "           c = (l % (TSK / WIDTH)) * WIDTH;"
+                          "           STOREW(LOADW(0, A + IDX(offm + r, t + c, K)), 0, v);"
+                          "           for (w = 0; w < WIDTH; w++)"
+                          "               As[c + w][r] = v[w];"
+                          "       }"
+                          "       for (l = tid; l < TSK * TSN / WIDTH; l += RTSM * RTSN)"
+                          "       {"
+                          "           r = l / (TSN / WIDTH);"
+                          "           c = (l % (TSN / WIDTH)) * WIDTH;"
+                          "           STOREW(LOADW(0, B + IDX(t + r, offn + c, N)), 0, &Bs[r][c]);"
+                          "       }"
+                          "       barrier(CLK_LOCAL_MEM_FENCE);"
+                          "       for (k = 0; k < TSK; k++)"
+                          "       {"
+                          "           for (wn = 0; wn < WPTN; wn++)"
+                          "               b[wn] = Bs[k][tidn + wn * RTSN];"
+                          "           for (wm = 0; wm < WPTM; wm++)"
+                          "           {"
+                          "               a = As[k][tidm + wm * RTSM];"
+                          "               for (wn = 0; wn < WPTN; wn++)"
+                          "                   acc[wm][wn] += a * b[wn];"
+                          "           }"
+                          "       }"
+                          "       barrier(CLK_LOCAL_MEM_FENCE);"
+                          "   }"
+                          "   for (wm = 0; wm < WPTM; wm++)"
+                          "       for (wn = 0; wn < WPTN; wn++)"
+                          "           C[IDX(offm + tidm + wm * RTSM, offn + tidn + wn * RTSN, N)] = acc[wm][wn];"
+                          "}\n"
+                          "#endif\n";
+
+#define KERN_NAIVE  0
+#define KERN_TILED  1
+#define KERN_REG    2
+#define NKERNS      3
+
+static const char *kernNames[NKERNS] = {"naive", "tiled", "reg"};
+
+// tiled: TS
+static const unsigned int tiledSizes[] = {32, 16, 8};
+
+// reg: TSM, TSN, TSK, WPTM, WPTN, WIDTH; in order of preference
+struct regConfig
+{
+    unsigned int tsm, tsn, tsk, wptm, wptn, width;
+};
+
+static const struct regConfig regConfigs[] = {
+    {128, 128, 16, 8, 8, 4},
+    {128, 64, 16, 8, 4, 4},
+    {64, 64, 16, 4, 4, 4},
+    {64, 64, 8, 4, 4, 4},
+    {32, 32, 16, 2, 2, 4},
+    {32, 32, 8, 2, 2, 2},
+    {16, 16, 8, 1, 1, 1},
+};
+
+#define NREGS       (sizeof(regConfigs) / sizeof(regConfigs[0]))
+
+struct options
+{
+    size_t size;            // n, rounded up to MAT_ALIGN
+    int threads;            // host threads, 0: one per cpu
+    cl_uint seed;           // input generator seed
+    int reps;               // timed runs per kernel, the best one is kept
+    char *select;           // pid.did of the only device to test, NULL: all
+    int kern;               // only this kernel, -1: all
+    int tune;               // try every tile configuration that fits
+};
+
+static struct options opts = {MAT_SIZE, 0, 1, 3, NULL, -1, 0};
+
+static struct threadPool *hostPool;
+
+struct data
+{
+    struct device *d;
+    size_t n;
+
+    cl_context ctx;
+    cl_command_queue queue;
+
+    cl_mem a;
+    cl_mem b;
+    cl_mem c;
+
+    size_t wgmax;
+    cl_ulong lmem;
+};
+
+struct hostGemm
+{
+    const float *a;
+    const float *b;
+    float *c;
+    size_t n;
+    int simd;
+};
+
+static double wallTime()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static size_t parseSize(const char *s)
+{
+    char *end;
+    unsigned long long v;
+
+    v = strtoull(s, &end, 0);
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        v *= 1024;
+        break;
+    }
+
+    return (size_t)v;
+}
+
+// c[0 .. nb) += a * b[0 .. nb)
+static void axpyScalar(float a, const float *b, float *c, size_t nb)
+{
+    size_t j;
+
+    for (j = 0; j < nb; j += 1)
+    {
+        c[j] += a * b[j];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma"))) static void axpyAVX2(float a, const float *b, float *c, size_t nb)
+{
+    __m256 va;
+    size_t j;
+
+    va = _mm256_set1_ps(a);
+    for (j = 0; j + 8 <= nb; j += 8)
+    {
+        _mm256_storeu_ps(c + j, _mm256_fmadd_ps(va, _mm256_loadu_ps(b + j), _mm256_loadu_ps(c + j)));
+    }
+
+    axpyScalar(a, b + j, c + j, nb - j);
+}
+#endif
+
+// Rows are dealt to the threads HOST_MB at a time. Within a row block,
+// a HOST_KB x HOST_NB block of B stays in cache while every row of the
+// block goes over it.
+static void hostGemmThread(void *arg, int index, int count)
+{
+    struct hostGemm *h;
+    size_t i, i0, k, k0, j0, n, ni, nk, nj;
+
+    h = (struct hostGemm *)arg;
+    n = h->n;
+
+    for (i0 = (size_t)index * HOST_MB; i0 < n; i0 += (size_t)count * HOST_MB)
+    {
+        ni = n - i0 < HOST_MB ? n - i0 : HOST_MB;
+        memset(h->c + i0 * n, 0, sizeof(float) * ni * n);
+
+        for (k0 = 0; k0 < n; k0 += HOST_KB)
+        {
+            nk = n - k0 < HOST_KB ? n - k0 : HOST_KB;
+
+            for (j0 = 0; j0 < n; j0 += HOST_NB)
+            {
+                nj = n - j0 < HOST_NB ? n - j0 : HOST_NB;
+
+                for (i = i0; i < i0 + ni; i += 1)
+                {
+                    for (k = k0; k < k0 + nk; k += 1)
+                    {
+#if defined(__x86_64__) || defined(__i386__)
+                        if (h->simd)
+                        {
+                            axpyAVX2(h->a[i * n + k], h->b + k * n + j0, h->c + i * n + j0, nj);
+                            continue;
+                        }
+#endif
+                        axpyScalar(h->a[i * n + k], h->b + k * n + j0, h->c + i * n + j0, nj);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void hostGemm(const float *a, const float *b, float *c, size_t n)
+{
+    struct hostGemm h;
+
+    h.a = a;
+    h.b = b;
+    h.c = c;
+    h.n = n;
+    h.simd = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    h.simd = getSimdLevel() >= SIMD_AVX2 && __builtin_cpu_supports("fma");
+#endif
+
+    runThreadPool(hostPool, hostGemmThread, &h);
+}
+
+static double eventTime(cl_event evt)
+{
+    cl_ulong start, end;
+
+    if (clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) != CL_SUCCESS ||
+        clGetEventProfilingInfo(evt, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) != CL_SUCCESS)
+    {
+        return 0;
+    }
+
+    return (double)(end - start) / 1e9;
+}
+
+static int fitsTiled(struct data *x, unsigned int ts)
+{
+    return ts * ts <= x->wgmax && 2 * ts * ts * sizeof(float) <= x->lmem;
+}
+
+static int fitsReg(struct data *x, const struct regConfig *r)
+{
+    return (r->tsm / r->wptm) * (r->tsn / r->wptn) <= x->wgmax &&
+           (size_t)r->tsk * (r->tsm + r->tsn) * sizeof(float) <= x->lmem;
+}
+
+// Best of opts.reps runs after a warmup one, 0 on error
+static double runGemm(struct data *x, int kern, const char *options, const size_t *global, const size_t *local,
+                      const char *label)
+{
+    cl_program prog;
+    cl_kernel k;
+    cl_event evt;
+    double t, best;
+    cl_uint n;
+    cl_int err;
+    int r, cached;
+
+    best = 0;
+    k = NULL;
+
+    prog = buildCLProgram(x->ctx, x->d, kernel_gemm, options, &cached);
+    if (prog == NULL)
+    {
+        fprintf(stderr, "%d.%d: %s [%s]", x->d->pid, x->d->did, getLastCLError(), label);
+        return 0;
+    }
+
+    k = clCreateKernel(prog, kern == KERN_NAIVE ? "gemmNaive" : kern == KERN_TILED ? "gemmTiled" : "gemmReg", &err);
+    clReleaseProgram(prog);
+    if (k == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateKernel failed with %d [%s]\n", x->d->pid, x->d->did, err, label);
+        return 0;
+    }
+
+    n = (cl_uint)x->n;
+    err = clSetKernelArg(k, 0, sizeof(cl_uint), &n);
+    err |= clSetKernelArg(k, 1, sizeof(cl_uint), &n);
+    err |= clSetKernelArg(k, 2, sizeof(cl_uint), &n);
+    err |= clSetKernelArg(k, 3, sizeof(cl_mem), &x->a);
+    err |= clSetKernelArg(k, 4, sizeof(cl_mem), &x->b);
+    err |= clSetKernelArg(k, 5, sizeof(cl_mem), &x->c);
+    if (err != CL_SUCCESS)
+    {
+        fprintf(stderr, "%d.%d: clSetKernelArg failed with %d [%s]\n", x->d->pid, x->d->did, err, label);
+        goto error;
+    }
+
+    for (r = 0; r <= opts.reps; r += 1)
+    {
+        err = clEnqueueNDRangeKernel(x->queue, k, 2, NULL, global, local, 0, NULL, &evt);
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clEnqueueNDRangeKernel failed with %d [%s]\n", x->d->pid, x->d->did, err, label);
+            best = 0;
+            goto error;
+        }
+
+        err = clWaitForEvents(1, &evt);
+        t = eventTime(evt);
+        clReleaseEvent(evt);
+
+        if (err != CL_SUCCESS)
+        {
+            fprintf(stderr, "%d.%d: clWaitForEvents failed with %d [%s]\n", x->d->pid, x->d->did, err, label);
+            best = 0;
+            goto error;
+        }
+
+        if (r > 0 && (best == 0 || t < best))
+        {
+            best = t;
+        }
+    }
+
+error:
+    clReleaseKernel(k);
+    return best;
+}
+
+// largest relative difference to the host result
+static double checkGemm(struct data *x, float *c, const float *ref)
+{
+    double err, e;
+    size_t i;
+
+    if (clEnqueueReadBuffer(x->queue, x->c, CL_TRUE, 0, sizeof(float) * x->n * x->n, c, 0, NULL, NULL) != CL_SUCCESS)
+    {
+        return INFINITY;
+    }
+
+    err = 0;
+    for (i = 0; i < x->n * x->n; i += 1)
+    {
+        e = fabs((double)c[i] - ref[i]) / (fabs(ref[i]) > 1 ? fabs(ref[i]) : 1);
+        err = e > err ? e : err;
+    }
+
+    return err;
+}
+
+static void report(struct data *x, const char *label, double t, float *c, const float *ref, double host)
+{
+    double flops, err;
+
+    flops = 2.0 * x->n * x->n * x->n;
+    err = checkGemm(x, c, ref);
+
+    printf("%d.%d: %-32s %10.3f ms %10.2f GFLOP/s %6.2fx host, max rel error %.2e%s\n", x->d->pid, x->d->did,
+           label, t * 1e3, flops / t / 1e9, host / t, err, err > TOL ? "  check error" : "");
+}
+
+void testGemm(struct device *d, const float *a, const float *b, const float *ref, float *c, double host)
+{
+    struct data x;
+    const struct regConfig *rc;
+    char options[128], label[64];
+    size_t global[2], local[2], bytes;
+    double t;
+    unsigned int i;
+    cl_int err;
+
+    memset(&x, 0, sizeof(x));
+    x.d = d;
+    x.n = opts.size;
+    bytes = sizeof(float) * x.n * x.n;
+
+    x.wgmax = d->maxWorkGroup;
+    x.lmem = d->localMem;
+
+    x.ctx = clCreateContext(NULL, 1, &d->device, NULL, NULL, &err);
+    if (x.ctx == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateContext failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    x.queue = clCreateCommandQueue(x.ctx, d->device, CL_QUEUE_PROFILING_ENABLE, &err);
+    if (x.queue == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateCommandQueue failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    x.a = clCreateBuffer(x.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, (void *)a, &err);
+    x.b = clCreateBuffer(x.ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, (void *)b, &err);
+    x.c = clCreateBuffer(x.ctx, CL_MEM_WRITE_ONLY, bytes, NULL, &err);
+    if (x.a == NULL || x.b == NULL || x.c == NULL)
+    {
+        fprintf(stderr, "%d.%d: clCreateBuffer failed with %d\n", d->pid, d->did, err);
+        goto error;
+    }
+
+    // one work-item per element of C, except for reg
+    global[0] = x.n;
+    global[1] = x.n;
+
+    if (opts.kern < 0 || opts.kern == KERN_NAIVE)
+    {
+        t = runGemm(&x, KERN_NAIVE, NULL, global, NULL, "naive");
+        if (t > 0)
+        {
+            report(&x, "naive", t, c, ref, host);
+        }
+    }
+
+    if (opts.kern < 0 || opts.kern == KERN_TILED)
+    {
+        for (i = 0; i < sizeof(tiledSizes) / sizeof(tiledSizes[0]); i += 1)
+        {
+            if (!fitsTiled(&x, tiledSizes[i]))
+            {
+                continue;
+            }
+
+            sprintf(options, "-DTS=%u", tiledSizes[i]);
+            sprintf(label, "tiled TS=%u", tiledSizes[i]);
+            local[0] = local[1] = tiledSizes[i];
+
+            t = runGemm(&x, KERN_TILED, options, global, local, label);
+            if (t > 0)
+            {
+                report(&x, label, t, c, ref, host);
+            }
+
+            // the largest tile that fits, unless searching
+            if (t > 0 && !opts.tune)
+            {
+                break;
+            }
+        }
+    }
+
+    if (opts.kern < 0 || opts.kern == KERN_REG)
+    {
+        for (i = 0; i < NREGS; i += 1)
+        {
+            rc = regConfigs + i;
+            if (!fitsReg(&x, rc) || x.n % rc->tsm != 0 || x.n % rc->tsn != 0)
+            {
+                continue;
+            }
+
+            sprintf(options, "-DTSM=%u -DTSN=%u -DTSK=%u -DWPTM=%u -DWPTN=%u -DWIDTH=%u",
+                    rc->tsm, rc->tsn, rc->tsk, rc->wptm, rc->wptn, rc->width);
+            sprintf(label, "reg %ux%ux%u %ux%u w%u", rc->tsm, rc->tsn, rc->tsk, rc->wptm, rc->wptn, rc->width);
+
+            // one work-item per WPTM x WPTN block of C
+            local[0] = rc->tsn / rc->wptn;
+            local[1] = rc->tsm / rc->wptm;
+            global[0] = x.n / rc->wptn;
+            global[1] = x.n / rc->wptm;
+
+            t = runGemm(&x, KERN_REG, options, global, local, label);
+            if (t > 0)
+            {
+                report(&x, label, t, c, ref, host);
+            }
+
+            if (t > 0 && !opts.tune)
+            {
+                break;
+            }
+        }
+    }
+
+error:
+    if (x.c != NULL)
+    {
+        clReleaseMemObject(x.c);
+    }
+
+    if (x.b != NULL)
+    {
+        clReleaseMemObject(x.b);
+    }
+
+    if (x.a != NULL)
+    {
+        clReleaseMemObject(x.a);
+    }
+
+    if (x.queue != NULL)
+    {
+        clReleaseCommandQueue(x.queue);
+    }
+
+    if (x.ctx != NULL)
+    {
+        clReleaseContext(x.ctx);
+    }
+}
+
+static int selectedDevice(struct device *d)
+{
+    unsigned int pid, did;
+
+    if (opts.select == NULL)
+    {
+        return 1;
+    }
+
+    return sscanf(opts.select, "%u.%u", &pid, &did) == 2 && pid == d->pid && did == d->did;
+}
+
+void usage()
+{
+    fprintf(stderr, "usage: " EXENAME " [-n size] [-k kernel] [-t] [-i reps] [-T threads] [-r seed] [-D pid.did]\n");
+    fprintf(stderr, "\t-n size    rows and columns, rounded up to a multiple of %d (default %d)\n", MAT_ALIGN, MAT_SIZE);
+    fprintf(stderr, "\t-k kernel  naive, tiled or reg (default: all)\n");
+    fprintf(stderr, "\t-t         try every tile configuration that fits the device\n");
+    fprintf(stderr, "\t-i reps    timed runs per kernel, the best one is kept (default 3)\n");
+    fprintf(stderr, "\t-T threads host threads (default: one per cpu)\n");
+    fprintf(stderr, "\t-r seed    input generator seed (default 1)\n");
+    fprintf(stderr, "\t-D pid.did only test this device\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct device *devices, *d;
+    float *a, *b, *c, *ref;
+    double start, host;
+    size_t n;
+    int i;
+
+    while ((i = getopt(argc, argv, "n:k:ti:T:r:D:h")) != -1)
+    {
+        switch (i)
+        {
+        case 'n':
+            opts.size = parseSize(optarg);
+            break;
+
+        case 'k':
+            for (opts.kern = NKERNS - 1; opts.kern >= 0; opts.kern -= 1)
+            {
+                if (strcmp(optarg, kernNames[opts.kern]) == 0)
+                {
+                    break;
+                }
+            }
+
+            if (opts.kern < 0)
+            {
+                usage();
+                return -1;
+            }
+            break;
+
+        case 't':
+            opts.tune = 1;
+            break;
+
+        case 'i':
+            opts.reps = atoi(optarg);
+            break;
+
+        case 'T':
+            opts.threads = atoi(optarg);
+            break;
+
+        case 'r':
+            opts.seed = (cl_uint)strtoul(optarg, NULL, 0);
+            break;
+
+        case 'D':
+            opts.select = optarg;
+            break;
+
+        default:
+            usage();
+            return -1;
+        }
+    }
+
+    if (opts.size == 0 || opts.reps < 1)
+    {
+        usage();
+        return -1;
+    }
+
+    opts.size = (opts.size + MAT_ALIGN - 1) / MAT_ALIGN * MAT_ALIGN;
+    n = opts.size;
+
+    hostPool = createThreadPool(opts.threads);
+    if (hostPool == NULL)
+    {
+        fprintf(stderr, EXENAME ": %s", getLastCLError());
+        return -1;
+    }
+
+    a = (float *)malloc(sizeof(float) * n * n);
+    b = (float *)malloc(sizeof(float) * n * n);
+    c = (float *)malloc(sizeof(float) * n * n);
+    ref = (float *)malloc(sizeof(float) * n * n);
+    if (a == NULL || b == NULL || c == NULL || ref == NULL)
+    {
+        fprintf(stderr, EXENAME ": Could not allocate memory [matrices]\n");
+        return -1;
+    }
+
+    fillUniform(hostPool, a, n * n, opts.seed, 0);
+    fillUniform(hostPool, b, n * n, opts.seed, 1);
+
+    // warm the caches and the threads once, keep the second run
+    hostGemm(a, b, ref, n);
+    start = wallTime();
+    hostGemm(a, b, ref, n);
+    host = wallTime() - start;
+
+    printf("host: %lux%lu sgemm in %g seconds, %.2f GFLOP/s (%d threads)\n", (unsigned long)n, (unsigned long)n,
+           host, 2.0 * n * n * n / host / 1e9, getThreadCount(hostPool));
+
+    devices = enumCLDevices();
+    if (devices == NULL)
+    {
+        fprintf(stderr, EXENAME ": no opencl device found\n");
+        fprintf(stderr, "\t%s\n", getLastCLError());
+        return -1;
+    }
+
+    for (d = devices; d != NULL; d = d->next)
+    {
+        if (!selectedDevice(d))
+        {
+            continue;
+        }
+
+        printf("%d.%d: %s\n", d->pid, d->did, d->name);
+        testGemm(d, a, b, ref, c, host);
+    }
+
+    freeCLDevices(devices);
+    free(ref);
+    free(c);
+    free(b);
+    free(a);
+    freeThreadPool(hostPool);
+    return 0;
+}
@@ -0,0 +1,360 @@
+// clcache.c
+//
+// On-disk cache of compiled program binaries.
+//
+// A program is keyed by a hash of its source, build options, device name,
+// driver version and platform version. The CL_PROGRAM_BINARIES output is
+// stored under the cache directory and reloaded with
+// clCreateProgramWithBinary; an entry that is stale, corrupt or refused by
+// the driver falls back to a source build, which rewrites it.
+//
+// The directory is $CLC_CACHE_DIR, or $HOME/.cache/cl-c. An empty
+// CLC_CACHE_DIR disables the cache.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "clutil.h"
+
+#define CACHE_MAGIC "CLCBIN1"
+
+static unsigned int tmpSeq;
+
+struct cacheHeader
+{
+    char magic[8];
+    cl_ulong key;
+    cl_ulong size;
+    cl_ulong sum;
+};
+
+void setLastCLError(char *fmt, ...);
+
+static cl_ulong fnv1a(cl_ulong h, const void *p, size_t n)
+{
+    const unsigned char *s;
+    size_t i;
+
+    s = (const unsigned char *)p;
+    for (i = 0; i < n; i += 1)
+    {
+        h ^= s[i];
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+cl_ulong hashCLString(cl_ulong h, const char *s)
+{
+    // the terminating zero separates fields: ("ab", "c") != ("a", "bc")
+    return fnv1a(h, s != NULL ? s : "", s != NULL ? strlen(s) + 1 : 1);
+}
+
+static char *getCacheDir()
+{
+    char *env, *dir;
+
+    env = getenv("CLC_CACHE_DIR");
+    if (env != NULL)
+    {
+        return *env != 0 ? strdup(env) : NULL;
+    }
+
+    env = getenv("HOME");
+    if (env == NULL)
+    {
+        return NULL;
+    }
+
+    dir = (char *)malloc(strlen(env) + 16);
+    if (dir == NULL)
+    {
+        return NULL;
+    }
+
+    sprintf(dir, "%s/.cache/cl-c", env);
+    return dir;
+}
+
+static int makeDirs(char *path)
+{
+    char *p;
+
+    for (p = path + 1; *p != 0; p += 1)
+    {
+        if (*p != '/')
+        {
+            continue;
+        }
+
+        *p = 0;
+        if (mkdir(path, 0755) != 0 && errno != EEXIST)
+        {
+            *p = '/';
+            return 0;
+        }
+        *p = '/';
+    }
+
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+// Cache directory, created if needed; NULL when the cache is disabled.
+// Also holds the device attributes (clenum.c).
+char *getCLCacheDir()
+{
+    char *dir;
+
+    dir = getCacheDir();
+    if (dir != NULL && !makeDirs(dir))
+    {
+        free(dir);
+        return NULL;
+    }
+
+    return dir;
+}
+
+static cl_program loadBinary(cl_context ctx, struct device *d, const char *path, cl_ulong key, const char *options)
+{
+    struct cacheHeader h;
+    unsigned char *bin;
+    cl_program prog;
+    cl_int err, status;
+    size_t size;
+    FILE *f;
+
+    prog = NULL;
+    bin = NULL;
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return NULL;
+    }
+
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, CACHE_MAGIC, sizeof(h.magic)) != 0 ||
+        h.key != key || h.size == 0 || h.size > ((cl_ulong)1 << 30))
+    {
+        goto error;
+    }
+
+    bin = (unsigned char *)malloc(h.size);
+    if (bin == NULL)
+    {
+        goto error;
+    }
+
+    if (fread(bin, h.size, 1, f) != 1 || fnv1a(0xcbf29ce484222325ull, bin, h.size) != h.sum)
+    {
+        goto error;
+    }
+
+    size = (size_t)h.size;
+    prog = clCreateProgramWithBinary(ctx, 1, &d->device, &size,
+                                     (const unsigned char **)&bin, &status, &err);
+    if (prog == NULL || status != CL_SUCCESS)
+    {
+        goto error;
+    }
+
+    err = clBuildProgram(prog, 1, &d->device, options, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        goto error;
+    }
+
+    free(bin);
+    fclose(f);
+    return prog;
+
+error:
+    if (prog != NULL)
+    {
+        clReleaseProgram(prog);
+    }
+
+    free(bin);
+    fclose(f);
+    return NULL;
+}
+
+static void storeBinary(cl_program prog, struct device *d, const char *path, cl_ulong key)
+{
+    struct cacheHeader h;
+    unsigned char **bins;
+    cl_device_id *dids;
+    size_t *sizes;
+    cl_uint i, n;
+    char *tmp;
+    cl_int err;
+    FILE *f;
+
+    bins = NULL;
+    dids = NULL;
+    sizes = NULL;
+    tmp = NULL;
+
+    // the program holds one binary per device of the context
+    err = clGetProgramInfo(prog, CL_PROGRAM_NUM_DEVICES, sizeof(n), &n, NULL);
+    if (err != CL_SUCCESS || n == 0)
+    {
+        return;
+    }
+
+    bins = (unsigned char **)calloc(n, sizeof(*bins));
+    dids = (cl_device_id *)malloc(n * sizeof(*dids));
+    sizes = (size_t *)malloc(n * sizeof(*sizes));
+    tmp = (char *)malloc(strlen(path) + 32);
+    if (bins == NULL || dids == NULL || sizes == NULL || tmp == NULL)
+    {
+        goto error;
+    }
+
+    err = clGetProgramInfo(prog, CL_PROGRAM_DEVICES, n * sizeof(*dids), dids, NULL);
+    err |= clGetProgramInfo(prog, CL_PROGRAM_BINARY_SIZES, n * sizeof(*sizes), sizes, NULL);
+    if (err != CL_SUCCESS)
+    {
+        goto error;
+    }
+
+    for (i = 0; i < n && dids[i] != d->device; i += 1)
+    {
+    }
+
+    if (i == n || sizes[i] == 0)
+    {
+        goto error;
+    }
+
+    bins[i] = (unsigned char *)malloc(sizes[i]);
+    if (bins[i] == NULL)
+    {
+        goto error;
+    }
+
+    // entries left NULL are skipped by the driver
+    err = clGetProgramInfo(prog, CL_PROGRAM_BINARIES, n * sizeof(*bins), bins, NULL);
+    if (err != CL_SUCCESS)
+    {
+        goto error;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+    h.key = key;
+    h.size = sizes[i];
+    h.sum = fnv1a(0xcbf29ce484222325ull, bins[i], sizes[i]);
+
+    // write aside then rename, so a concurrent reader never sees half a
+    // file; the sequence number keeps two threads of a process apart
+    sprintf(tmp, "%s.%d.%u", path, (int)getpid(), __sync_fetch_and_add(&tmpSeq, 1u));
+
+    f = fopen(tmp, "wb");
+    if (f == NULL)
+    {
+        goto error;
+    }
+
+    if (fwrite(&h, sizeof(h), 1, f) != 1 || fwrite(bins[i], sizes[i], 1, f) != 1)
+    {
+        fclose(f);
+        unlink(tmp);
+        goto error;
+    }
+
+    if (fclose(f) != 0 || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+    }
+
+error:
+    if (bins != NULL)
+    {
+        for (i = 0; i < n; i += 1)
+        {
+            free(bins[i]);
+        }
+    }
+
+    free(bins);
+    free(dids);
+    free(sizes);
+    free(tmp);
+}
+
+cl_program buildCLProgram(cl_context ctx, struct device *d, const char *src, const char *options, int *cached)
+{
+    char *dir, *path;
+    cl_program prog;
+    cl_ulong key;
+    size_t len;
+    cl_int err;
+
+    *cached = 0;
+    path = NULL;
+    key = 0;
+
+    dir = getCacheDir();
+    if (dir != NULL)
+    {
+        key = hashCLString(0xcbf29ce484222325ull, src);
+        key = hashCLString(key, options);
+        key = hashCLString(key, d->name);
+        key = hashCLString(key, d->driver);
+        key = hashCLString(key, d->platformVersion);
+
+        path = (char *)malloc(strlen(dir) + 32);
+        if (path != NULL && makeDirs(dir))
+        {
+            sprintf(path, "%s/%016llx.bin", dir, (unsigned long long)key);
+
+            prog = loadBinary(ctx, d, path, key, options);
+            if (prog != NULL)
+            {
+                *cached = 1;
+                free(path);
+                free(dir);
+                return prog;
+            }
+        }
+        else
+        {
+            free(path);
+            path = NULL;
+        }
+
+        free(dir);
+    }
+
+    len = strlen(src);
+
+    prog = clCreateProgramWithSource(ctx, 1, &src, &len, &err);
+    if (prog == NULL)
+    {
+        setLastCLError("clCreateProgramWithSource failed with %d\n", err);
+        free(path);
+        return NULL;
+    }
+
+    err = clBuildProgram(prog, 1, &d->device, options, NULL, NULL);
+    if (err != CL_SUCCESS)
+    {
+        setLastCLError("clBuildProgram failed with %d\n", err);
+        clReleaseProgram(prog);
+        free(path);
+        return NULL;
+    }
+
+    if (path != NULL)
+    {
+        storeBinary(prog, d, path, key);
+        free(path);
+    }
+
+    return prog;
+}
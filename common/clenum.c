@@ -1,8 +1,22 @@
+// clenum.c
+//
+// Device list, with the attributes that matter for performance decisions.
+//
+// Only what identifies a device is queried on each start: its name, its
+// driver version and its platform version. The other attributes come
+// from dev-<hash>.txt in the cache directory (see clcache.c) when it
+// holds an entry for the same identity, from the driver otherwise, and
+// are then written there: a driver update gives a new entry.
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <unistd.h>
 #include "clutil.h"
 
+#define DEVICE_MAGIC "clc-device 1"
+
 void freeCLDevices(struct device *d)
 {
     struct device *n;
@@ -10,7 +24,12 @@ void freeCLDevices(struct device *d)
     while (d != NULL)
     {
         n = d->next;
-        // free d->XXX
+        free(d->name);
+        free(d->driver);
+        free(d->platformVersion);
+        free(d->vendor);
+        free(d->version);
+        free(d->extensions);
         free(d);
         d = n;
     }
@@ -19,6 +38,304 @@ void freeCLDevices(struct device *d)
 void setLastCLError(char *fmt, ...);
 char *getCLPlateformString(cl_platform_id id, cl_platform_info info);
 char *getCLDeviceString(cl_device_id id, cl_device_info info);
+char *getCLCacheDir();
+cl_ulong hashCLString(cl_ulong h, const char *s);
+
+static const cl_device_info vecInfo[7] = {
+    CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR, CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT,
+    CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT, CL_DEVICE_PREFERRED_VECTOR_WIDTH_LONG,
+    CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE,
+    CL_DEVICE_PREFERRED_VECTOR_WIDTH_HALF};
+
+// whole word match in the extension list
+int hasCLExtension(struct device *d, const char *name)
+{
+    const char *p;
+    size_t len;
+
+    len = strlen(name);
+    for (p = d->extensions; p != NULL && (p = strstr(p, name)) != NULL; p += len)
+    {
+        if ((p == d->extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == 0))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// zero when the query fails: an attribute the driver does not report
+static void getInfo(cl_device_id id, cl_device_info info, void *p, size_t size)
+{
+    if (clGetDeviceInfo(id, info, size, p, NULL) != CL_SUCCESS)
+    {
+        memset(p, 0, size);
+    }
+}
+
+static void queryDevice(struct device *d)
+{
+    int major, minor, i;
+
+    d->vendor = getCLDeviceString(d->device, CL_DEVICE_VENDOR);
+    d->version = getCLDeviceString(d->device, CL_DEVICE_VERSION);
+    d->extensions = getCLDeviceString(d->device, CL_DEVICE_EXTENSIONS);
+
+    getInfo(d->device, CL_DEVICE_MAX_COMPUTE_UNITS, &d->computeUnits, sizeof(d->computeUnits));
+    getInfo(d->device, CL_DEVICE_MAX_CLOCK_FREQUENCY, &d->clock, sizeof(d->clock));
+    getInfo(d->device, CL_DEVICE_GLOBAL_MEM_SIZE, &d->globalMem, sizeof(d->globalMem));
+    getInfo(d->device, CL_DEVICE_LOCAL_MEM_SIZE, &d->localMem, sizeof(d->localMem));
+    getInfo(d->device, CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE, &d->constMem, sizeof(d->constMem));
+    getInfo(d->device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, &d->maxAlloc, sizeof(d->maxAlloc));
+    getInfo(d->device, CL_DEVICE_MAX_WORK_GROUP_SIZE, &d->maxWorkGroup, sizeof(d->maxWorkGroup));
+    getInfo(d->device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, &d->baseAlign, sizeof(d->baseAlign));
+    getInfo(d->device, CL_DEVICE_HOST_UNIFIED_MEMORY, &d->unified, sizeof(d->unified));
+
+    for (i = 0; i < 7; i += 1)
+    {
+        getInfo(d->device, vecInfo[i], &d->vecWidth[i], sizeof(d->vecWidth[i]));
+    }
+
+    // the 2.0 query is not defined below
+    d->svm = 0;
+    if (d->version != NULL && sscanf(d->version, "OpenCL %d.%d", &major, &minor) == 2 && major >= 2)
+    {
+        getInfo(d->device, CL_DEVICE_SVM_CAPABILITIES, &d->svm, sizeof(d->svm));
+    }
+
+    d->fp16 = hasCLExtension(d, "cl_khr_fp16");
+    d->fp64 = hasCLExtension(d, "cl_khr_fp64");
+}
+
+// <prefix>-<hash of the identity>.txt, NULL without a cache
+char *getCLDevicePath(struct device *d, const char *prefix)
+{
+    cl_ulong key;
+    char *dir, *path;
+
+    dir = getCLCacheDir();
+    if (dir == NULL)
+    {
+        return NULL;
+    }
+
+    key = hashCLString(0xcbf29ce484222325ull, d->name);
+    key = hashCLString(key, d->driver);
+    key = hashCLString(key, d->platformVersion);
+
+    path = (char *)malloc(strlen(dir) + strlen(prefix) + 32);
+    if (path != NULL)
+    {
+        sprintf(path, "%s/%s-%016llx.txt", dir, prefix, (unsigned long long)key);
+    }
+
+    free(dir);
+    return path;
+}
+
+// "key value" lines; the identity has to match, string values run to
+// the end of the line
+static int loadDevice(struct device *d, const char *path)
+{
+    char *line, *value;
+    size_t cap, len;
+    FILE *f;
+    int ok, ids, i;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+        return 0;
+    }
+
+    line = NULL;
+    cap = 0;
+    ok = 0;
+    ids = 0;
+
+    if (getline(&line, &cap, f) <= 0 || strncmp(line, DEVICE_MAGIC "\n", sizeof(DEVICE_MAGIC)) != 0)
+    {
+        goto error;
+    }
+
+    while (getline(&line, &cap, f) > 0)
+    {
+        len = strlen(line);
+        if (len > 0 && line[len - 1] == '\n')
+        {
+            line[len - 1] = 0;
+        }
+
+        value = strchr(line, ' ');
+        if (value == NULL)
+        {
+            goto error;
+        }
+        *value++ = 0;
+
+        if (strcmp(line, "name") == 0 || strcmp(line, "driver") == 0 || strcmp(line, "platform") == 0)
+        {
+            if (strcmp(value, line[0] == 'n' ? d->name : line[0] == 'd' ? d->driver : d->platformVersion) != 0)
+            {
+                goto error;
+            }
+            ids += 1;
+        }
+        else if (strcmp(line, "vendor") == 0)
+        {
+            d->vendor = strdup(value);
+        }
+        else if (strcmp(line, "version") == 0)
+        {
+            d->version = strdup(value);
+        }
+        else if (strcmp(line, "extensions") == 0)
+        {
+            d->extensions = strdup(value);
+        }
+        else if (strcmp(line, "compute_units") == 0)
+        {
+            d->computeUnits = (cl_uint)strtoul(value, NULL, 0);
+        }
+        else if (strcmp(line, "clock") == 0)
+        {
+            d->clock = (cl_uint)strtoul(value, NULL, 0);
+        }
+        else if (strcmp(line, "global_mem") == 0)
+        {
+            d->globalMem = (cl_ulong)strtoull(value, NULL, 0);
+        }
+        else if (strcmp(line, "local_mem") == 0)
+        {
+            d->localMem = (cl_ulong)strtoull(value, NULL, 0);
+        }
+        else if (strcmp(line, "const_mem") == 0)
+        {
+            d->constMem = (cl_ulong)strtoull(value, NULL, 0);
+        }
+        else if (strcmp(line, "max_alloc") == 0)
+        {
+            d->maxAlloc = (cl_ulong)strtoull(value, NULL, 0);
+        }
+        else if (strcmp(line, "max_work_group") == 0)
+        {
+            d->maxWorkGroup = (size_t)strtoull(value, NULL, 0);
+        }
+        else if (strcmp(line, "vector_widths") == 0)
+        {
+            for (i = 0; i < 7; i += 1)
+            {
+                d->vecWidth[i] = (cl_uint)strtoul(value, &value, 0);
+            }
+        }
+        else if (strcmp(line, "base_align") == 0)
+        {
+            d->baseAlign = (cl_uint)strtoul(value, NULL, 0);
+        }
+        else if (strcmp(line, "unified") == 0)
+        {
+            d->unified = (cl_bool)strtoul(value, NULL, 0);
+        }
+        else if (strcmp(line, "svm") == 0)
+        {
+            d->svm = (cl_device_svm_capabilities)strtoull(value, NULL, 0);
+        }
+        else if (strcmp(line, "fp16") == 0)
+        {
+            d->fp16 = atoi(value);
+        }
+        else if (strcmp(line, "fp64") == 0)
+        {
+            d->fp64 = atoi(value);
+        }
+    }
+
+    ok = ids == 3 && d->version != NULL && d->extensions != NULL;
+
+error:
+    free(line);
+    fclose(f);
+    return ok;
+}
+
+// written aside then renamed, as the program binaries
+static void storeDevice(struct device *d, const char *path)
+{
+    static unsigned int seq;
+    char *tmp;
+    FILE *f;
+    int i;
+
+    if (d->vendor == NULL || d->version == NULL || d->extensions == NULL)
+    {
+        return;
+    }
+
+    tmp = (char *)malloc(strlen(path) + 32);
+    if (tmp == NULL)
+    {
+        return;
+    }
+
+    sprintf(tmp, "%s.%d.%u", path, (int)getpid(), __sync_fetch_and_add(&seq, 1u));
+
+    f = fopen(tmp, "w");
+    if (f == NULL)
+    {
+        free(tmp);
+        return;
+    }
+
+    fprintf(f, DEVICE_MAGIC "\n");
+    fprintf(f, "name %s\ndriver %s\nplatform %s\n", d->name, d->driver, d->platformVersion);
+    fprintf(f, "vendor %s\nversion %s\nextensions %s\n", d->vendor, d->version, d->extensions);
+    fprintf(f, "compute_units %u\nclock %u\n", d->computeUnits, d->clock);
+    fprintf(f, "global_mem %llu\nlocal_mem %llu\nconst_mem %llu\nmax_alloc %llu\n",
+            (unsigned long long)d->globalMem, (unsigned long long)d->localMem,
+            (unsigned long long)d->constMem, (unsigned long long)d->maxAlloc);
+    fprintf(f, "max_work_group %lu\nvector_widths", (unsigned long)d->maxWorkGroup);
+    for (i = 0; i < 7; i += 1)
+    {
+        fprintf(f, " %u", d->vecWidth[i]);
+    }
+    fprintf(f, "\nbase_align %u\nunified %u\nsvm %llu\nfp16 %d\nfp64 %d\n", d->baseAlign, d->unified,
+            (unsigned long long)d->svm, d->fp16, d->fp64);
+
+    if (fclose(f) != 0 || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+    }
+
+    free(tmp);
+}
+
+static void describeDevice(struct device *d)
+{
+    char *path;
+
+    path = getCLDevicePath(d, "dev");
+    if (path != NULL && loadDevice(d, path))
+    {
+        d->cached = 1;
+        free(path);
+        return;
+    }
+
+    // a stale or partial entry
+    free(d->vendor);
+    free(d->version);
+    free(d->extensions);
+    memset(&d->vendor, 0, sizeof(*d) - offsetof(struct device, vendor));
+
+    queryDevice(d);
+
+    if (path != NULL)
+    {
+        storeDevice(d, path);
+        free(path);
+    }
+}
 
 struct device *enumCLDevices()
 {
@@ -26,8 +343,11 @@ struct device *enumCLDevices()
     cl_uint np, nps, nd, nds;
     cl_platform_id *pids;
     cl_device_id *dids;
+    char *version;
     cl_int err;
 
+    version = NULL;
+
     err = clGetPlatformIDs(0, NULL, &nps);
     if (err != CL_SUCCESS)
     {
@@ -58,6 +378,9 @@ struct device *enumCLDevices()
     devices = NULL;
     for (np = 0; np < nps; np += 1)
     {
+        free(version);
+        version = getCLPlateformString(pids[np], CL_PLATFORM_VERSION);
+
         err = clGetDeviceIDs(pids[np], CL_DEVICE_TYPE_ALL, 0, NULL, &nds);
         if (err != CL_SUCCESS || nds == 0)
         {
@@ -83,7 +406,7 @@ struct device *enumCLDevices()
         {
             struct device *d;
 
-            d = (struct device *)malloc(sizeof(*d));
+            d = (struct device *)calloc(1, sizeof(*d));
             if (d == NULL)
             {
                 setLastCLError("Could not allocate memory [device entry]\n");
@@ -96,8 +419,6 @@ struct device *enumCLDevices()
             d->platform = pids[np];
             d->device = dids[nd];
 
-            // TODO: get more information (name, type, memory, extensions, ...)
-
             err = clGetDeviceInfo(d->device, CL_DEVICE_TYPE, sizeof(d->type), &d->type, NULL);
             if (err != CL_SUCCESS)
             {
@@ -107,16 +428,27 @@ struct device *enumCLDevices()
             }
 
             d->name = getCLDeviceString(d->device, CL_DEVICE_NAME);
-            if (d->name == NULL)
+            d->driver = getCLDeviceString(d->device, CL_DRIVER_VERSION);
+            d->platformVersion = version != NULL ? strdup(version) : NULL;
+            if (d->name == NULL || d->driver == NULL || d->platformVersion == NULL)
             {
+                free(d->name);
+                free(d->driver);
+                free(d->platformVersion);
                 free(d);
                 continue;
             }
 
+            describeDevice(d);
+
             devices = d;
         }
+
+        free(dids);
     }
 
+    free(version);
+    free(pids);
     return devices;
 }
 
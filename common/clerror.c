@@ -1,7 +1,8 @@
 #include <stdio.h>
 #include <stdarg.h>
 
-static char lastError[1024] = "no error";
+// one per thread: devices run on threads of their own
+static __thread char lastError[1024] = "no error";
 
 char *getLastCLError()
 {
@@ -0,0 +1,410 @@
+// clexpr.c
+//
+// Lazy element-wise expressions, evaluated by one fused kernel.
+//
+// exprInput, exprConst and exprOp only record nodes of a DAG. evalExpr
+// turns the DAG under the requested outputs into a single OpenCL kernel:
+// each input is read once, every node is a register, each output is
+// written once, whatever the number of operators. A node used twice is
+// computed once.
+//
+// Constants are kernel arguments, so the source only depends on the
+// shape of the expression. The kernel is named after a hash of its
+// source and kept in the runtime's kernel table (and the on-disk binary
+// cache): an expression of a known shape is neither generated into a new
+// program nor built again.
+//
+// FP_CONTRACT is off: the fused kernel gives the same bits as the same
+// operators run one kernel at a time, or on the host.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "clutil.h"
+
+#define MAX_INPUTS  16
+#define MAX_CONSTS  32
+#define MAX_OUTPUTS 8
+
+struct exprNode
+{
+    struct exprNode *link;  // all nodes of the graph
+    int op;
+    int index;              // EXPR_INPUT: input number
+    float value;            // EXPR_CONST
+    struct exprNode *a;
+    struct exprNode *b;
+    int id;                 // code generation: temporary or constant slot, -1: not seen
+};
+
+struct exprGraph
+{
+    struct exprNode *nodes;
+};
+
+struct strbuf
+{
+    char *s;
+    size_t len;
+    size_t cap;
+    int failed;
+};
+
+struct gen
+{
+    struct strbuf body;
+    int ntmp;
+    int ninputs;
+    int nconsts;
+    float consts[MAX_CONSTS];
+    int failed;
+};
+
+void setLastCLError(char *fmt, ...);
+
+struct exprGraph *createExprGraph()
+{
+    struct exprGraph *g;
+
+    g = (struct exprGraph *)calloc(1, sizeof(*g));
+    if (g == NULL)
+    {
+        setLastCLError("Could not allocate memory [expression]\n");
+    }
+
+    return g;
+}
+
+void freeExprGraph(struct exprGraph *g)
+{
+    struct exprNode *e, *n;
+
+    if (g == NULL)
+    {
+        return;
+    }
+
+    for (e = g->nodes; e != NULL; e = n)
+    {
+        n = e->link;
+        free(e);
+    }
+
+    free(g);
+}
+
+static struct exprNode *newNode(struct exprGraph *g, int op, struct exprNode *a, struct exprNode *b)
+{
+    struct exprNode *e;
+
+    e = (struct exprNode *)calloc(1, sizeof(*e));
+    if (e == NULL)
+    {
+        setLastCLError("Could not allocate memory [expression node]\n");
+        return NULL;
+    }
+
+    e->op = op;
+    e->a = a;
+    e->b = b;
+    e->link = g->nodes;
+    g->nodes = e;
+
+    return e;
+}
+
+struct exprNode *exprInput(struct exprGraph *g, int index)
+{
+    struct exprNode *e;
+
+    if (index < 0 || index >= MAX_INPUTS)
+    {
+        setLastCLError("Expression input %d out of range\n", index);
+        return NULL;
+    }
+
+    e = newNode(g, EXPR_INPUT, NULL, NULL);
+    if (e != NULL)
+    {
+        e->index = index;
+    }
+
+    return e;
+}
+
+struct exprNode *exprConst(struct exprGraph *g, float value)
+{
+    struct exprNode *e;
+
+    e = newNode(g, EXPR_CONST, NULL, NULL);
+    if (e != NULL)
+    {
+        e->value = value;
+    }
+
+    return e;
+}
+
+// b is NULL for the unary operators. A NULL operand gives NULL, so that
+// a whole expression can be built before checking the result once.
+struct exprNode *exprOp(struct exprGraph *g, int op, struct exprNode *a, struct exprNode *b)
+{
+    if (a == NULL || (op < EXPR_NEG && b == NULL))
+    {
+        return NULL;
+    }
+
+    return newNode(g, op, a, op < EXPR_NEG ? b : NULL);
+}
+
+static void append(struct strbuf *sb, const char *fmt, ...)
+{
+    va_list ap;
+    char *p;
+    int n;
+
+    if (sb->failed)
+    {
+        return;
+    }
+
+    for (;;)
+    {
+        va_start(ap, fmt);
+        n = vsnprintf(sb->s + sb->len, sb->cap - sb->len, fmt, ap);
+        va_end(ap);
+
+        if (n >= 0 && sb->len + n < sb->cap)
+        {
+            sb->len += n;
+            return;
+        }
+
+        p = (char *)realloc(sb->s, sb->cap * 2 + 256);
+        if (p == NULL)
+        {
+            sb->failed = 1;
+            return;
+        }
+
+        sb->s = p;
+        sb->cap = sb->cap * 2 + 256;
+    }
+}
+
+// Emit e after its operands, once; returns its temporary number
+static int emit(struct gen *gn, struct exprNode *e)
+{
+    static const char *infix[] = {"+", "-", "*", "/"};
+    static const char *calls[] = {"fmin", "fmax"};
+    int a, b;
+
+    if (e->id >= 0)
+    {
+        return e->id;
+    }
+
+    switch (e->op)
+    {
+    case EXPR_INPUT:
+        if (e->index >= gn->ninputs)
+        {
+            gn->ninputs = e->index + 1;
+        }
+        e->id = gn->ntmp++;
+        append(&gn->body, "   float t%d = in%d[i];\n", e->id, e->index);
+        break;
+
+    case EXPR_CONST:
+        if (gn->nconsts == MAX_CONSTS)
+        {
+            gn->failed = 1;
+            return 0;
+        }
+        gn->consts[gn->nconsts] = e->value;
+        e->id = gn->ntmp++;
+        append(&gn->body, "   float t%d = k%d;\n", e->id, gn->nconsts++);
+        break;
+
+    case EXPR_ADD:
+    case EXPR_SUB:
+    case EXPR_MUL:
+    case EXPR_DIV:
+        a = emit(gn, e->a);
+        b = emit(gn, e->b);
+        e->id = gn->ntmp++;
+        append(&gn->body, "   float t%d = t%d %s t%d;\n", e->id, a, infix[e->op - EXPR_ADD], b);
+        break;
+
+    case EXPR_MIN:
+    case EXPR_MAX:
+        a = emit(gn, e->a);
+        b = emit(gn, e->b);
+        e->id = gn->ntmp++;
+        append(&gn->body, "   float t%d = %s(t%d, t%d);\n", e->id, calls[e->op - EXPR_MIN], a, b);
+        break;
+
+    case EXPR_NEG:
+        a = emit(gn, e->a);
+        e->id = gn->ntmp++;
+        append(&gn->body, "   float t%d = -t%d;\n", e->id, a);
+        break;
+
+    case EXPR_ABS:
+        a = emit(gn, e->a);
+        e->id = gn->ntmp++;
+        append(&gn->body, "   float t%d = fabs(t%d);\n", e->id, a);
+        break;
+
+    case EXPR_SQRT:
+        a = emit(gn, e->a);
+        e->id = gn->ntmp++;
+        append(&gn->body, "   float t%d = sqrt(t%d);\n", e->id, a);
+        break;
+
+    default:
+        gn->failed = 1;
+        return 0;
+    }
+
+    return e->id;
+}
+
+static cl_ulong hashSource(const char *s)
+{
+    cl_ulong h;
+
+    h = 0xcbf29ce484222325ull;
+    for (; *s != 0; s += 1)
+    {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ull;
+    }
+
+    return h;
+}
+
+// One kernel computing outs[0 .. nouts) from inputs[], n elements;
+// outputs[j] receives outs[j]. evt is the kernel's event, or NULL.
+int evalExpr(struct clrt *rt, struct exprGraph *g, struct exprNode **outs, int nouts,
+             cl_mem *inputs, cl_mem *outputs, size_t n, cl_event *evt)
+{
+    struct exprNode *e;
+    struct strbuf sig, src;
+    struct gen gn;
+    char name[32];
+    int res[MAX_OUTPUTS], i, ok;
+    cl_uint arg, un;
+    cl_kernel kern;
+    cl_int err;
+
+    ok = 0;
+    memset(&gn, 0, sizeof(gn));
+    memset(&sig, 0, sizeof(sig));
+    memset(&src, 0, sizeof(src));
+
+    if (nouts <= 0 || nouts > MAX_OUTPUTS)
+    {
+        setLastCLError("Expression with %d outputs\n", nouts);
+        return 0;
+    }
+
+    for (i = 0; i < nouts; i += 1)
+    {
+        if (outs[i] == NULL)
+        {
+            setLastCLError("Incomplete expression, output %d\n", i);
+            return 0;
+        }
+    }
+
+    for (e = g->nodes; e != NULL; e = e->link)
+    {
+        e->id = -1;
+    }
+
+    for (i = 0; i < nouts; i += 1)
+    {
+        res[i] = emit(&gn, outs[i]);
+    }
+
+    for (i = 0; i < nouts; i += 1)
+    {
+        append(&gn.body, "   out%d[i] = t%d;\n", i, res[i]);
+    }
+
+    if (gn.failed || gn.body.failed)
+    {
+        setLastCLError("Could not generate the expression kernel\n");
+        goto error;
+    }
+
+    // parameters: inputs, outputs, constants, n
+    append(&sig, "(");
+    for (i = 0; i < gn.ninputs; i += 1)
+    {
+        append(&sig, "__global const float* in%d, ", i);
+    }
+    for (i = 0; i < nouts; i += 1)
+    {
+        append(&sig, "__global float* out%d, ", i);
+    }
+    for (i = 0; i < gn.nconsts; i += 1)
+    {
+        append(&sig, "const float k%d, ", i);
+    }
+    append(&sig, "const uint n)\n{\n   uint i = get_global_id(0);\n   if (i >= n)\n      return;\n%s}\n",
+           gn.body.s);
+
+    // the kernel is named after the rest of its source
+    sprintf(name, "expr_%016llx", sig.failed ? 0ull : (unsigned long long)hashSource(sig.s));
+    append(&src, "#pragma OPENCL FP_CONTRACT OFF\n__kernel void %s%s", name, sig.s);
+
+    if (sig.failed || src.failed)
+    {
+        setLastCLError("Could not allocate memory [expression source]\n");
+        goto error;
+    }
+
+    kern = getCLKernel(rt, name);
+    if (kern == NULL)
+    {
+        if (!addCLProgram(rt, src.s, NULL) || (kern = getCLKernel(rt, name)) == NULL)
+        {
+            goto error;
+        }
+    }
+
+    err = CL_SUCCESS;
+    arg = 0;
+    for (i = 0; i < gn.ninputs; i += 1)
+    {
+        err |= clSetKernelArg(kern, arg++, sizeof(cl_mem), &inputs[i]);
+    }
+    for (i = 0; i < nouts; i += 1)
+    {
+        err |= clSetKernelArg(kern, arg++, sizeof(cl_mem), &outputs[i]);
+    }
+    for (i = 0; i < gn.nconsts; i += 1)
+    {
+        err |= clSetKernelArg(kern, arg++, sizeof(float), &gn.consts[i]);
+    }
+
+    un = (cl_uint)n;
+    err |= clSetKernelArg(kern, arg, sizeof(cl_uint), &un);
+    err |= clEnqueueNDRangeKernel(rt->queue, kern, 1, NULL, &n, NULL, 0, NULL, evt);
+    if (err != CL_SUCCESS)
+    {
+        setLastCLError("Expression kernel %s failed with %d\n", name, err);
+        goto error;
+    }
+
+    ok = 1;
+
+error:
+    free(gn.body.s);
+    free(sig.s);
+    free(src.s);
+    return ok;
+}
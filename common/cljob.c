@@ -0,0 +1,211 @@
+// cljob.c
+//
+// Asynchronous jobs: a job is any chain of commands the caller enqueued
+// without blocking, ending with one event. submitCLJob registers a
+// clSetEventCallback on that event and flushes the queue; the driver
+// calls back when the chain is done and the job lands on a completion
+// queue, where the host picks it up with waitCLJob or pollCLJob.
+//
+// Jobs on any number of queues and devices can share one completion
+// queue, so a single host thread can keep them all busy: it only wakes
+// up when some job is done, and can work on its results while the others
+// run.
+//
+// The callbacks run on a driver thread: they only take the lock and
+// append the job, no OpenCL call is made from there.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "clutil.h"
+
+struct cljobs
+{
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+
+    struct cljob *head;     // completed, oldest first
+    struct cljob *tail;
+    int pending;            // submitted, not completed yet
+};
+
+void setLastCLError(char *fmt, ...);
+
+struct cljobs *createCLJobs()
+{
+    struct cljobs *q;
+
+    q = (struct cljobs *)calloc(1, sizeof(*q));
+    if (q == NULL)
+    {
+        setLastCLError("Could not allocate memory [jobs]\n");
+        return NULL;
+    }
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->done, NULL);
+
+    return q;
+}
+
+// Waits for the jobs still running: their callbacks point here
+void freeCLJobs(struct cljobs *q)
+{
+    struct cljob *j;
+
+    if (q == NULL)
+    {
+        return;
+    }
+
+    while ((j = waitCLJob(q)) != NULL)
+    {
+        freeCLJob(j);
+    }
+
+    pthread_cond_destroy(&q->done);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
+
+static void CL_CALLBACK jobDone(cl_event evt, cl_int status, void *data)
+{
+    struct cljob *j;
+    struct cljobs *q;
+
+    j = (struct cljob *)data;
+    q = j->jobs;
+
+    pthread_mutex_lock(&q->lock);
+
+    j->status = status;
+    j->next = NULL;
+    if (q->tail != NULL)
+    {
+        q->tail->next = j;
+    }
+    else
+    {
+        q->head = j;
+    }
+    q->tail = j;
+
+    q->pending -= 1;
+    pthread_cond_signal(&q->done);
+
+    pthread_mutex_unlock(&q->lock);
+}
+
+// evt is the last command of the job, now owned by it; arg is handed
+// back with the job. Returns NULL (and evt is left to the caller) if the
+// callback could not be set.
+struct cljob *submitCLJob(struct cljobs *q, cl_command_queue queue, cl_event evt, void *arg)
+{
+    struct cljob *j;
+    cl_int err;
+
+    j = (struct cljob *)calloc(1, sizeof(*j));
+    if (j == NULL)
+    {
+        setLastCLError("Could not allocate memory [job]\n");
+        return NULL;
+    }
+
+    j->jobs = q;
+    j->evt = evt;
+    j->arg = arg;
+    j->status = CL_QUEUED;
+
+    // counted first: the callback may run before clSetEventCallback returns
+    pthread_mutex_lock(&q->lock);
+    q->pending += 1;
+    pthread_mutex_unlock(&q->lock);
+
+    err = clSetEventCallback(evt, CL_COMPLETE, jobDone, j);
+    if (err != CL_SUCCESS)
+    {
+        setLastCLError("clSetEventCallback failed with %d\n", err);
+
+        pthread_mutex_lock(&q->lock);
+        q->pending -= 1;
+        pthread_mutex_unlock(&q->lock);
+
+        free(j);
+        return NULL;
+    }
+
+    // nothing may reach the device before a flush
+    clFlush(queue);
+    return j;
+}
+
+// Next completed job, in completion order. Blocks while jobs are still
+// running; NULL when none is left.
+struct cljob *waitCLJob(struct cljobs *q)
+{
+    struct cljob *j;
+
+    pthread_mutex_lock(&q->lock);
+
+    while (q->head == NULL && q->pending > 0)
+    {
+        pthread_cond_wait(&q->done, &q->lock);
+    }
+
+    j = q->head;
+    if (j != NULL)
+    {
+        q->head = j->next;
+        if (q->head == NULL)
+        {
+            q->tail = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&q->lock);
+    return j;
+}
+
+// Same without blocking: NULL when no job has completed yet
+struct cljob *pollCLJob(struct cljobs *q)
+{
+    struct cljob *j;
+
+    pthread_mutex_lock(&q->lock);
+
+    j = q->head;
+    if (j != NULL)
+    {
+        q->head = j->next;
+        if (q->head == NULL)
+        {
+            q->tail = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&q->lock);
+    return j;
+}
+
+int pendingCLJobs(struct cljobs *q)
+{
+    int n;
+
+    pthread_mutex_lock(&q->lock);
+    n = q->pending;
+    pthread_mutex_unlock(&q->lock);
+
+    return n;
+}
+
+void freeCLJob(struct cljob *j)
+{
+    if (j == NULL)
+    {
+        return;
+    }
+
+    clReleaseEvent(j->evt);
+    free(j);
+}
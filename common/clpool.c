@@ -0,0 +1,383 @@
+// clpool.c
+//
+// Device memory pool: blocks are sub-buffers (clCreateSubBuffer) carved
+// out of a few large arenas, at offsets aligned on
+// CL_DEVICE_MEM_BASE_ADDR_ALIGN.
+//
+// Block sizes are powers of two from MIN_BLOCK, one free list per size
+// class. A freed block keeps its sub-buffer and goes back on its list, so
+// in steady state an allocation is a list pop: no clCreateBuffer, no
+// clReleaseMemObject. Requests whose block would be larger than an arena
+// get an arena of their own, released with the block.
+//
+// A freed block can be handed out again at once: the commands using it
+// must be finished, or be on the same in-order queue as the next user.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "clutil.h"
+
+#define MIN_BLOCK   4096
+#define MAX_CLASSES 48
+#define ARENA_SIZE  (64 * 1024 * 1024)
+
+struct poolArena
+{
+    struct poolArena *next;
+    cl_mem mem;
+    size_t size;
+    size_t top;             // bytes already carved
+    int large;              // holds a single oversized block
+};
+
+struct poolBlock
+{
+    struct poolBlock *next;
+    cl_mem mem;
+    struct poolArena *arena;
+    size_t size;            // size of the class
+    size_t used;            // size asked for
+    int cls;
+};
+
+struct clpool
+{
+    cl_context ctx;
+    size_t min;             // smallest block, multiple of the alignment
+    size_t arena;
+    size_t limit;           // arena bytes allowed on the device
+
+    struct poolArena *arenas;
+    struct poolBlock *free[MAX_CLASSES];
+    struct poolBlock *used;
+
+    struct clpoolStats stats;
+    pthread_mutex_t lock;
+};
+
+void setLastCLError(char *fmt, ...);
+
+struct clpool *createCLPool(cl_context ctx, struct device *d, size_t arena, size_t limit)
+{
+    struct clpool *p;
+
+    if (d->maxAlloc == 0 || d->globalMem == 0)
+    {
+        setLastCLError("Device memory sizes unknown\n");
+        return NULL;
+    }
+
+    p = (struct clpool *)calloc(1, sizeof(*p));
+    if (p == NULL)
+    {
+        setLastCLError("Could not allocate memory [pool]\n");
+        return NULL;
+    }
+
+    p->ctx = ctx;
+
+    // the alignment is given in bits
+    p->min = MIN_BLOCK;
+    while (p->min < d->baseAlign / 8)
+    {
+        p->min *= 2;
+    }
+
+    p->arena = arena != 0 ? arena : ARENA_SIZE;
+    if (p->arena > d->maxAlloc)
+    {
+        p->arena = (size_t)d->maxAlloc;
+    }
+    p->arena &= ~(p->min - 1);
+
+    p->limit = limit != 0 ? limit : (size_t)d->globalMem;
+
+    pthread_mutex_init(&p->lock, NULL);
+    return p;
+}
+
+void freeCLPool(struct clpool *p)
+{
+    struct poolArena *a, *na;
+    struct poolBlock *b, *nb;
+    int c;
+
+    if (p == NULL)
+    {
+        return;
+    }
+
+    // sub-buffers before their parent
+    for (c = 0; c < MAX_CLASSES; c += 1)
+    {
+        for (b = p->free[c]; b != NULL; b = nb)
+        {
+            nb = b->next;
+            clReleaseMemObject(b->mem);
+            free(b);
+        }
+    }
+
+    for (b = p->used; b != NULL; b = nb)
+    {
+        nb = b->next;
+        clReleaseMemObject(b->mem);
+        free(b);
+    }
+
+    for (a = p->arenas; a != NULL; a = na)
+    {
+        na = a->next;
+        clReleaseMemObject(a->mem);
+        free(a);
+    }
+
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+}
+
+// caller holds the lock
+static struct poolArena *newArena(struct clpool *p, size_t size, int large)
+{
+    struct poolArena *a;
+    cl_int err;
+
+    if (p->stats.reserved + size > p->limit)
+    {
+        setLastCLError("Pool limit reached: %lu + %lu > %lu bytes\n", (unsigned long)p->stats.reserved,
+                       (unsigned long)size, (unsigned long)p->limit);
+        return NULL;
+    }
+
+    a = (struct poolArena *)calloc(1, sizeof(*a));
+    if (a == NULL)
+    {
+        setLastCLError("Could not allocate memory [arena]\n");
+        return NULL;
+    }
+
+    a->mem = clCreateBuffer(p->ctx, CL_MEM_READ_WRITE, size, NULL, &err);
+    if (a->mem == NULL)
+    {
+        setLastCLError("clCreateBuffer(arena, %lu) failed with %d\n", (unsigned long)size, err);
+        free(a);
+        return NULL;
+    }
+
+    a->size = size;
+    a->large = large;
+    a->next = p->arenas;
+    p->arenas = a;
+
+    p->stats.reserved += size;
+    p->stats.arenas += 1;
+
+    return a;
+}
+
+// caller holds the lock
+static void releaseArena(struct clpool *p, struct poolArena *a)
+{
+    struct poolArena **pa;
+
+    for (pa = &p->arenas; *pa != a; pa = &(*pa)->next)
+    {
+    }
+    *pa = a->next;
+
+    p->stats.reserved -= a->size;
+    p->stats.arenas -= 1;
+
+    clReleaseMemObject(a->mem);
+    free(a);
+}
+
+// caller holds the lock: a new block of size bytes carved from a
+static struct poolBlock *carveBlock(struct clpool *p, struct poolArena *a, size_t size, int cls)
+{
+    struct poolBlock *b;
+    cl_buffer_region region;
+    cl_int err;
+
+    b = (struct poolBlock *)calloc(1, sizeof(*b));
+    if (b == NULL)
+    {
+        setLastCLError("Could not allocate memory [block]\n");
+        return NULL;
+    }
+
+    region.origin = a->top;
+    region.size = size;
+
+    b->mem = clCreateSubBuffer(a->mem, 0, CL_BUFFER_CREATE_TYPE_REGION, &region, &err);
+    if (b->mem == NULL)
+    {
+        setLastCLError("clCreateSubBuffer(%lu, %lu) failed with %d\n", (unsigned long)region.origin,
+                       (unsigned long)size, err);
+        free(b);
+        return NULL;
+    }
+
+    b->arena = a;
+    b->size = size;
+    b->cls = cls;
+    a->top += size;
+
+    return b;
+}
+
+// A read-write block of at least size bytes
+cl_mem poolAlloc(struct clpool *p, size_t size)
+{
+    struct poolArena *a;
+    struct poolBlock *b;
+    size_t bsize;
+    int cls;
+
+    if (size == 0)
+    {
+        size = 1;
+    }
+
+    pthread_mutex_lock(&p->lock);
+
+    p->stats.allocs += 1;
+
+    // the class decides: with an arena that is not a power of two, the
+    // block of a size below it can still be larger
+    for (cls = 0, bsize = p->min; bsize < size && bsize <= p->arena; cls += 1, bsize *= 2)
+    {
+    }
+
+    if (bsize > p->arena)
+    {
+        bsize = (size + p->min - 1) & ~(p->min - 1);
+        cls = -1;
+
+        b = NULL;
+        a = newArena(p, bsize, 1);
+        if (a != NULL)
+        {
+            b = carveBlock(p, a, bsize, cls);
+            if (b == NULL)
+            {
+                releaseArena(p, a);
+            }
+        }
+    }
+    else
+    {
+        b = p->free[cls];
+        if (b != NULL)
+        {
+            p->free[cls] = b->next;
+            p->stats.cached -= b->size;
+            p->stats.hits += 1;
+        }
+        else
+        {
+            for (a = p->arenas; a != NULL; a = a->next)
+            {
+                if (!a->large && a->size - a->top >= bsize)
+                {
+                    break;
+                }
+            }
+
+            if (a == NULL)
+            {
+                a = newArena(p, p->arena, 0);
+            }
+
+            b = a != NULL ? carveBlock(p, a, bsize, cls) : NULL;
+        }
+    }
+
+    if (b == NULL)
+    {
+        pthread_mutex_unlock(&p->lock);
+        return NULL;
+    }
+
+    b->used = size;
+    b->next = p->used;
+    p->used = b;
+
+    p->stats.inuse += b->size;
+    p->stats.requested += size;
+    if (p->stats.inuse > p->stats.highWater)
+    {
+        p->stats.highWater = p->stats.inuse;
+    }
+
+    pthread_mutex_unlock(&p->lock);
+    return b->mem;
+}
+
+void poolFree(struct clpool *p, cl_mem mem)
+{
+    struct poolBlock **pb, *b;
+
+    if (mem == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&p->lock);
+
+    for (pb = &p->used; *pb != NULL && (*pb)->mem != mem; pb = &(*pb)->next)
+    {
+    }
+
+    b = *pb;
+    if (b == NULL)
+    {
+        pthread_mutex_unlock(&p->lock);
+        return;
+    }
+
+    *pb = b->next;
+
+    p->stats.inuse -= b->size;
+    p->stats.requested -= b->used;
+
+    if (b->cls < 0)
+    {
+        clReleaseMemObject(b->mem);
+        releaseArena(p, b->arena);
+        free(b);
+    }
+    else
+    {
+        b->next = p->free[b->cls];
+        p->free[b->cls] = b;
+        p->stats.cached += b->size;
+    }
+
+    pthread_mutex_unlock(&p->lock);
+}
+
+void getCLPoolStats(struct clpool *p, struct clpoolStats *s)
+{
+    pthread_mutex_lock(&p->lock);
+    *s = p->stats;
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Internal fragmentation: bytes lost to the size classes in the blocks
+// in use. External: reserved bytes not in use (free lists and the
+// uncarved end of the arenas).
+void printCLPoolStats(struct clpool *p, FILE *f)
+{
+    struct clpoolStats s;
+
+    getCLPoolStats(p, &s);
+
+    fprintf(f, "pool: %d arenas, %.1f MB reserved, %.1f MB in use, high water %.1f MB\n", s.arenas,
+            s.reserved / 1048576.0, s.inuse / 1048576.0, s.highWater / 1048576.0);
+    fprintf(f, "pool: %lu allocations, %lu from free lists, fragmentation %.1f%% internal, %.1f%% external\n",
+            s.allocs, s.hits, s.inuse != 0 ? 100.0 * (s.inuse - s.requested) / s.inuse : 0.0,
+            s.reserved != 0 ? 100.0 * (s.reserved - s.inuse) / s.reserved : 0.0);
+}
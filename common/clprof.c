@@ -0,0 +1,371 @@
+// clprof.c
+//
+// Event based profiling of enqueued commands.
+//
+// Every command of interest gets an event, either from profEvent (pass
+// the returned pointer as the enqueue's event argument) or with
+// profAddEvent when the caller needs the event itself. Once the queues
+// are finished, collectCLProf reads the QUEUED, SUBMIT, START and END
+// timestamps; the commands can then be written as a Chrome / Perfetto
+// trace (chrome://tracing, ui.perfetto.dev) and summed up in a table.
+//
+// A NULL profiler is accepted everywhere and records nothing, so call
+// sites do not need to test for it. Queues need CL_QUEUE_PROFILING_ENABLE.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "clutil.h"
+
+#define MAX_LABEL   48
+
+struct profEntry
+{
+    struct profEntry *next;
+    cl_event evt;
+    int kind;
+    int track;
+    char label[MAX_LABEL];
+    size_t bytes;
+    double flops;
+    cl_ulong t[4];          // queued, submit, start, end
+    int valid;
+};
+
+struct profTrack
+{
+    struct profTrack *next;
+    int id;
+    char name[MAX_LABEL];
+};
+
+struct clprof
+{
+    struct profEntry *head;
+    struct profEntry *tail;
+    struct profTrack *tracks;
+    int ntracks;
+    pthread_mutex_t lock;
+};
+
+static const char *kindNames[] = {"write", "read", "kernel", "map", "unmap", "copy", "fill"};
+
+void setLastCLError(char *fmt, ...);
+
+struct clprof *createCLProf()
+{
+    struct clprof *p;
+
+    p = (struct clprof *)calloc(1, sizeof(*p));
+    if (p == NULL)
+    {
+        setLastCLError("Could not allocate memory [profiler]\n");
+        return NULL;
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    return p;
+}
+
+void freeCLProf(struct clprof *p)
+{
+    struct profEntry *e, *n;
+    struct profTrack *t, *u;
+
+    if (p == NULL)
+    {
+        return;
+    }
+
+    for (e = p->head; e != NULL; e = n)
+    {
+        n = e->next;
+        if (e->evt != NULL)
+        {
+            clReleaseEvent(e->evt);
+        }
+        free(e);
+    }
+
+    for (t = p->tracks; t != NULL; t = u)
+    {
+        u = t->next;
+        free(t);
+    }
+
+    pthread_mutex_destroy(&p->lock);
+    free(p);
+}
+
+// caller holds the lock
+static int findTrack(struct clprof *p, const char *name)
+{
+    struct profTrack *t;
+
+    for (t = p->tracks; t != NULL; t = t->next)
+    {
+        if (strcmp(t->name, name) == 0)
+        {
+            return t->id;
+        }
+    }
+
+    t = (struct profTrack *)calloc(1, sizeof(*t));
+    if (t == NULL)
+    {
+        return 0;
+    }
+
+    t->id = ++p->ntracks;
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    t->next = p->tracks;
+    p->tracks = t;
+
+    return t->id;
+}
+
+static struct profEntry *addEntry(struct clprof *p, const char *track, const char *label,
+                                  int kind, size_t bytes, double flops)
+{
+    struct profEntry *e;
+
+    e = (struct profEntry *)calloc(1, sizeof(*e));
+    if (e == NULL)
+    {
+        return NULL;
+    }
+
+    snprintf(e->label, sizeof(e->label), "%s", label);
+    e->kind = kind;
+    e->bytes = bytes;
+    e->flops = flops;
+
+    pthread_mutex_lock(&p->lock);
+
+    e->track = findTrack(p, track);
+
+    if (p->tail != NULL)
+    {
+        p->tail->next = e;
+    }
+    else
+    {
+        p->head = e;
+    }
+    p->tail = e;
+
+    pthread_mutex_unlock(&p->lock);
+
+    return e;
+}
+
+// Event slot for one command. track groups commands on one trace row
+// (typically a device and queue), bytes and flops feed the rates.
+cl_event *profEvent(struct clprof *p, const char *track, const char *label, int kind, size_t bytes, double flops)
+{
+    struct profEntry *e;
+
+    if (p == NULL)
+    {
+        return NULL;
+    }
+
+    e = addEntry(p, track, label, kind, bytes, flops);
+    return e != NULL ? &e->evt : NULL;
+}
+
+// Same for an event the caller keeps: it is retained here.
+void profAddEvent(struct clprof *p, cl_event evt, const char *track, const char *label, int kind,
+                  size_t bytes, double flops)
+{
+    struct profEntry *e;
+
+    if (p == NULL || evt == NULL)
+    {
+        return;
+    }
+
+    e = addEntry(p, track, label, kind, bytes, flops);
+    if (e != NULL && clRetainEvent(evt) == CL_SUCCESS)
+    {
+        e->evt = evt;
+    }
+}
+
+// Read the timestamps of every command, all of them must be complete.
+// Returns the number of commands without profiling information.
+int collectCLProf(struct clprof *p)
+{
+    static const cl_profiling_info info[4] = {CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT,
+                                              CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END};
+    struct profEntry *e;
+    cl_int err;
+    int i, missing;
+
+    if (p == NULL)
+    {
+        return 0;
+    }
+
+    missing = 0;
+    for (e = p->head; e != NULL; e = e->next)
+    {
+        if (e->evt == NULL)
+        {
+            missing += e->valid ? 0 : 1;
+            continue;
+        }
+
+        err = clWaitForEvents(1, &e->evt);
+        for (i = 0; i < 4 && err == CL_SUCCESS; i += 1)
+        {
+            err = clGetEventProfilingInfo(e->evt, info[i], sizeof(cl_ulong), &e->t[i], NULL);
+        }
+
+        e->valid = err == CL_SUCCESS;
+        missing += e->valid ? 0 : 1;
+
+        clReleaseEvent(e->evt);
+        e->evt = NULL;
+    }
+
+    return missing;
+}
+
+static cl_ulong firstQueued(struct clprof *p)
+{
+    struct profEntry *e;
+    cl_ulong t0;
+
+    t0 = 0;
+    for (e = p->head; e != NULL; e = e->next)
+    {
+        if (e->valid && (t0 == 0 || e->t[0] < t0))
+        {
+            t0 = e->t[0];
+        }
+    }
+
+    return t0;
+}
+
+// Chrome trace event format: one complete ("X") slice per command from
+// START to END, in microseconds from the first QUEUED, one row per track.
+// The queued and submit times go in the slice arguments.
+int writeCLProfTrace(struct clprof *p, const char *path)
+{
+    struct profEntry *e;
+    struct profTrack *t;
+    cl_ulong t0;
+    const char *sep;
+    FILE *f;
+
+    if (p == NULL)
+    {
+        return 1;
+    }
+
+    f = fopen(path, "w");
+    if (f == NULL)
+    {
+        setLastCLError("Could not create %s\n", path);
+        return 0;
+    }
+
+    t0 = firstQueued(p);
+    sep = "";
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+    for (t = p->tracks; t != NULL; t = t->next)
+    {
+        fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                sep, t->id, t->name);
+        sep = ",";
+    }
+
+    for (e = p->head; e != NULL; e = e->next)
+    {
+        if (!e->valid)
+        {
+            continue;
+        }
+
+        fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                   "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"queued_us\":%.3f,\"submit_us\":%.3f,\"bytes\":%lu}}",
+                sep, e->label, kindNames[e->kind], e->track,
+                (double)(e->t[2] - t0) / 1e3, (double)(e->t[3] - e->t[2]) / 1e3,
+                (double)(e->t[0] - t0) / 1e3, (double)(e->t[1] - t0) / 1e3, (unsigned long)e->bytes);
+        sep = ",";
+    }
+
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) != 0)
+    {
+        setLastCLError("Could not write %s\n", path);
+        return 0;
+    }
+
+    return 1;
+}
+
+// One row per label: count, time from queued to start (queuing and
+// submission latency), time from start to end, and the rates.
+void printCLProfSummary(struct clprof *p, FILE *f)
+{
+    struct profEntry *e, *g;
+    double wait, busy, flops;
+    size_t bytes;
+    int count, seen;
+
+    if (p == NULL)
+    {
+        return;
+    }
+
+    fprintf(f, "%-24s %-6s %6s %12s %12s %10s %10s\n",
+            "command", "kind", "count", "queued ms", "busy ms", "GB/s", "GFLOP/s");
+
+    for (e = p->head; e != NULL; e = e->next)
+    {
+        if (!e->valid)
+        {
+            continue;
+        }
+
+        // first entry of its label only
+        seen = 0;
+        for (g = p->head; g != e && !seen; g = g->next)
+        {
+            seen = g->valid && strcmp(g->label, e->label) == 0;
+        }
+
+        if (seen)
+        {
+            continue;
+        }
+
+        count = 0;
+        wait = busy = flops = 0;
+        bytes = 0;
+
+        for (g = e; g != NULL; g = g->next)
+        {
+            if (!g->valid || strcmp(g->label, e->label) != 0)
+            {
+                continue;
+            }
+
+            count += 1;
+            wait += (double)(g->t[2] - g->t[0]) / 1e6;
+            busy += (double)(g->t[3] - g->t[2]) / 1e6;
+            bytes += g->bytes;
+            flops += g->flops;
+        }
+
+        fprintf(f, "%-24s %-6s %6d %12.3f %12.3f %10.2f %10.2f\n", e->label, kindNames[e->kind], count,
+                wait, busy, busy > 0 ? (double)bytes / busy / 1e6 : 0.0, busy > 0 ? flops / busy / 1e6 : 0.0);
+    }
+}
@@ -0,0 +1,553 @@
+// clrank.c
+//
+// Device ranking for a class of work, from a short calibration run.
+//
+// calibrateCLDevice measures four rates on a device, wall clock as seen by
+// the host, best of RANK_REPS runs after a warmup one:
+//   - transfer: a blocking upload then download of RANK_BYTES
+//   - memory: a float4 copy kernel over RANK_BYTES
+//   - flops: chains of fp32 mad, RANK_FLOPS per work item
+//   - launch: enqueue + clFinish of an empty kernel, median of RANK_LAUNCHES
+// It takes a fraction of a second; the rates are then stored in
+// rank-<hash>.txt in the cache directory under the identity of the
+// device (see clenum.c), and reloaded as long as it matches. Delete the
+// file to calibrate again.
+//
+// The score of a device for a class of work is what a job of that class
+// would see:
+//   - bandwidth: host-fed streaming, each byte crosses the link and the
+//     device memory once: 1 / (1 / transfer + 1 / memory), GB/s
+//   - compute: GFLOP/s
+//   - latency: small launches per second, 1 / launch
+// so the best device is the one a job of that class finishes first on,
+// whatever the enumeration order.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "clutil.h"
+
+#define RANK_MAGIC      "clc-rank 1"
+
+#define RANK_BYTES      (32 << 20)  // transfer and copy size, less on small devices
+#define RANK_REPS       3           // timed runs per rate, the best one is kept
+#define RANK_ITEMS      (256 << 10) // flops kernel work items
+#define RANK_LOOP       128         // flops kernel iterations, 32 flops each
+#define RANK_FLOPS      (RANK_LOOP * 32)
+#define RANK_LAUNCHES   32          // empty kernel launches
+
+static const char *rankNames[] = {"bandwidth", "compute", "latency"};
+
+static const char *kernel_rank =
+    "__kernel void rankCopy(__global const float4 *a, __global float4 *b)\n"
+    "{\n"
+    "    size_t i = get_global_id(0);\n"
+    "    b[i] = a[i];\n"
+    "}\n"
+    "\n"
+    "// four independent float4 chains, converging to c / (1 - k)\n"
+    "__kernel void rankFlops(__global float *out, float k, float c)\n"
+    "{\n"
+    "    float4 x0 = (float4)(get_global_id(0) & 255);\n"
+    "    float4 x1 = x0 + 1.0f, x2 = x0 + 2.0f, x3 = x0 + 3.0f;\n"
+    "    for (int i = 0; i < RANK_LOOP; i++)\n"
+    "    {\n"
+    "        x0 = mad(x0, k, c);\n"
+    "        x1 = mad(x1, k, c);\n"
+    "        x2 = mad(x2, k, c);\n"
+    "        x3 = mad(x3, k, c);\n"
+    "    }\n"
+    "    x0 += x1 + x2 + x3;\n"
+    "    out[get_global_id(0)] = x0.x + x0.y + x0.z + x0.w;\n"
+    "}\n"
+    "\n"
+    "__kernel void rankEmpty(void) {}\n";
+
+struct calibration
+{
+    cl_context ctx;
+    cl_command_queue queue;
+    cl_program prog;
+    cl_kernel copy;
+    cl_kernel flops;
+    cl_kernel empty;
+    cl_mem buf[2];
+    void *host;
+    size_t bytes;
+};
+
+void setLastCLError(char *fmt, ...);
+
+static double wallTime()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+const char *getRankName(int kind)
+{
+    return kind >= RANK_BANDWIDTH && kind <= RANK_LATENCY ? rankNames[kind] : "?";
+}
+
+// 0 for a device that could not be calibrated
+double getRankScore(struct device *d, int kind)
+{
+    if (d->calibrated <= 0)
+    {
+        return 0;
+    }
+
+    switch (kind)
+    {
+    case RANK_BANDWIDTH:
+        return d->transferRate > 0 && d->memoryRate > 0 ? 1.0 / (1.0 / d->transferRate + 1.0 / d->memoryRate) : 0;
+
+    case RANK_COMPUTE:
+        return d->flopRate;
+
+    case RANK_LATENCY:
+        return d->launchTime > 0 ? 1.0 / d->launchTime : 0;
+    }
+
+    return 0;
+}
+
+static int loadRank(struct device *d, const char *path)
+{
+    char line[1024], value[1024];
+    FILE *f;
+    int ok, n;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+        return 0;
+    }
+
+    ok = 0;
+    n = 0;
+
+    if (fgets(line, sizeof(line), f) == NULL || strcmp(line, RANK_MAGIC "\n") != 0)
+    {
+        goto error;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "transfer %lf", &d->transferRate) == 1 || sscanf(line, "memory %lf", &d->memoryRate) == 1 ||
+            sscanf(line, "flops %lf", &d->flopRate) == 1 || sscanf(line, "launch %lf", &d->launchTime) == 1)
+        {
+            n += 1;
+            continue;
+        }
+
+        // the identity, as in the device entry
+        line[strcspn(line, "\n")] = 0;
+        if (sscanf(line, "%*s %1023[^\n]", value) != 1 ||
+            (strncmp(line, "name ", 5) == 0 && strcmp(value, d->name) != 0) ||
+            (strncmp(line, "driver ", 7) == 0 && strcmp(value, d->driver) != 0) ||
+            (strncmp(line, "platform ", 9) == 0 && strcmp(value, d->platformVersion) != 0))
+        {
+            goto error;
+        }
+    }
+
+    ok = n == 4;
+
+error:
+    fclose(f);
+    return ok;
+}
+
+// written aside then renamed, as the device entries
+static void storeRank(struct device *d, const char *path)
+{
+    static unsigned int seq;
+    char *tmp;
+    FILE *f;
+
+    tmp = (char *)malloc(strlen(path) + 32);
+    if (tmp == NULL)
+    {
+        return;
+    }
+
+    sprintf(tmp, "%s.%d.%u", path, (int)getpid(), __sync_fetch_and_add(&seq, 1u));
+
+    f = fopen(tmp, "w");
+    if (f == NULL)
+    {
+        free(tmp);
+        return;
+    }
+
+    fprintf(f, RANK_MAGIC "\n");
+    fprintf(f, "name %s\ndriver %s\nplatform %s\n", d->name, d->driver, d->platformVersion);
+    fprintf(f, "transfer %.6g\nmemory %.6g\nflops %.6g\nlaunch %.6g\n", d->transferRate, d->memoryRate,
+            d->flopRate, d->launchTime);
+
+    if (fclose(f) != 0 || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+    }
+
+    free(tmp);
+}
+
+static void releaseCalibration(struct calibration *c)
+{
+    int i;
+
+    for (i = 0; i < 2; i += 1)
+    {
+        if (c->buf[i] != NULL)
+        {
+            clReleaseMemObject(c->buf[i]);
+        }
+    }
+
+    if (c->copy != NULL)
+    {
+        clReleaseKernel(c->copy);
+    }
+
+    if (c->flops != NULL)
+    {
+        clReleaseKernel(c->flops);
+    }
+
+    if (c->empty != NULL)
+    {
+        clReleaseKernel(c->empty);
+    }
+
+    if (c->prog != NULL)
+    {
+        clReleaseProgram(c->prog);
+    }
+
+    if (c->queue != NULL)
+    {
+        clReleaseCommandQueue(c->queue);
+    }
+
+    if (c->ctx != NULL)
+    {
+        clReleaseContext(c->ctx);
+    }
+
+    free(c->host);
+}
+
+static int setupCalibration(struct calibration *c, struct device *d)
+{
+    char options[32];
+    cl_int err;
+    int cached, i;
+
+    c->bytes = RANK_BYTES;
+    while (c->bytes > 4096 && (c->bytes > d->maxAlloc || 2 * c->bytes > d->globalMem / 4))
+    {
+        c->bytes /= 2;
+    }
+
+    c->host = malloc(c->bytes);
+    if (c->host == NULL)
+    {
+        setLastCLError("Could not allocate memory [calibration]\n");
+        return 0;
+    }
+    memset(c->host, 0, c->bytes);
+
+    c->ctx = clCreateContext(NULL, 1, &d->device, NULL, NULL, &err);
+    if (c->ctx == NULL)
+    {
+        setLastCLError("clCreateContext failed with %d\n", err);
+        return 0;
+    }
+
+    c->queue = clCreateCommandQueue(c->ctx, d->device, 0, &err);
+    if (c->queue == NULL)
+    {
+        setLastCLError("clCreateCommandQueue failed with %d\n", err);
+        return 0;
+    }
+
+    sprintf(options, "-DRANK_LOOP=%d", RANK_LOOP);
+    c->prog = buildCLProgram(c->ctx, d, kernel_rank, options, &cached);
+    if (c->prog == NULL)
+    {
+        return 0;
+    }
+
+    c->copy = clCreateKernel(c->prog, "rankCopy", &err);
+    if (c->copy != NULL)
+    {
+        c->flops = clCreateKernel(c->prog, "rankFlops", &err);
+    }
+    if (c->flops != NULL)
+    {
+        c->empty = clCreateKernel(c->prog, "rankEmpty", &err);
+    }
+    if (c->empty == NULL)
+    {
+        setLastCLError("clCreateKernel(rank) failed with %d\n", err);
+        return 0;
+    }
+
+    for (i = 0; i < 2; i += 1)
+    {
+        c->buf[i] = clCreateBuffer(c->ctx, CL_MEM_READ_WRITE, c->bytes, NULL, &err);
+        if (c->buf[i] == NULL)
+        {
+            setLastCLError("clCreateBuffer(rank, %lu) failed with %d\n", (unsigned long)c->bytes, err);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// best of RANK_REPS runs of kern after a warmup one, in seconds, < 0 on
+// error; kern NULL: an upload and a download
+static double bestRun(struct calibration *c, cl_kernel kern, size_t global)
+{
+    double t, best, start;
+    cl_int err;
+    int r;
+
+    best = 0;
+    for (r = 0; r <= RANK_REPS; r += 1)
+    {
+        start = wallTime();
+
+        if (kern == NULL)
+        {
+            err = clEnqueueWriteBuffer(c->queue, c->buf[0], CL_TRUE, 0, c->bytes, c->host, 0, NULL, NULL);
+            err |= clEnqueueReadBuffer(c->queue, c->buf[0], CL_TRUE, 0, c->bytes, c->host, 0, NULL, NULL);
+        }
+        else
+        {
+            err = clEnqueueNDRangeKernel(c->queue, kern, 1, NULL, &global, NULL, 0, NULL, NULL);
+            err |= clFinish(c->queue);
+        }
+
+        if (err != CL_SUCCESS)
+        {
+            setLastCLError("Calibration run failed with %d\n", err);
+            return -1;
+        }
+
+        t = wallTime() - start;
+        if (r > 0 && (best == 0 || t < best))
+        {
+            best = t;
+        }
+    }
+
+    return best;
+}
+
+// median enqueue + clFinish of an empty kernel, < 0 on error
+static double launchTime(struct calibration *c)
+{
+    double times[RANK_LAUNCHES];
+    struct stats s;
+    size_t global;
+    double start;
+    cl_int err;
+    int i;
+
+    global = 1;
+
+    // warmup: the first launch pays for lazy initialisation
+    err = clEnqueueNDRangeKernel(c->queue, c->empty, 1, NULL, &global, NULL, 0, NULL, NULL);
+    err |= clFinish(c->queue);
+
+    for (i = 0; i < RANK_LAUNCHES && err == CL_SUCCESS; i += 1)
+    {
+        start = wallTime();
+        err = clEnqueueNDRangeKernel(c->queue, c->empty, 1, NULL, &global, NULL, 0, NULL, NULL);
+        err |= clFinish(c->queue);
+        times[i] = wallTime() - start;
+    }
+
+    if (err != CL_SUCCESS)
+    {
+        setLastCLError("Calibration launch failed with %d\n", err);
+        return -1;
+    }
+
+    computeStats(times, RANK_LAUNCHES, &s);
+    return s.median;
+}
+
+static int measureRates(struct device *d)
+{
+    struct calibration c;
+    cl_float k, a;
+    size_t items;
+    cl_int err;
+    double t;
+    int ok;
+
+    memset(&c, 0, sizeof(c));
+    ok = 0;
+
+    if (!setupCalibration(&c, d))
+    {
+        goto error;
+    }
+
+    t = bestRun(&c, NULL, 0);
+    if (t <= 0)
+    {
+        goto error;
+    }
+    d->transferRate = 2.0 * c.bytes / t / 1e9;
+
+    err = clSetKernelArg(c.copy, 0, sizeof(cl_mem), &c.buf[0]);
+    err |= clSetKernelArg(c.copy, 1, sizeof(cl_mem), &c.buf[1]);
+
+    k = 0.5f;
+    a = 1.0f;
+    err |= clSetKernelArg(c.flops, 0, sizeof(cl_mem), &c.buf[1]);
+    err |= clSetKernelArg(c.flops, 1, sizeof(cl_float), &k);
+    err |= clSetKernelArg(c.flops, 2, sizeof(cl_float), &a);
+    if (err != CL_SUCCESS)
+    {
+        setLastCLError("clSetKernelArg(rank) failed with %d\n", err);
+        goto error;
+    }
+
+    // read + write bytes
+    t = bestRun(&c, c.copy, c.bytes / (4 * sizeof(cl_float)));
+    if (t <= 0)
+    {
+        goto error;
+    }
+    d->memoryRate = 2.0 * c.bytes / t / 1e9;
+
+    // one float out per item
+    items = c.bytes / sizeof(cl_float) < RANK_ITEMS ? c.bytes / sizeof(cl_float) : RANK_ITEMS;
+    t = bestRun(&c, c.flops, items);
+    if (t <= 0)
+    {
+        goto error;
+    }
+    d->flopRate = (double)RANK_FLOPS * items / t / 1e9;
+
+    t = launchTime(&c);
+    if (t <= 0)
+    {
+        goto error;
+    }
+    d->launchTime = t;
+
+    ok = 1;
+
+error:
+    releaseCalibration(&c);
+    return ok;
+}
+
+// Fills the rates of d, from the cache or a calibration run. Returns 0
+// (and d ranks last) when the device cannot run it.
+int calibrateCLDevice(struct device *d)
+{
+    char *path;
+
+    if (d->calibrated != 0)
+    {
+        return d->calibrated > 0;
+    }
+
+    path = getCLDevicePath(d, "rank");
+    if (path != NULL && loadRank(d, path))
+    {
+        d->calibrated = 2;
+        free(path);
+        return 1;
+    }
+
+    d->calibrated = measureRates(d) ? 1 : -1;
+
+    if (d->calibrated > 0 && path != NULL)
+    {
+        storeRank(d, path);
+    }
+
+    if (d->calibrated < 0)
+    {
+        d->transferRate = 0;
+        d->memoryRate = 0;
+        d->flopRate = 0;
+        d->launchTime = 0;
+    }
+
+    free(path);
+    return d->calibrated > 0;
+}
+
+// All the devices, best first for kind; equal scores keep the
+// enumeration order. The devices are calibrated one at a time, so that
+// they do not share the host while measured. The array is malloc'ed.
+struct device **rankCLDevices(struct device *devices, int kind, int *count)
+{
+    struct device **ranked, *d;
+    int n, i, j;
+
+    n = 0;
+    for (d = devices; d != NULL; d = d->next)
+    {
+        n += 1;
+    }
+
+    ranked = (struct device **)malloc((n > 0 ? n : 1) * sizeof(*ranked));
+    if (ranked == NULL)
+    {
+        setLastCLError("Could not allocate memory [ranking]\n");
+        return NULL;
+    }
+
+    for (d = devices, i = 0; d != NULL; d = d->next, i += 1)
+    {
+        calibrateCLDevice(d);
+
+        // insertion, after the equal scores
+        for (j = i; j > 0 && getRankScore(ranked[j - 1], kind) < getRankScore(d, kind); j -= 1)
+        {
+            ranked[j] = ranked[j - 1];
+        }
+        ranked[j] = d;
+    }
+
+    *count = n;
+    return ranked;
+}
+
+// NULL when no device could be calibrated
+struct device *bestCLDevice(struct device *devices, int kind)
+{
+    struct device **ranked, *best;
+    int n;
+
+    ranked = rankCLDevices(devices, kind, &n);
+    if (ranked == NULL)
+    {
+        return NULL;
+    }
+
+    best = n > 0 && getRankScore(ranked[0], kind) > 0 ? ranked[0] : NULL;
+    if (best == NULL)
+    {
+        setLastCLError("No device could be calibrated\n");
+    }
+
+    free(ranked);
+    return best;
+}
@@ -0,0 +1,317 @@
+// clrt.c
+//
+// Long-lived runtime for one device: a context and an in-order queue,
+// the programs built on them, a table of their kernels keyed by name and
+// named buffers that are only reallocated when they have to grow.
+//
+// Setting up a context, building a program and allocating buffers costs
+// milliseconds; once they are kept here, running a kernel again only
+// costs the enqueues. Device only buffers come from a clpool, so that
+// growing one does not go back to the driver either.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clutil.h"
+
+#define MAX_KERNELS 64
+
+struct rtProgram
+{
+    struct rtProgram *next;
+    cl_program prog;
+};
+
+struct rtKernel
+{
+    struct rtKernel *next;
+    char *name;
+    cl_kernel kern;
+};
+
+struct rtBuffer
+{
+    struct rtBuffer *next;
+    char *name;
+    cl_mem mem;
+    size_t size;
+    cl_mem_flags flags;
+    int pooled;
+};
+
+void setLastCLError(char *fmt, ...);
+
+static void releaseBuffer(struct clrt *rt, struct rtBuffer *b)
+{
+    if (b->pooled)
+    {
+        poolFree(rt->pool, b->mem);
+    }
+    else
+    {
+        clReleaseMemObject(b->mem);
+    }
+}
+
+struct clrt *createCLRuntime(struct device *d, cl_command_queue_properties props)
+{
+    struct clrt *rt;
+    cl_int err;
+
+    rt = (struct clrt *)calloc(1, sizeof(*rt));
+    if (rt == NULL)
+    {
+        setLastCLError("Could not allocate memory [runtime]\n");
+        return NULL;
+    }
+
+    rt->d = d;
+
+    rt->ctx = clCreateContext(NULL, 1, &d->device, NULL, NULL, &err);
+    if (rt->ctx == NULL)
+    {
+        setLastCLError("clCreateContext failed with %d\n", err);
+        free(rt);
+        return NULL;
+    }
+
+    rt->queue = clCreateCommandQueue(rt->ctx, d->device, props, &err);
+    if (rt->queue == NULL)
+    {
+        setLastCLError("clCreateCommandQueue failed with %d\n", err);
+        clReleaseContext(rt->ctx);
+        free(rt);
+        return NULL;
+    }
+
+    rt->pool = createCLPool(rt->ctx, d, 0, 0);
+    if (rt->pool == NULL)
+    {
+        clReleaseCommandQueue(rt->queue);
+        clReleaseContext(rt->ctx);
+        free(rt);
+        return NULL;
+    }
+
+    return rt;
+}
+
+void freeCLRuntime(struct clrt *rt)
+{
+    struct rtProgram *p, *np;
+    struct rtKernel *k, *nk;
+    struct rtBuffer *b, *nb;
+
+    if (rt == NULL)
+    {
+        return;
+    }
+
+    clFinish(rt->queue);
+
+    for (b = rt->buffers; b != NULL; b = nb)
+    {
+        nb = b->next;
+        releaseBuffer(rt, b);
+        free(b->name);
+        free(b);
+    }
+
+    freeCLPool(rt->pool);
+
+    for (k = rt->kernels; k != NULL; k = nk)
+    {
+        nk = k->next;
+        clReleaseKernel(k->kern);
+        free(k->name);
+        free(k);
+    }
+
+    for (p = rt->programs; p != NULL; p = np)
+    {
+        np = p->next;
+        clReleaseProgram(p->prog);
+        free(p);
+    }
+
+    clReleaseCommandQueue(rt->queue);
+    clReleaseContext(rt->ctx);
+    free(rt);
+}
+
+// Build src (through the binary cache) and add all of its kernels to the
+// table. A kernel name already in the table is shadowed by the new one.
+int addCLProgram(struct clrt *rt, const char *src, const char *options)
+{
+    cl_kernel kerns[MAX_KERNELS];
+    struct rtProgram *p;
+    struct rtKernel *k;
+    cl_uint i, n;
+    cl_int err;
+    size_t len;
+    int cached;
+
+    p = (struct rtProgram *)calloc(1, sizeof(*p));
+    if (p == NULL)
+    {
+        setLastCLError("Could not allocate memory [program]\n");
+        return 0;
+    }
+
+    p->prog = buildCLProgram(rt->ctx, rt->d, src, options, &cached);
+    if (p->prog == NULL)
+    {
+        free(p);
+        return 0;
+    }
+
+    p->next = rt->programs;
+    rt->programs = p;
+
+    err = clCreateKernelsInProgram(p->prog, MAX_KERNELS, kerns, &n);
+    if (err != CL_SUCCESS)
+    {
+        setLastCLError("clCreateKernelsInProgram failed with %d\n", err);
+        return 0;
+    }
+
+    for (i = 0; i < n; i += 1)
+    {
+        len = 0;
+        k = (struct rtKernel *)calloc(1, sizeof(*k));
+        if (k != NULL)
+        {
+            err = clGetKernelInfo(kerns[i], CL_KERNEL_FUNCTION_NAME, 0, NULL, &len);
+            k->name = err == CL_SUCCESS ? (char *)malloc(len) : NULL;
+        }
+
+        if (k == NULL || k->name == NULL ||
+            clGetKernelInfo(kerns[i], CL_KERNEL_FUNCTION_NAME, len, k->name, NULL) != CL_SUCCESS)
+        {
+            setLastCLError("Could not add kernel %u to the table\n", i);
+            if (k != NULL)
+            {
+                free(k->name);
+                free(k);
+            }
+
+            for (; i < n; i += 1)
+            {
+                clReleaseKernel(kerns[i]);
+            }
+            return 0;
+        }
+
+        k->kern = kerns[i];
+        k->next = rt->kernels;
+        rt->kernels = k;
+    }
+
+    return 1;
+}
+
+cl_kernel getCLKernel(struct clrt *rt, const char *name)
+{
+    struct rtKernel *k;
+
+    for (k = rt->kernels; k != NULL; k = k->next)
+    {
+        if (strcmp(k->name, name) == 0)
+        {
+            return k->kern;
+        }
+    }
+
+    setLastCLError("Unknown kernel %s\n", name);
+    return NULL;
+}
+
+// Buffer called name, at least size bytes. The previous one is returned
+// as long as it is large enough and has the same flags; *fresh (if not
+// NULL) is set when a new buffer was allocated and kernel arguments
+// pointing to the old one have to be set again.
+cl_mem getCLBuffer(struct clrt *rt, const char *name, size_t size, cl_mem_flags flags, int *fresh)
+{
+    struct rtBuffer *b;
+    cl_mem mem;
+    cl_int err;
+    int pooled;
+
+    if (fresh != NULL)
+    {
+        *fresh = 0;
+    }
+
+    for (b = rt->buffers; b != NULL; b = b->next)
+    {
+        if (strcmp(b->name, name) == 0)
+        {
+            break;
+        }
+    }
+
+    if (b != NULL && b->size >= size && b->flags == flags)
+    {
+        return b->mem;
+    }
+
+    // pool blocks are read-write: the access flags are only a hint
+    pooled = (flags & (CL_MEM_USE_HOST_PTR | CL_MEM_ALLOC_HOST_PTR | CL_MEM_COPY_HOST_PTR)) == 0;
+    if (pooled)
+    {
+        mem = poolAlloc(rt->pool, size);
+        if (mem == NULL)
+        {
+            return NULL;
+        }
+    }
+    else
+    {
+        mem = clCreateBuffer(rt->ctx, flags, size, NULL, &err);
+        if (mem == NULL)
+        {
+            setLastCLError("clCreateBuffer(%s, %lu) failed with %d\n", name, (unsigned long)size, err);
+            return NULL;
+        }
+    }
+
+    if (b == NULL)
+    {
+        b = (struct rtBuffer *)calloc(1, sizeof(*b));
+        if (b == NULL || (b->name = strdup(name)) == NULL)
+        {
+            setLastCLError("Could not allocate memory [buffer %s]\n", name);
+            if (pooled)
+            {
+                poolFree(rt->pool, mem);
+            }
+            else
+            {
+                clReleaseMemObject(mem);
+            }
+            free(b);
+            return NULL;
+        }
+
+        b->next = rt->buffers;
+        rt->buffers = b;
+    }
+    else
+    {
+        // the queue is in order: commands still using the old buffer run
+        // before anything enqueued on its reuse
+        releaseBuffer(rt, b);
+    }
+
+    b->mem = mem;
+    b->pooled = pooled;
+    b->size = size;
+    b->flags = flags;
+
+    if (fresh != NULL)
+    {
+        *fresh = 1;
+    }
+
+    return mem;
+}
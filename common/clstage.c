@@ -0,0 +1,239 @@
+// clstage.c
+//
+// Pinned staging buffers for transfers from and to pageable memory.
+//
+// Given a malloc'ed pointer, most drivers copy it into a pinned bounce
+// buffer of their own before the DMA, one piece at a time, and the
+// transfer runs well below the link speed. Here the bounce buffers are
+// ours: count CL_MEM_ALLOC_HOST_PTR buffers of chunk bytes, mapped once
+// and kept mapped, used as the host side of clEnqueueWriteBuffer /
+// clEnqueueReadBuffer. A transfer is cut in chunks rotating through
+// them, so that the memcpy of one chunk overlaps the DMA of the others.
+//
+// A stage belongs to one in-order queue and is not locked: one thread at
+// a time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clutil.h"
+
+struct stageSlot
+{
+    cl_mem mem;
+    void *ptr;              // mapped for the life of the stage
+    cl_event evt;           // last transfer from or to ptr
+};
+
+struct clstage
+{
+    cl_command_queue queue;
+    size_t chunk;
+    int count;
+    int next;               // slot of the next write chunk
+    struct stageSlot *slots;
+};
+
+void setLastCLError(char *fmt, ...);
+
+struct clstage *createCLStage(cl_context ctx, cl_command_queue queue, size_t chunk, int count)
+{
+    struct stageSlot *sl;
+    struct clstage *s;
+    cl_int err;
+    int i;
+
+    s = (struct clstage *)calloc(1, sizeof(*s));
+    if (s != NULL)
+    {
+        s->slots = (struct stageSlot *)calloc(count, sizeof(*s->slots));
+    }
+
+    if (s == NULL || s->slots == NULL)
+    {
+        setLastCLError("Could not allocate memory [stage]\n");
+        free(s);
+        return NULL;
+    }
+
+    s->queue = queue;
+    s->chunk = chunk;
+    s->count = count;
+    clRetainCommandQueue(queue);
+
+    for (i = 0; i < count; i += 1)
+    {
+        sl = &s->slots[i];
+
+        sl->mem = clCreateBuffer(ctx, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, chunk, NULL, &err);
+        if (sl->mem == NULL)
+        {
+            setLastCLError("clCreateBuffer(stage %d, %lu) failed with %d\n", i, (unsigned long)chunk, err);
+            freeCLStage(s);
+            return NULL;
+        }
+
+        sl->ptr = clEnqueueMapBuffer(queue, sl->mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, chunk, 0, NULL, NULL,
+                                     &err);
+        if (sl->ptr == NULL)
+        {
+            setLastCLError("clEnqueueMapBuffer(stage %d) failed with %d\n", i, err);
+            freeCLStage(s);
+            return NULL;
+        }
+    }
+
+    return s;
+}
+
+// Slot free for the host: its last transfer is done
+static int waitSlot(struct stageSlot *sl)
+{
+    cl_int err;
+
+    if (sl->evt == NULL)
+    {
+        return 1;
+    }
+
+    err = clWaitForEvents(1, &sl->evt);
+    clReleaseEvent(sl->evt);
+    sl->evt = NULL;
+
+    if (err != CL_SUCCESS)
+    {
+        setLastCLError("Staged transfer failed with %d\n", err);
+        return 0;
+    }
+
+    return 1;
+}
+
+void freeCLStage(struct clstage *s)
+{
+    struct stageSlot *sl;
+    int i;
+
+    if (s == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < s->count; i += 1)
+    {
+        sl = &s->slots[i];
+        waitSlot(sl);
+
+        if (sl->ptr != NULL)
+        {
+            clEnqueueUnmapMemObject(s->queue, sl->mem, sl->ptr, 0, NULL, NULL);
+        }
+    }
+
+    clFinish(s->queue);
+
+    for (i = 0; i < s->count; i += 1)
+    {
+        if (s->slots[i].mem != NULL)
+        {
+            clReleaseMemObject(s->slots[i].mem);
+        }
+    }
+
+    clReleaseCommandQueue(s->queue);
+    free(s->slots);
+    free(s);
+}
+
+// size bytes from src to dst at offset. Returns once src has been copied
+// to the stage: src can be reused at once, the last chunks may still be
+// on their way to the device (commands enqueued after this one on the
+// queue run after them).
+int stageWrite(struct clstage *s, cl_mem dst, size_t offset, const void *src, size_t size)
+{
+    struct stageSlot *sl;
+    size_t done, len;
+    cl_int err;
+
+    for (done = 0; done < size; done += len)
+    {
+        sl = &s->slots[s->next];
+        s->next = (s->next + 1) % s->count;
+
+        len = size - done < s->chunk ? size - done : s->chunk;
+
+        if (!waitSlot(sl))
+        {
+            return 0;
+        }
+
+        memcpy(sl->ptr, (const char *)src + done, len);
+
+        err = clEnqueueWriteBuffer(s->queue, dst, CL_FALSE, offset + done, len, sl->ptr, 0, NULL, &sl->evt);
+        if (err != CL_SUCCESS)
+        {
+            setLastCLError("clEnqueueWriteBuffer(stage, %lu) failed with %d\n", (unsigned long)len, err);
+            return 0;
+        }
+
+        // start the DMA while the next chunk is copied
+        clFlush(s->queue);
+    }
+
+    return 1;
+}
+
+// size bytes from src at offset to dst, blocking: the reads of up to
+// count chunks are in flight while the previous one is copied out.
+int stageRead(struct clstage *s, cl_mem src, size_t offset, void *dst, size_t size)
+{
+    struct stageSlot *sl;
+    size_t n, i, issued, len;
+    cl_int err;
+    int j;
+
+    // pending writes keep their slots busy
+    for (j = 0; j < s->count; j += 1)
+    {
+        if (!waitSlot(&s->slots[j]))
+        {
+            return 0;
+        }
+    }
+
+    s->next = 0;
+    n = (size + s->chunk - 1) / s->chunk;
+    issued = 0;
+
+    for (i = 0; i < n; i += 1)
+    {
+        // chunk i + count reuses the slot of chunk i, copied out below
+        for (; issued < n && issued < i + s->count; issued += 1)
+        {
+            sl = &s->slots[issued % s->count];
+            len = size - issued * s->chunk < s->chunk ? size - issued * s->chunk : s->chunk;
+
+            err = clEnqueueReadBuffer(s->queue, src, CL_FALSE, offset + issued * s->chunk, len, sl->ptr, 0, NULL,
+                                      &sl->evt);
+            if (err != CL_SUCCESS)
+            {
+                setLastCLError("clEnqueueReadBuffer(stage, %lu) failed with %d\n", (unsigned long)len, err);
+                return 0;
+            }
+        }
+
+        clFlush(s->queue);
+
+        sl = &s->slots[i % s->count];
+        len = size - i * s->chunk < s->chunk ? size - i * s->chunk : s->chunk;
+
+        if (!waitSlot(sl))
+        {
+            return 0;
+        }
+
+        memcpy((char *)dst + i * s->chunk, sl->ptr, len);
+    }
+
+    return 1;
+}
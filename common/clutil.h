@@ -2,6 +2,7 @@
 // and replaced with clCreateCommandQueueWithProperties.
 
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
+#include <stdio.h>
 #include <CL/cl.h>
 
 struct device
@@ -13,11 +14,223 @@ struct device
     cl_device_id device;
     cl_device_type type;
     char *name;
+
+    // identity: the cached attributes below are only reused when the
+    // three match
+    char *driver;           // CL_DRIVER_VERSION
+    char *platformVersion;  // CL_PLATFORM_VERSION
+
+    char *vendor;
+    char *version;          // CL_DEVICE_VERSION
+    char *extensions;
+    cl_uint computeUnits;
+    cl_uint clock;          // MHz
+    cl_ulong globalMem;
+    cl_ulong localMem;
+    cl_ulong constMem;
+    cl_ulong maxAlloc;
+    size_t maxWorkGroup;
+    cl_uint vecWidth[7];    // preferred vector width: char, short, int, long, float, double, half
+    cl_uint baseAlign;      // CL_DEVICE_MEM_BASE_ADDR_ALIGN, in bits
+    cl_bool unified;        // CL_DEVICE_HOST_UNIFIED_MEMORY
+    cl_device_svm_capabilities svm;     // 0 below OpenCL 2.0
+    int fp16;
+    int fp64;
+    int cached;             // attributes read from the cache
+
+    // measured by calibrateCLDevice (clrank.c), 0 until then
+    double transferRate;    // GB/s, host to device and back
+    double memoryRate;      // GB/s, device to device copy kernel
+    double flopRate;        // GFLOP/s, fp32 mad
+    double launchTime;      // seconds, enqueue to completion of an empty kernel
+    int calibrated;         // 1: measured, 2: read from the cache, -1: failed
 };
 
 // clerror.c
 char *getLastCLError();
 
 // clenum.c
+#define VEC_CHAR    0
+#define VEC_SHORT   1
+#define VEC_INT     2
+#define VEC_LONG    3
+#define VEC_FLOAT   4
+#define VEC_DOUBLE  5
+#define VEC_HALF    6
+
 void freeCLDevices(struct device *d);
 struct device *enumCLDevices();
+int hasCLExtension(struct device *d, const char *name);
+char *getCLDevicePath(struct device *d, const char *prefix);
+
+// clcache.c
+cl_program buildCLProgram(cl_context ctx, struct device *d, const char *src, const char *options, int *cached);
+
+// threads.c
+#define SIMD_SCALAR 0
+#define SIMD_SSE    1
+#define SIMD_AVX2   2
+#define SIMD_AVX512 3
+
+struct threadPool;
+
+struct threadPool *createThreadPool(int count);
+void freeThreadPool(struct threadPool *p);
+int getThreadCount(struct threadPool *p);
+void runThreadPool(struct threadPool *p, void (*fn)(void *arg, int index, int count), void *arg);
+void splitRange(size_t n, size_t align, int index, int count, size_t *begin, size_t *end);
+int getSimdLevel();
+const char *getSimdName(int level);
+
+// random.c
+extern const char *philoxCLSource;
+
+void philox4x32(const cl_uint ctr[4], const cl_uint key[2], cl_uint out[4]);
+float uniformAt(cl_uint seed, cl_uint stream, size_t i);
+void fillUniform(struct threadPool *pool, float *p, size_t n, cl_uint seed, cl_uint stream);
+
+// verify.c
+cl_uint ulpDistance(float a, float b);
+size_t compareFloats(struct threadPool *pool, const float *x, const float *ref, size_t n, cl_uint ulp, size_t *first);
+
+// clprof.c
+#define PROF_WRITE  0
+#define PROF_READ   1
+#define PROF_KERNEL 2
+#define PROF_MAP    3
+#define PROF_UNMAP  4
+#define PROF_COPY   5
+#define PROF_FILL   6
+
+struct clprof;
+
+struct clprof *createCLProf();
+void freeCLProf(struct clprof *p);
+cl_event *profEvent(struct clprof *p, const char *track, const char *label, int kind, size_t bytes, double flops);
+void profAddEvent(struct clprof *p, cl_event evt, const char *track, const char *label, int kind,
+                  size_t bytes, double flops);
+int collectCLProf(struct clprof *p);
+int writeCLProfTrace(struct clprof *p, const char *path);
+void printCLProfSummary(struct clprof *p, FILE *f);
+
+// stats.c
+struct stats
+{
+    int count;
+    double min;
+    double max;
+    double median;
+    double p95;
+    double mean;
+    double stddev;
+};
+
+void computeStats(double *v, int n, struct stats *s);
+
+// clpool.c
+struct clpool;
+
+struct clpoolStats
+{
+    size_t reserved;        // arena bytes on the device
+    size_t inuse;           // bytes of the blocks handed out
+    size_t requested;       // bytes asked for by these blocks
+    size_t cached;          // bytes of the blocks on free lists
+    size_t highWater;       // highest inuse
+    unsigned long allocs;
+    unsigned long hits;     // allocations served from a free list
+    int arenas;
+};
+
+struct clpool *createCLPool(cl_context ctx, struct device *d, size_t arena, size_t limit);
+void freeCLPool(struct clpool *p);
+cl_mem poolAlloc(struct clpool *p, size_t size);
+void poolFree(struct clpool *p, cl_mem mem);
+void getCLPoolStats(struct clpool *p, struct clpoolStats *s);
+void printCLPoolStats(struct clpool *p, FILE *f);
+
+// clrt.c
+struct rtProgram;
+struct rtKernel;
+struct rtBuffer;
+
+struct clrt
+{
+    struct device *d;
+    cl_context ctx;
+    cl_command_queue queue;
+    struct clpool *pool;
+
+    struct rtProgram *programs;
+    struct rtKernel *kernels;
+    struct rtBuffer *buffers;
+};
+
+struct clrt *createCLRuntime(struct device *d, cl_command_queue_properties props);
+void freeCLRuntime(struct clrt *rt);
+int addCLProgram(struct clrt *rt, const char *src, const char *options);
+cl_kernel getCLKernel(struct clrt *rt, const char *name);
+cl_mem getCLBuffer(struct clrt *rt, const char *name, size_t size, cl_mem_flags flags, int *fresh);
+
+// clexpr.c
+#define EXPR_INPUT  0
+#define EXPR_CONST  1
+#define EXPR_ADD    2
+#define EXPR_SUB    3
+#define EXPR_MUL    4
+#define EXPR_DIV    5
+#define EXPR_MIN    6
+#define EXPR_MAX    7
+#define EXPR_NEG    8
+#define EXPR_ABS    9
+#define EXPR_SQRT   10
+
+struct exprGraph;
+struct exprNode;
+
+struct exprGraph *createExprGraph();
+void freeExprGraph(struct exprGraph *g);
+struct exprNode *exprInput(struct exprGraph *g, int index);
+struct exprNode *exprConst(struct exprGraph *g, float value);
+struct exprNode *exprOp(struct exprGraph *g, int op, struct exprNode *a, struct exprNode *b);
+int evalExpr(struct clrt *rt, struct exprGraph *g, struct exprNode **outs, int nouts,
+             cl_mem *inputs, cl_mem *outputs, size_t n, cl_event *evt);
+
+// cljob.c
+struct cljobs;
+
+struct cljob
+{
+    struct cljob *next;
+    struct cljobs *jobs;
+    cl_event evt;           // last command of the job
+    cl_int status;          // CL_COMPLETE, or the error the job ended with
+    void *arg;              // caller's
+};
+
+struct cljobs *createCLJobs();
+void freeCLJobs(struct cljobs *q);
+struct cljob *submitCLJob(struct cljobs *q, cl_command_queue queue, cl_event evt, void *arg);
+struct cljob *waitCLJob(struct cljobs *q);
+struct cljob *pollCLJob(struct cljobs *q);
+int pendingCLJobs(struct cljobs *q);
+void freeCLJob(struct cljob *j);
+
+// clstage.c
+struct clstage;
+
+struct clstage *createCLStage(cl_context ctx, cl_command_queue queue, size_t chunk, int count);
+void freeCLStage(struct clstage *s);
+int stageWrite(struct clstage *s, cl_mem dst, size_t offset, const void *src, size_t size);
+int stageRead(struct clstage *s, cl_mem src, size_t offset, void *dst, size_t size);
+
+// clrank.c
+#define RANK_BANDWIDTH  0
+#define RANK_COMPUTE    1
+#define RANK_LATENCY    2
+
+int calibrateCLDevice(struct device *d);
+double getRankScore(struct device *d, int kind);
+const char *getRankName(int kind);
+struct device **rankCLDevices(struct device *devices, int kind, int *count);
+struct device *bestCLDevice(struct device *devices, int kind);
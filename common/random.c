@@ -0,0 +1,248 @@
+// random.c
+//
+// Counter-based random numbers (Philox4x32-10, Salmon et al., SC'11).
+//
+// Element i of stream s is a pure function of (seed, s, i): a buffer
+// comes out the same whatever the number of threads filling it, any
+// element can be regenerated on its own, and the OpenCL version below
+// produces the same bits on a device.
+//
+// Block j = i / 4 is the counter {j, j >> 32, stream, 0} under the key
+// {seed, 0}; its 4 output words give elements 4j .. 4j+3, as 24-bit
+// floats in [0, 1).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clutil.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define PHILOX_M0   0xD2511F53u
+#define PHILOX_M1   0xCD9E8D57u
+#define PHILOX_W0   0x9E3779B9u
+#define PHILOX_W1   0xBB67AE85u
+
+// Same generator as an OpenCL C prelude: philoxUniform(seed, stream, i)
+const char *philoxCLSource =
+    "#define PHILOX_M0 0xD2511F53u\n"
+    "#define PHILOX_M1 0xCD9E8D57u\n"
+    "#define PHILOX_W0 0x9E3779B9u\n"
+    "#define PHILOX_W1 0xBB67AE85u\n"
+    "uint4 philox4x32(uint4 c, uint2 k)"
+    "{"
+    "   for (int r = 0; r < 10; r += 1)"
+    "   {"
+    "       uint hi0 = mul_hi(PHILOX_M0, c.x), lo0 = PHILOX_M0 * c.x;"
+    "       uint hi1 = mul_hi(PHILOX_M1, c.z), lo1 = PHILOX_M1 * c.z;"
+    "       c = (uint4)(hi1 ^ c.y ^ k.x, lo1, hi0 ^ c.w ^ k.y, lo0);"
+    "       k += (uint2)(PHILOX_W0, PHILOX_W1);"
+    "   }"
+    "   return c;"
+    "}"
+    "float4 philoxUniform4(uint seed, uint stream, ulong block)"
+    "{"
+    "   uint4 r = philox4x32((uint4)((uint)block, (uint)(block >> 32), stream, 0), (uint2)(seed, 0));"
+    "   return convert_float4(r >> 8) * 0x1p-24f;"
+    "}\n";
+
+static void philoxRound(cl_uint c[4], cl_uint k[2])
+{
+    cl_ulong p0, p1;
+
+    p0 = (cl_ulong)PHILOX_M0 * c[0];
+    p1 = (cl_ulong)PHILOX_M1 * c[2];
+
+    c[0] = (cl_uint)(p1 >> 32) ^ c[1] ^ k[0];
+    c[1] = (cl_uint)p1;
+    c[2] = (cl_uint)(p0 >> 32) ^ c[3] ^ k[1];
+    c[3] = (cl_uint)p0;
+
+    k[0] += PHILOX_W0;
+    k[1] += PHILOX_W1;
+}
+
+void philox4x32(const cl_uint ctr[4], const cl_uint key[2], cl_uint out[4])
+{
+    cl_uint k[2];
+    int r;
+
+    memcpy(out, ctr, 4 * sizeof(cl_uint));
+    k[0] = key[0];
+    k[1] = key[1];
+
+    for (r = 0; r < 10; r += 1)
+    {
+        philoxRound(out, k);
+    }
+}
+
+static void uniformBlock(cl_uint seed, cl_uint stream, cl_ulong block, float out[4])
+{
+    cl_uint c[4], k[2], r[4];
+    int j;
+
+    c[0] = (cl_uint)block;
+    c[1] = (cl_uint)(block >> 32);
+    c[2] = stream;
+    c[3] = 0;
+    k[0] = seed;
+    k[1] = 0;
+
+    philox4x32(c, k, r);
+
+    for (j = 0; j < 4; j += 1)
+    {
+        out[j] = (float)(r[j] >> 8) * 0x1p-24f;
+    }
+}
+
+float uniformAt(cl_uint seed, cl_uint stream, size_t i)
+{
+    float v[4];
+
+    uniformBlock(seed, stream, (cl_ulong)(i / 4), v);
+    return v[i % 4];
+}
+
+static void uniformScalar(float *p, cl_uint seed, cl_uint stream, cl_ulong b, cl_ulong e)
+{
+    for (; b < e; b += 1)
+    {
+        uniformBlock(seed, stream, b, p + 4 * b);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// 8 blocks at a time, one per 32-bit lane
+__attribute__((target("avx2"))) static void mulhilo8(__m256i m, __m256i x, __m256i *hi, __m256i *lo)
+{
+    __m256i even, odd;
+
+    even = _mm256_mul_epu32(x, m);
+    odd = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), m);
+
+    *lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+    *hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+}
+
+__attribute__((target("avx2"))) static void uniformAVX2(float *p, cl_uint seed, cl_uint stream, cl_ulong b, cl_ulong e)
+{
+    __m256i c0, c1, c2, c3, hi0, lo0, hi1, lo1, m0, m1, k0, k1, t0, t1, t2, t3;
+    __m256 scale;
+    cl_uint lo[8], hi[8];
+    int r, j;
+
+    m0 = _mm256_set1_epi64x(PHILOX_M0);
+    m1 = _mm256_set1_epi64x(PHILOX_M1);
+    scale = _mm256_set1_ps(0x1p-24f);
+
+    for (; b + 8 <= e; b += 8)
+    {
+        for (j = 0; j < 8; j += 1)
+        {
+            lo[j] = (cl_uint)(b + j);
+            hi[j] = (cl_uint)((b + j) >> 32);
+        }
+
+        c0 = _mm256_loadu_si256((__m256i *)lo);
+        c1 = _mm256_loadu_si256((__m256i *)hi);
+        c2 = _mm256_set1_epi32((int)stream);
+        c3 = _mm256_setzero_si256();
+        k0 = _mm256_set1_epi32((int)seed);
+        k1 = _mm256_setzero_si256();
+
+        for (r = 0; r < 10; r += 1)
+        {
+            mulhilo8(m0, c0, &hi0, &lo0);
+            mulhilo8(m1, c2, &hi1, &lo1);
+
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), k0);
+            c1 = lo1;
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), k1);
+            c3 = lo0;
+
+            k0 = _mm256_add_epi32(k0, _mm256_set1_epi32((int)PHILOX_W0));
+            k1 = _mm256_add_epi32(k1, _mm256_set1_epi32((int)PHILOX_W1));
+        }
+
+        // lane j holds block b + j as (c0, c1, c2, c3): transpose so that
+        // each block's 4 words are contiguous
+        t0 = _mm256_unpacklo_epi32(c0, c1);     // 0.0 0.1 1.0 1.1 | 4.0 4.1 5.0 5.1
+        t1 = _mm256_unpackhi_epi32(c0, c1);     // 2.0 2.1 3.0 3.1 | 6.0 ...
+        t2 = _mm256_unpacklo_epi32(c2, c3);     // 0.2 0.3 1.2 1.3 | 4.2 ...
+        t3 = _mm256_unpackhi_epi32(c2, c3);
+
+        c0 = _mm256_unpacklo_epi64(t0, t2);     // block 0 | block 4
+        c1 = _mm256_unpackhi_epi64(t0, t2);     // block 1 | block 5
+        c2 = _mm256_unpacklo_epi64(t1, t3);     // block 2 | block 6
+        c3 = _mm256_unpackhi_epi64(t1, t3);     // block 3 | block 7
+
+        t0 = _mm256_permute2x128_si256(c0, c1, 0x20);   // blocks 0, 1
+        t1 = _mm256_permute2x128_si256(c2, c3, 0x20);   // blocks 2, 3
+        t2 = _mm256_permute2x128_si256(c0, c1, 0x31);   // blocks 4, 5
+        t3 = _mm256_permute2x128_si256(c2, c3, 0x31);   // blocks 6, 7
+
+        _mm256_storeu_ps(p + 4 * b, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(t0, 8)), scale));
+        _mm256_storeu_ps(p + 4 * b + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(t1, 8)), scale));
+        _mm256_storeu_ps(p + 4 * b + 16, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(t2, 8)), scale));
+        _mm256_storeu_ps(p + 4 * b + 24, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(t3, 8)), scale));
+    }
+
+    uniformScalar(p, seed, stream, b, e);
+}
+#endif
+
+struct fill
+{
+    float *p;
+    size_t n;
+    cl_uint seed;
+    cl_uint stream;
+};
+
+static void fillThread(void *arg, int index, int count)
+{
+    struct fill *f;
+    size_t begin, end;
+
+    f = (struct fill *)arg;
+
+    // whole blocks only, the partial last one is done by the caller
+    splitRange(f->n / 4, 16, index, count, &begin, &end);
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (getSimdLevel() >= SIMD_AVX2)
+    {
+        uniformAVX2(f->p, f->seed, f->stream, begin, end);
+        return;
+    }
+#endif
+
+    uniformScalar(f->p, f->seed, f->stream, begin, end);
+}
+
+void fillUniform(struct threadPool *pool, float *p, size_t n, cl_uint seed, cl_uint stream)
+{
+    struct fill f;
+    size_t i;
+    float v[4];
+
+    f.p = p;
+    f.n = n;
+    f.seed = seed;
+    f.stream = stream;
+
+    runThreadPool(pool, fillThread, &f);
+
+    if (n % 4 != 0)
+    {
+        uniformBlock(seed, stream, (cl_ulong)(n / 4), v);
+        for (i = n & ~(size_t)3; i < n; i += 1)
+        {
+            p[i] = v[i % 4];
+        }
+    }
+}
@@ -0,0 +1,58 @@
+// stats.c
+//
+// Summary statistics of repeated timings.
+//
+// The median and p95 describe a noisy benchmark better than the mean: a
+// single preempted run moves the mean and the stddev, not the median.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "clutil.h"
+
+static int compareDoubles(const void *a, const void *b)
+{
+    double x, y;
+
+    x = *(const double *)a;
+    y = *(const double *)b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// v is sorted in place. p95 is the nearest-rank percentile, stddev the
+// sample standard deviation (0 for a single value).
+void computeStats(double *v, int n, struct stats *s)
+{
+    double sum, dev;
+    int i;
+
+    memset(s, 0, sizeof(*s));
+    if (n <= 0)
+    {
+        return;
+    }
+
+    qsort(v, n, sizeof(*v), compareDoubles);
+
+    s->count = n;
+    s->min = v[0];
+    s->max = v[n - 1];
+    s->median = n % 2 != 0 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+    s->p95 = v[(95 * n + 99) / 100 - 1];
+
+    sum = 0;
+    for (i = 0; i < n; i += 1)
+    {
+        sum += v[i];
+    }
+    s->mean = sum / n;
+
+    dev = 0;
+    for (i = 0; i < n; i += 1)
+    {
+        dev += (v[i] - s->mean) * (v[i] - s->mean);
+    }
+    s->stddev = n > 1 ? sqrt(dev / (n - 1)) : 0;
+}
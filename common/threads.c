@@ -0,0 +1,271 @@
+// threads.c
+//
+// Small pthread pool for the host side reference code: every call to
+// runThreadPool runs the same function once on each thread, each thread
+// getting its index, and returns when all of them are done. The calling
+// thread takes index 0. Calls from several threads take turns.
+//
+// Also holds the runtime SIMD level used to dispatch host kernels.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "clutil.h"
+
+struct threadPool
+{
+    int count;
+    pthread_t *threads;
+
+    pthread_mutex_t lock;
+    pthread_mutex_t run;        // held by the thread running a job
+    pthread_cond_t start;
+    pthread_cond_t done;
+
+    unsigned long generation;   // bumped for each job
+    int pending;                // workers still running the job
+    int quit;
+
+    void (*fn)(void *arg, int index, int count);
+    void *arg;
+};
+
+struct worker
+{
+    struct threadPool *p;
+    int index;
+};
+
+void setLastCLError(char *fmt, ...);
+
+static void *threadMain(void *arg)
+{
+    struct threadPool *p;
+    unsigned long seen;
+    int index;
+
+    p = ((struct worker *)arg)->p;
+    index = ((struct worker *)arg)->index;
+    free(arg);
+
+    seen = 0;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;)
+    {
+        while (p->generation == seen && !p->quit)
+        {
+            pthread_cond_wait(&p->start, &p->lock);
+        }
+
+        if (p->quit)
+        {
+            break;
+        }
+
+        seen = p->generation;
+        pthread_mutex_unlock(&p->lock);
+
+        p->fn(p->arg, index, p->count);
+
+        pthread_mutex_lock(&p->lock);
+        p->pending -= 1;
+        if (p->pending == 0)
+        {
+            pthread_cond_signal(&p->done);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+struct threadPool *createThreadPool(int count)
+{
+    struct threadPool *p;
+    struct worker *w;
+    int i;
+
+    if (count <= 0)
+    {
+        count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (count <= 0)
+        {
+            count = 1;
+        }
+    }
+
+    p = (struct threadPool *)calloc(1, sizeof(*p));
+    if (p == NULL)
+    {
+        setLastCLError("Could not allocate memory [thread pool]\n");
+        return NULL;
+    }
+
+    p->threads = (pthread_t *)calloc(count, sizeof(*p->threads));
+    if (p->threads == NULL)
+    {
+        setLastCLError("Could not allocate memory [threads]\n");
+        free(p);
+        return NULL;
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_mutex_init(&p->run, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    // thread 0 is the caller
+    p->count = 1;
+    for (i = 1; i < count; i += 1)
+    {
+        w = (struct worker *)malloc(sizeof(*w));
+        if (w == NULL)
+        {
+            break;
+        }
+
+        w->p = p;
+        w->index = i;
+
+        if (pthread_create(&p->threads[i], NULL, threadMain, w) != 0)
+        {
+            free(w);
+            break;
+        }
+
+        p->count += 1;
+    }
+
+    return p;
+}
+
+void freeThreadPool(struct threadPool *p)
+{
+    int i;
+
+    if (p == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    for (i = 1; i < p->count; i += 1)
+    {
+        pthread_join(p->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->start);
+    pthread_mutex_destroy(&p->run);
+    pthread_mutex_destroy(&p->lock);
+
+    free(p->threads);
+    free(p);
+}
+
+int getThreadCount(struct threadPool *p)
+{
+    return p != NULL ? p->count : 1;
+}
+
+void runThreadPool(struct threadPool *p, void (*fn)(void *arg, int index, int count), void *arg)
+{
+    if (p == NULL || p->count == 1)
+    {
+        fn(arg, 0, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&p->run);
+
+    pthread_mutex_lock(&p->lock);
+    p->fn = fn;
+    p->arg = arg;
+    p->pending = p->count - 1;
+    p->generation += 1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    fn(arg, 0, p->count);
+
+    pthread_mutex_lock(&p->lock);
+    while (p->pending != 0)
+    {
+        pthread_cond_wait(&p->done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    pthread_mutex_unlock(&p->run);
+}
+
+// Split [0, n) in count parts, boundaries on multiples of align (a power
+// of two, keeps each part's SIMD loop aligned and away from its
+// neighbour's cache lines).
+void splitRange(size_t n, size_t align, int index, int count, size_t *begin, size_t *end)
+{
+    size_t step;
+
+    step = (n + count - 1) / count;
+    step = (step + align - 1) & ~(align - 1);
+
+    *begin = step * index;
+    *end = *begin + step;
+
+    if (*begin > n)
+    {
+        *begin = n;
+    }
+
+    if (*end > n)
+    {
+        *end = n;
+    }
+}
+
+int getSimdLevel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return SIMD_AVX512;
+    }
+
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return SIMD_AVX2;
+    }
+
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return SIMD_SSE;
+    }
+#endif
+
+    return SIMD_SCALAR;
+}
+
+const char *getSimdName(int level)
+{
+    switch (level)
+    {
+    case SIMD_SSE:
+        return "sse";
+
+    case SIMD_AVX2:
+        return "avx2";
+
+    case SIMD_AVX512:
+        return "avx512";
+    }
+
+    return "scalar";
+}
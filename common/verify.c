@@ -0,0 +1,204 @@
+// verify.c
+//
+// Threaded, SIMD comparison of a result against a host reference.
+//
+// Floats are compared by ULP distance: their bits are mapped to integers
+// that are ordered like the floats, so the distance is a subtraction.
+// Every element is checked, the caller gets the number of mismatches and
+// the first one instead of a stop at the first difference.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "clutil.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define MAX_THREADS 256
+
+struct compare
+{
+    const float *x;
+    const float *ref;
+    size_t n;
+    cl_uint ulp;
+
+    size_t count[MAX_THREADS];
+    size_t first[MAX_THREADS];
+};
+
+static cl_uint orderedBits(float f)
+{
+    cl_uint i;
+
+    // negative floats reversed below 0x80000000, positive ones above
+    memcpy(&i, &f, sizeof(i));
+    return (i & 0x80000000u) != 0 ? ~i : i | 0x80000000u;
+}
+
+cl_uint ulpDistance(float a, float b)
+{
+    cl_uint i, j;
+
+    if (a == b)
+    {
+        return 0;
+    }
+
+    i = orderedBits(a);
+    j = orderedBits(b);
+
+    return i > j ? i - j : j - i;
+}
+
+static size_t compareScalar(const float *x, const float *ref, size_t n, cl_uint ulp, size_t *first)
+{
+    size_t i, count;
+
+    count = 0;
+    for (i = 0; i < n; i += 1)
+    {
+        // NaN never matches, even itself
+        if (x[i] != x[i] || ref[i] != ref[i] || ulpDistance(x[i], ref[i]) > ulp)
+        {
+            if (count == 0)
+            {
+                *first = i;
+            }
+            count += 1;
+        }
+    }
+
+    return count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static __m256i orderedBits8(__m256 f)
+{
+    __m256i i, neg;
+
+    i = _mm256_castps_si256(f);
+    neg = _mm256_srai_epi32(i, 31);
+
+    // neg: ~i, else i | 0x80000000
+    return _mm256_xor_si256(i, _mm256_or_si256(neg, _mm256_set1_epi32((int)0x80000000u)));
+}
+
+__attribute__((target("avx2"))) static size_t compareAVX2(const float *x, const float *ref, size_t n,
+                                                          cl_uint ulp, size_t *first)
+{
+    __m256 a, b;
+    __m256i i, j, d, lim, ok;
+    size_t k, count;
+    int mask;
+
+    count = 0;
+    lim = _mm256_set1_epi32((int)ulp);
+
+    for (k = 0; k + 8 <= n; k += 8)
+    {
+        a = _mm256_loadu_ps(x + k);
+        b = _mm256_loadu_ps(ref + k);
+
+        i = orderedBits8(a);
+        j = orderedBits8(b);
+        d = _mm256_sub_epi32(_mm256_max_epu32(i, j), _mm256_min_epu32(i, j));
+
+        // ok: a == b (not NaN, +0 == -0), or both numbers and d <= ulp
+        ok = _mm256_cmpeq_epi32(_mm256_max_epu32(d, lim), lim);
+        ok = _mm256_and_si256(ok, _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_ORD_Q)));
+        ok = _mm256_or_si256(ok, _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)));
+
+        mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(ok)) & 0xff;
+        if (mask != 0)
+        {
+            if (count == 0)
+            {
+                *first = k + __builtin_ctz(mask);
+            }
+            count += __builtin_popcount(mask);
+        }
+    }
+
+    if (k < n)
+    {
+        size_t f, c;
+
+        c = compareScalar(x + k, ref + k, n - k, ulp, &f);
+        if (c != 0 && count == 0)
+        {
+            *first = k + f;
+        }
+        count += c;
+    }
+
+    return count;
+}
+#endif
+
+static void compareThread(void *arg, int index, int count)
+{
+    struct compare *c;
+    size_t begin, end;
+
+    c = (struct compare *)arg;
+    splitRange(c->n, 16, index, count, &begin, &end);
+
+    c->first[index] = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (getSimdLevel() >= SIMD_AVX2)
+    {
+        c->count[index] = compareAVX2(c->x + begin, c->ref + begin, end - begin, c->ulp, &c->first[index]);
+        c->first[index] += begin;
+        return;
+    }
+#endif
+
+    c->count[index] = compareScalar(c->x + begin, c->ref + begin, end - begin, c->ulp, &c->first[index]);
+    c->first[index] += begin;
+}
+
+size_t compareFloats(struct threadPool *pool, const float *x, const float *ref, size_t n, cl_uint ulp, size_t *first)
+{
+    struct compare *c;
+    size_t count;
+    int i;
+
+    if (getThreadCount(pool) > MAX_THREADS)
+    {
+        pool = NULL;
+    }
+
+    c = (struct compare *)malloc(sizeof(*c));
+    if (c == NULL)
+    {
+        // fall back to one thread, nothing allocated
+        *first = 0;
+        count = compareScalar(x, ref, n, ulp, first);
+        return count;
+    }
+
+    c->x = x;
+    c->ref = ref;
+    c->n = n;
+    c->ulp = ulp;
+
+    runThreadPool(pool, compareThread, c);
+
+    count = 0;
+    *first = n;
+    for (i = 0; i < getThreadCount(pool); i += 1)
+    {
+        if (c->count[i] != 0 && count == 0)
+        {
+            *first = c->first[i];
+        }
+        count += c->count[i];
+    }
+
+    free(c);
+    return count;
+}